@@ -9,7 +9,9 @@ BuildRequires: cmake
 BuildRequires: make
 BuildRequires: libev
 BuildRequires: libev-devel
+BuildRequires: zlib-devel
 Requires:      libev
+Requires:      zlib
 Source:        https://github.com/jesperpedersen/pgprtdbg/releases/%{name}-%{version}.tar.gz
 
 %description
@@ -46,10 +48,12 @@ cmake -DCMAKE_BUILD_TYPE=Release ..
 %{__install} -m 644 %{_builddir}/%{name}-%{version}/doc/etc/pgprtdbg.conf %{buildroot}%{_sysconfdir}/pgprtdbg.conf
 
 %{__install} -m 755 %{_builddir}/%{name}-%{version}/build/src/pgprtdbg %{buildroot}%{_bindir}/pgprtdbg
+%{__install} -m 755 %{_builddir}/%{name}-%{version}/build/src/pgprtdbg-convert %{buildroot}%{_bindir}/pgprtdbg-convert
 
 %{__install} -m 755 %{_builddir}/%{name}-%{version}/build/src/libpgprtdbg.so.%{version} %{buildroot}%{_libdir}/libpgprtdbg.so.%{version}
 
 chrpath -r %{_libdir} %{buildroot}%{_bindir}/pgprtdbg
+chrpath -r %{_libdir} %{buildroot}%{_bindir}/pgprtdbg-convert
 
 cd %{buildroot}%{_libdir}/
 %{__ln_s} libpgprtdbg.so.%{version} libpgprtdbg.so.0
@@ -67,6 +71,7 @@ cd %{buildroot}%{_libdir}/
 %{_docdir}/%{name}/RPM.md
 %config %{_sysconfdir}/pgprtdbg.conf
 %{_bindir}/pgprtdbg
+%{_bindir}/pgprtdbg-convert
 %{_libdir}/libpgprtdbg.so
 %{_libdir}/libpgprtdbg.so.0
 %{_libdir}/libpgprtdbg.so.%{version}
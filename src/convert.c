@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2024 The pgprtdbg community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgprtdbg */
+#include <pgprtdbg.h>
+#include <tracefile.h>
+
+/* system */
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static void
+version()
+{
+   printf("pgprtdbg-convert %s\n", VERSION);
+   exit(1);
+}
+
+static void
+usage()
+{
+   printf("pgprtdbg-convert %s\n", VERSION);
+   printf("  Convert a binary pgprtdbg output to the CSV output\n");
+   printf("\n");
+
+   printf("Usage:\n");
+   printf("  pgprtdbg-convert [ -s ] FILE...\n");
+   printf("\n");
+   printf("Options:\n");
+   printf("  -s, --sockets            Include the socket descriptors, like output_sockets\n");
+   printf("  -V, --version            Display version information\n");
+   printf("  -?, --help               Display help\n");
+   printf("\n");
+
+   exit(1);
+}
+
+int
+main(int argc, char** argv)
+{
+   bool sockets = false;
+   char line[MISC_LENGTH];
+   size_t length;
+   int status = 0;
+   int c;
+   struct tracefile_reader* reader = NULL;
+   struct tracefile_record* record = NULL;
+
+   while (1)
+   {
+      static struct option long_options[] =
+      {
+         {"sockets", no_argument, 0, 's'},
+         {"version", no_argument, 0, 'V'},
+         {"help", no_argument, 0, '?'},
+         {0, 0, 0, 0}
+      };
+      int option_index = 0;
+
+      c = getopt_long (argc, argv, "sV?",
+                       long_options, &option_index);
+
+      if (c == -1)
+      {
+         break;
+      }
+
+      switch (c)
+      {
+         case 's':
+            sockets = true;
+            break;
+         case 'V':
+            version();
+            break;
+         case '?':
+            usage();
+            break;
+         default:
+            break;
+      }
+   }
+
+   if (optind >= argc)
+   {
+      usage();
+   }
+
+   for (int i = optind; i < argc; i++)
+   {
+      if (pgprtdbg_tracefile_open(argv[i], &reader))
+      {
+         fprintf(stderr, "pgprtdbg-convert: %s isn't a binary pgprtdbg output\n", argv[i]);
+         status = 1;
+         continue;
+      }
+
+      while (!pgprtdbg_tracefile_next(reader, &record))
+      {
+         length = pgprtdbg_tracefile_csv(&line[0], sizeof(line), record->direction, record->from, record->to,
+                                         record->kind, record->text_length > 0 ? pgprtdbg_tracefile_text(record) : NULL,
+                                         record->text_length, sockets);
+         fwrite(&line[0], 1, length, stdout);
+      }
+
+      pgprtdbg_tracefile_close(reader);
+      reader = NULL;
+   }
+
+   fflush(stdout);
+
+   return status;
+}
@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2024 The pgprtdbg community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGPRTDBG_ADMISSION_H
+#define PGPRTDBG_ADMISSION_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <ev.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+
+#define ADMISSION_POLL 0.01
+
+struct admission;
+
+/**
+ * Start or stop the accept watchers of an event loop
+ * @param data The event loop data
+ * @param start Start the watchers, otherwise stop them
+ */
+typedef void (*admission_accept)(void* data, bool start);
+
+/**
+ * Start a session for a client that got a connection slot
+ * @param data The event loop data
+ * @param client_fd The client descriptor
+ * @param slot The session slot of the client
+ * @param peer The address of the client
+ */
+typedef void (*admission_admit)(void* data, int client_fd, int slot, struct sockaddr_storage* peer);
+
+/**
+ * Take a connection slot
+ * @param slot The resulting session slot
+ * @return True if a slot was free, otherwise false
+ */
+bool
+pgprtdbg_admission_acquire(int* slot);
+
+/**
+ * Give back a connection slot
+ * @param slot The session slot
+ */
+void
+pgprtdbg_admission_release(int slot);
+
+/**
+ * Create the admission queue of an event loop
+ * @param loop The event loop
+ * @param accept The function starting and stopping the accept watchers
+ * @param admit The function starting a session
+ * @param data The event loop data
+ * @param admission The resulting admission queue
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgprtdbg_admission_init(struct ev_loop* loop, admission_accept accept, admission_admit admit, void* data, struct admission** admission);
+
+/**
+ * Destroy an admission queue, and close the clients still waiting
+ * @param admission The admission queue
+ */
+void
+pgprtdbg_admission_destroy(struct admission* admission);
+
+/**
+ * Close the descriptors of the queued clients inherited by a child
+ * process, without touching the event loop of the parent
+ * @param admission The admission queue
+ */
+void
+pgprtdbg_admission_forget(struct admission* admission);
+
+/**
+ * Is a client accepted now admitted, or queued, right away. Otherwise the
+ * accept watchers are stopped until a slot frees up
+ * @param admission The admission queue
+ * @return True if a client can be accepted, otherwise false
+ */
+bool
+pgprtdbg_admission_open(struct admission* admission);
+
+/**
+ * Admit an accepted client, or queue it if there is no slot
+ * @param admission The admission queue
+ * @param client_fd The client descriptor
+ * @param peer The address of the client
+ */
+void
+pgprtdbg_admission_offer(struct admission* admission, int client_fd, struct sockaddr_storage* peer);
+
+/**
+ * Admit the queued clients now, when a slot of this event loop frees up
+ * @param admission The admission queue
+ */
+void
+pgprtdbg_admission_wakeup(struct admission* admission);
+
+/**
+ * Print the admission metrics
+ * @param file The file
+ */
+void
+pgprtdbg_admission_output_statistics(FILE* file);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,105 @@
+/*
+ * Copyright (C) 2024 The pgprtdbg community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGPRTDBG_COMPRESSION_H
+#define PGPRTDBG_COMPRESSION_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pgprtdbg.h>
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+struct compression;
+
+/**
+ * Is compression available, which needs pgprtdbg to be built with zlib
+ * @return True if available, otherwise false
+ */
+bool
+pgprtdbg_compression_available(void);
+
+/**
+ * Create a compression stream. The stream is one gzip member, which
+ * lasts until it is finished
+ * @param compression The resulting stream
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgprtdbg_compression_create(struct compression** compression);
+
+/**
+ * Compress data to a file. The data may be held back by the stream
+ * until the next flush
+ * @param compression The stream
+ * @param file The file
+ * @param data The data
+ * @param length The length of the data
+ * @param written The number of bytes written to the file
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgprtdbg_compression_write(struct compression* compression, FILE* file, char* data, size_t length, size_t* written);
+
+/**
+ * Write the data held back by the stream, so the file can be read up to
+ * here while it is still being written
+ * @param compression The stream
+ * @param file The file
+ * @param written The number of bytes written to the file
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgprtdbg_compression_flush(struct compression* compression, FILE* file, size_t* written);
+
+/**
+ * End the gzip member; the next write starts a new one
+ * @param compression The stream
+ * @param file The file
+ * @param written The number of bytes written to the file
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgprtdbg_compression_finish(struct compression* compression, FILE* file, size_t* written);
+
+/**
+ * Destroy a compression stream
+ * @param compression The stream
+ */
+void
+pgprtdbg_compression_destroy(struct compression* compression);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
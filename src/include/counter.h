@@ -30,8 +30,7 @@
 #define PGPRTDBG_COUNTER_H
 
 #include <inttypes.h>
-
-#define MAX_NUMBER_OF_COUNTERS MAX_NUMBER_OF_CONNECTIONS
+#include <netinet/in.h>
 
 /** @struct
  * Holds collected events for one client.
@@ -43,16 +42,25 @@ struct event_counter
    uint64_t sent_bytes;
    uint32_t rcvd_messages;
    uint32_t sent_messages;
+   char address[INET6_ADDRSTRLEN];
 };
 
 extern size_t event_counters_offset;
 
 /**
- * Gets a new event_counter.
- * @return Pointer to the next struct event_counter.
+ * Gets the size of the event counters in the shared memory segment.
+ * @return The size
+ */
+size_t
+pgprtdbg_counter_size(void);
+
+/**
+ * Gets the event_counter of a session slot.
+ * @param slot The session slot
+ * @return Pointer to the struct event_counter.
  */
 struct event_counter*
-pgprtdbg_counter_get(int client_number);
+pgprtdbg_counter_get(int slot);
 
 /**
  * Outputs the statistics for all counters.
@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2024 The pgprtdbg community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGPRTDBG_CURSOR_H
+#define PGPRTDBG_CURSOR_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/** @struct
+ * Reads the fields of a message in place. A read past the end of the
+ * message sets the error flag and returns an empty value, so a truncated
+ * or malformed message can never be read out of bounds
+ */
+struct cursor
+{
+   char* data;    /**< The message */
+   size_t length; /**< The length of the message */
+   size_t offset; /**< The position of the next field */
+   bool error;    /**< Has a read gone past the end */
+};
+
+/**
+ * Initialize a cursor
+ * @param cursor The cursor
+ * @param data The message
+ * @param length The length of the message
+ */
+void
+pgprtdbg_cursor_init(struct cursor* cursor, void* data, size_t length);
+
+/**
+ * Get the number of bytes left
+ * @param cursor The cursor
+ * @return The number of bytes
+ */
+size_t
+pgprtdbg_cursor_remaining(struct cursor* cursor);
+
+/**
+ * Read a byte
+ * @param cursor The cursor
+ * @return The byte, or 0
+ */
+signed char
+pgprtdbg_cursor_byte(struct cursor* cursor);
+
+/**
+ * Read an int16
+ * @param cursor The cursor
+ * @return The int16, or 0
+ */
+int16_t
+pgprtdbg_cursor_int16(struct cursor* cursor);
+
+/**
+ * Read an int32
+ * @param cursor The cursor
+ * @return The int32, or 0
+ */
+int32_t
+pgprtdbg_cursor_int32(struct cursor* cursor);
+
+/**
+ * Read a zero terminated string, without copying it
+ * @param cursor The cursor
+ * @return The string, or an empty string
+ */
+char*
+pgprtdbg_cursor_string(struct cursor* cursor);
+
+/**
+ * Get a view of the next bytes, without copying them
+ * @param cursor The cursor
+ * @param length The number of bytes
+ * @return The bytes, or NULL
+ */
+char*
+pgprtdbg_cursor_view(struct cursor* cursor, size_t length);
+
+/**
+ * Skip the next bytes
+ * @param cursor The cursor
+ * @param length The number of bytes
+ * @return True if the bytes were there, otherwise false
+ */
+bool
+pgprtdbg_cursor_skip(struct cursor* cursor, size_t length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2024 The pgprtdbg community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGPRTDBG_DECODER_H
+#define PGPRTDBG_DECODER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pgprtdbg.h>
+#include <protocol.h>
+#include <worker.h>
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#define DECODER_RING_SIZE (16 * 1024 * 1024)
+
+struct decoder_stage;
+
+/**
+ * Start a decoder stage: a thread decoding the traffic forwarded by one event loop
+ * @param stage The resulting stage
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgprtdbg_decoder_stage_start(struct decoder_stage** stage);
+
+/**
+ * Stop a decoder stage, once it has decoded everything queued
+ * @param stage The stage
+ */
+void
+pgprtdbg_decoder_stage_stop(struct decoder_stage* stage);
+
+/**
+ * Queue forwarded data for decoding. If the stage is behind the session
+ * isn't traced anymore, since the forwarding never waits for it
+ * @param session The session
+ * @param client Is the data from the client
+ * @param msg The data
+ */
+void
+pgprtdbg_decoder_stage_trace(struct worker_session* session, bool client, struct message* msg);
+
+/**
+ * Hand the decoder of a finished session to the stage, which frees it
+ * @param stage The stage
+ * @param decoder The decoder
+ */
+void
+pgprtdbg_decoder_stage_close(struct decoder_stage* stage, struct decoder* decoder);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
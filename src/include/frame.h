@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2024 The pgprtdbg community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGPRTDBG_FRAME_H
+#define PGPRTDBG_FRAME_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdlib.h>
+
+/** @struct
+ * The bytes of one direction not decoded yet. Messages are decoded in place,
+ * and the buffer is only compacted when a message doesn't fit behind the
+ * buffered bytes
+ */
+struct frame
+{
+   char* data;      /**< The buffer */
+   size_t capacity; /**< The size of the buffer */
+   size_t start;    /**< The first byte not decoded yet */
+   size_t end;      /**< The end of the buffered bytes */
+};
+
+/**
+ * Get the bytes to decode: the new data itself when nothing is buffered,
+ * otherwise the buffered bytes followed by the new data
+ * @param frame The frame
+ * @param data The new data
+ * @param length The length of the new data
+ * @param size The resulting number of bytes to decode
+ * @return The bytes to decode, or NULL if the buffer couldn't grow
+ */
+char*
+pgprtdbg_frame_begin(struct frame* frame, void* data, size_t length, size_t* size);
+
+/**
+ * Keep the bytes that weren't decoded, which is a partial message
+ * @param frame The frame
+ * @param buffer The bytes from pgprtdbg_frame_begin
+ * @param size The number of bytes from pgprtdbg_frame_begin
+ * @param consumed The number of bytes decoded
+ * @return 0 upon success, otherwise 1 if the buffer couldn't grow
+ */
+int
+pgprtdbg_frame_end(struct frame* frame, char* buffer, size_t size, size_t consumed);
+
+/**
+ * Drop the buffered bytes, and free the buffer
+ * @param frame The frame
+ */
+void
+pgprtdbg_frame_destroy(struct frame* frame);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -37,8 +37,20 @@ extern "C" {
 
 #include <stdlib.h>
 
+/** @struct
+ * Scratch memory handed out in order, and given back all at once
+ */
+struct arena
+{
+   char* data;      /**< The memory */
+   size_t capacity; /**< The size of the memory */
+   size_t used;     /**< The memory handed out */
+   size_t peak;     /**< The most memory handed out between two resets */
+   void* retired;   /**< The outgrown memory, freed at the next reset */
+};
+
 /**
- * Initialize a memory segment for the process local message structure
+ * Initialize a memory segment for the thread local message structure
  */
 void
 pgprtdbg_memory_init(void);
@@ -51,12 +63,25 @@ struct message*
 pgprtdbg_memory_message(void);
 
 /**
- * Get the pointer to the message data section
+ * Get the pointer to the message data section; the next free part of the batch
  * @return The pointer
  */
 void*
 pgprtdbg_memory_data(void);
 
+/**
+ * Keep the last message in the batch, and move the data section after it
+ * @param length The length of the message
+ */
+void
+pgprtdbg_memory_advance(size_t length);
+
+/**
+ * Start a new batch, without clearing the memory segment
+ */
+void
+pgprtdbg_memory_rewind(void);
+
 /**
  * Free the memory segment
  */
@@ -69,6 +94,30 @@ pgprtdbg_memory_free(void);
 void
 pgprtdbg_memory_destroy(void);
 
+/**
+ * Get memory from an arena. It stays valid until the arena is reset
+ * @param arena The arena
+ * @param size The size
+ * @return The memory, or NULL
+ */
+void*
+pgprtdbg_arena_alloc(struct arena* arena, size_t size);
+
+/**
+ * Give back all the memory of an arena. The arena keeps room for as much
+ * as was used, so it doesn't allocate again in steady state
+ * @param arena The arena
+ */
+void
+pgprtdbg_arena_reset(struct arena* arena);
+
+/**
+ * Free the memory of an arena
+ * @param arena The arena
+ */
+void
+pgprtdbg_arena_destroy(struct arena* arena);
+
 #ifdef __cplusplus
 }
 #endif
@@ -69,6 +69,16 @@ pgprtdbg_read_block_message(int socket, struct message** msg);
 int
 pgprtdbg_write_message(int socket, struct message* msg);
 
+/**
+ * Write as much of a message as the non-blocking socket accepts
+ * @param socket The socket descriptor
+ * @param msg The message
+ * @param written The number of bytes written
+ * @return MESSAGE_STATUS_OK or MESSAGE_STATUS_ERROR
+ */
+int
+pgprtdbg_write_nonblock_message(int socket, struct message* msg, ssize_t* written);
+
 /**
  * Create a message
  * @param data A pointer to the data
@@ -110,7 +120,8 @@ int32_t
 pgprtdbg_get_request(struct message* msg);
 
 /**
- * Write an empty message
+ * Write an empty message, without blocking. The client is disconnected
+ * afterwards, so what doesn't fit in the socket buffer is dropped
  * @param socket The socket descriptor
  * @return 0 upon success, otherwise 1
  */
@@ -118,13 +129,24 @@ int
 pgprtdbg_write_empty(int socket);
 
 /**
- * Write a connection refused message (protocol 1 or 2)
+ * Write a connection refused message (protocol 1 or 2), without blocking.
+ * The client is disconnected afterwards, so what doesn't fit in the socket
+ * buffer is dropped
  * @param socket The socket descriptor
  * @return 0 upon success, otherwise 1
  */
 int
 pgprtdbg_write_connection_refused_old(int socket);
 
+/**
+ * Write a too many connections error, without blocking. The client is
+ * disconnected afterwards, so what doesn't fit in the socket buffer is dropped
+ * @param socket The socket descriptor
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgprtdbg_write_too_many_connections(int socket);
+
 #ifdef __cplusplus
 }
 #endif
@@ -33,6 +33,7 @@
 extern "C" {
 #endif
 
+#include <stdbool.h>
 #include <stdlib.h>
 #include <sys/socket.h>
 
@@ -48,14 +49,74 @@ int
 pgprtdbg_bind(const char* hostname, int port, int** fds, int* length);
 
 /**
- * Connect to a host
- * @param hostname The host name
- * @param port The port number
+ * Resolve the addresses of a server into the shared memory segment.
+ * The previous addresses are kept upon failure
+ * @param server The server
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgprtdbg_resolve(int server);
+
+/**
+ * Get a resolved address of a server
+ * @param server The server
+ * @param index The index of the address
+ * @param address The resulting address
+ * @param length The resulting length of the address
+ * @return 0 upon success, otherwise 1 if there is no such address
+ */
+int
+pgprtdbg_server_address(int server, int index, struct sockaddr_storage* address, socklen_t* length);
+
+/**
+ * Resolve the servers, and start refreshing their addresses every dns_refresh seconds
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgprtdbg_resolver_start(void);
+
+/**
+ * Stop refreshing the addresses of the servers
+ */
+void
+pgprtdbg_resolver_stop(void);
+
+/**
+ * Start a non-blocking connect to an address
+ * @param address The address
+ * @param length The length of the address
  * @param fd The resulting descriptor
  * @return 0 upon success, otherwise 1
  */
 int
-pgprtdbg_connect(const char* hostname, int port, int* fd);
+pgprtdbg_connect(struct sockaddr* address, socklen_t length, int* fd);
+
+/**
+ * Get the result of a non-blocking connect, once the descriptor is writable
+ * @param fd The descriptor
+ * @return 0 if connected, otherwise 1
+ */
+int
+pgprtdbg_connect_result(int fd);
+
+/**
+ * Accept a connection as a non-blocking, close-on-exec descriptor
+ * @param fd The listening descriptor
+ * @param address The resulting peer address
+ * @param client_fd The resulting descriptor
+ * @return 0 upon success, otherwise 1 if there is no connection waiting
+ */
+int
+pgprtdbg_accept(int fd, struct sockaddr_storage* address, int* client_fd);
+
+/**
+ * Format the host of an address
+ * @param address The address
+ * @param text The resulting text
+ * @param length The size of text
+ */
+void
+pgprtdbg_address_text(struct sockaddr_storage* address, char* text, size_t length);
 
 /**
  * Disconnect from a descriptor
@@ -100,6 +161,24 @@ pgprtdbg_tcp_nodelay(int fd);
 int
 pgprtdbg_socket_buffers(int fd);
 
+/**
+ * Set O_NONBLOCK on a descriptor
+ * @param fd The descriptor
+ * @param value The value
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgprtdbg_socket_nonblocking(int fd, bool value);
+
+/**
+ * Set the number of bytes a descriptor needs before it is reported readable
+ * @param fd The descriptor
+ * @param bytes The number of bytes
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgprtdbg_socket_rcvlowat(int fd, int bytes);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2024 The pgprtdbg community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGPRTDBG_OUTPUT_H
+#define PGPRTDBG_OUTPUT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pgprtdbg.h>
+
+#include <stdlib.h>
+
+/**
+ * Open the output file, or the first output segment when the output is
+ * segmented. The file is inherited by the processes forked afterwards
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgprtdbg_output_open(void);
+
+/**
+ * Close the output file of the calling process
+ */
+void
+pgprtdbg_output_close(void);
+
+/**
+ * Write a trace line to the output file. The line is kept in the output
+ * buffer of the calling thread, which is written once it holds output_buffer
+ * bytes, or when it is flushed
+ * @param line The line
+ * @param length The length of the line
+ */
+void
+pgprtdbg_output_write(char* line, size_t length);
+
+/**
+ * Write data to the output file right away. A segmented output is rotated
+ * first, once the current segment has reached its size or age
+ * @param data The data
+ * @param length The length of the data
+ */
+void
+pgprtdbg_output_write_file(char* data, size_t length);
+
+/**
+ * Write the output buffer of the calling thread to the output file
+ */
+void
+pgprtdbg_output_flush(void);
+
+/**
+ * Flush and free the output buffer, and the compression state, of the calling thread
+ */
+void
+pgprtdbg_output_release(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
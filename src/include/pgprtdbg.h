@@ -37,20 +37,48 @@ extern "C" {
 #include <semaphore.h>
 #include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
+#include <sys/socket.h>
 #include <sys/types.h>
 
 #define VERSION "0.4.0"
 
 #define MAX_BUFFER_SIZE      65535
 #define DEFAULT_BUFFER_SIZE  65535
+#define DEFAULT_READ_BUDGET  16
+#define DEFAULT_DECODE_LIMIT (1024 * 1024)
+#define DEFAULT_OUTPUT_BUFFER (64 * 1024)
+#define DEFAULT_OUTPUT_FLUSH_INTERVAL 1000
+
+#define DEFAULT_CONNECT_TIMEOUT 5
+#define DEFAULT_DNS_REFRESH     60
+#define DEFAULT_POOL_LIFETIME   30
+#define DEFAULT_ADMISSION_TIMEOUT 5
+#define DEFAULT_MAX_CONNECTIONS   100
+
+#define MAX_ADDRESSES 8
+
+#define MAX_NUMBER_OF_SERVERS 16
+
+#define SERVER_UP   0
+#define SERVER_DOWN 1
+
+#define BALANCE_ROUND_ROBIN       0
+#define BALANCE_LEAST_CONNECTIONS 1
+
+#define COMPRESSION_NONE 0
+#define COMPRESSION_GZIP 1
+
+#define OUTPUT_FORMAT_CSV    0
+#define OUTPUT_FORMAT_BINARY 1
 
 #define IDENTIFIER_LENGTH 64
 #define MISC_LENGTH 128
 
-#define MAX_NUMBER_OF_CONNECTIONS 1000
+#define MAX_NUMBER_OF_CONNECTIONS 10000
 
 #define STATE_FREE   0
 #define STATE_IN_USE 1
@@ -76,8 +104,36 @@ struct server
    char name[MISC_LENGTH]; /**< The name of the server */
    char host[MISC_LENGTH]; /**< The host name of the server */
    int port;               /**< The port of the server */
+
+   atomic_uint sequence;                                /**< Odd while the addresses are updated */
+   int number_of_addresses;                             /**< The number of resolved addresses */
+   struct sockaddr_storage addresses[MAX_ADDRESSES];    /**< The resolved addresses */
+   socklen_t address_lengths[MAX_ADDRESSES];            /**< The lengths of the resolved addresses */
+
+   atomic_int state;       /**< The health of the server */
+   atomic_long retry;      /**< The time at which a server that is down is tried again */
+   atomic_int connections; /**< The number of sessions connected to the server */
 } __attribute__ ((aligned (64)));
 
+/** @struct
+ * Defines a session slot, which also selects the event counter of the session
+ */
+struct slot
+{
+   atomic_int pid;  /**< The process serving the session, or 0 */
+   atomic_int next; /**< The next free slot + 1, or 0 */
+};
+
+/** @struct
+ * Defines the BackendKeyData of a session, used to route a CancelRequest
+ */
+struct backend_key
+{
+   atomic_int process; /**< The process identifier of the backend, or 0 if free */
+   int32_t secret;     /**< The secret key */
+   int server;         /**< The server */
+};
+
 /** @struct
  * Defines the configuration and state of pgprtdbg
  */
@@ -87,13 +143,27 @@ struct configuration
    int port;               /**< The port */
 
    char output[MISC_LENGTH]; /**< The output path */
-   FILE* file;               /**< The file */
    sem_t lock;               /**< The file lock */
 
    char statistics_output[MISC_LENGTH];
 
    bool output_sockets;      /**< Output socket identifiers */
    bool save_traffic;        /**< Save the traffic in files */
+   bool passthrough;         /**< Forward the traffic without decoding it */
+   bool io_uring;            /**< Use the io_uring data path */
+   bool async_decode;        /**< Decode on a separate thread, after forwarding */
+   bool trace_writer;        /**< Write the trace from a separate process */
+   int trace_rings;          /**< The number of trace rings, one for each process or thread that traces */
+
+   int output_buffer;         /**< The size of the output buffer of each thread, 0 for none */
+   int output_flush_interval; /**< The interval in milliseconds for flushing the output buffers, 0 for never */
+   bool output_flush_ready;   /**< Flush the output buffer on ReadyForQuery */
+   int output_segment_size;   /**< The size in megabytes of an output segment, 0 for no limit */
+   int output_segment_age;    /**< The age in seconds of an output segment, 0 for no limit */
+   int output_segments;       /**< The number of output segments kept, 0 for all */
+   int compression;           /**< The compression of the output and the traffic files */
+   int output_format;         /**< The format of the output */
+   int output_payload;        /**< The number of message bytes kept in a binary output record */
 
    char unix_socket_dir[MISC_LENGTH]; /**< The directory for the Unix Domain Socket */
 
@@ -103,14 +173,40 @@ struct configuration
 
    char libev[MISC_LENGTH]; /**< Name of libev mode */
    int buffer_size;         /**< Socket buffer size */
+   int read_budget;         /**< The maximum number of reads per event loop wakeup */
+   int decode_limit;        /**< The size of the largest message buffered for decoding */
    bool keep_alive;         /**< Use keep alive */
    bool nodelay;            /**< Use NODELAY */
    int backlog;             /**< The backlog for listen */
+   int max_connections;     /**< The maximum number of sessions */
+   int workers;             /**< The number of pre-forked workers */
+   int threads;             /**< The number of event loop threads */
+   int connect_timeout;     /**< The timeout in seconds for connecting to the server */
+   int dns_refresh;         /**< The interval in seconds for resolving the server again */
+   int pool_size;           /**< The number of established server connections kept by each event loop */
+   int pool_lifetime;       /**< The lifetime in seconds of an unused server connection */
+   int admission_queue;     /**< The number of clients each event loop queues at the connection limit */
+   int admission_timeout;   /**< The maximum wait in seconds of a queued client */
 
    atomic_ushort active_connections;      /**< The active number of connections */
-   pid_t pids[MAX_NUMBER_OF_CONNECTIONS]; /**< The PIDS of the connections */
-
-   struct server server[1]; /**< The server */
+   atomic_int admission_queued;           /**< The number of clients waiting for a connection slot */
+   atomic_int admission_queued_max;       /**< The maximum number of clients waiting at once */
+   atomic_long admission_waits;           /**< The number of clients admitted after waiting */
+   atomic_long admission_wait_time;       /**< The total wait in milliseconds of the admitted clients */
+   atomic_long admission_wait_max;        /**< The longest wait in milliseconds of an admitted client */
+   atomic_long admission_rejected;        /**< The number of clients rejected at the connection limit */
+   atomic_long trace_dropped;             /**< The number of trace records dropped as the writer fell behind */
+   atomic_int clients;                    /**< The number of session slots used so far */
+   atomic_int sessions;                   /**< The number of sessions started so far, which numbers them */
+   atomic_uint_least64_t free_slots;      /**< The free list of the session slots */
+   unsigned int output_segment;           /**< The current output segment, 0 if not segmented */
+   size_t output_segment_bytes;           /**< The bytes written to the current output segment */
+   time_t output_segment_start;           /**< The time the current output segment was opened */
+
+   int balance;                                     /**< The selection of the server for a session */
+   atomic_uint round_robin;                         /**< The round robin position */
+   int number_of_servers;                           /**< The number of servers */
+   struct server server[MAX_NUMBER_OF_SERVERS];     /**< The servers */
 } __attribute__ ((aligned (64)));
 
 /** @struct
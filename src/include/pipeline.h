@@ -36,6 +36,7 @@ extern "C" {
 #include <worker.h>
 
 #include <ev.h>
+#include <stdbool.h>
 #include <stdlib.h>
 
 void
@@ -44,6 +45,41 @@ pipeline_client(struct ev_loop* loop, struct ev_io* watcher, int revents);
 void
 pipeline_server(struct ev_loop* loop, struct ev_io* watcher, int revents);
 
+/**
+ * Is the splice() passthrough pipeline available
+ * @return True if available, otherwise false
+ */
+bool
+pipeline_splice_available(void);
+
+/**
+ * Create the pipes of the passthrough pipeline for one direction
+ * @param wi The worker structure
+ * @param client Is this the client to server direction
+ * @return 0 upon success, otherwise 1
+ */
+int
+pipeline_splice_init(struct worker_io* wi, bool client);
+
+/**
+ * Close the pipes of the passthrough pipeline for one direction
+ * @param wi The worker structure
+ */
+void
+pipeline_splice_destroy(struct worker_io* wi);
+
+/**
+ * Move client data to the server using splice(), without decoding
+ */
+void
+pipeline_splice_client(struct ev_loop* loop, struct ev_io* watcher, int revents);
+
+/**
+ * Move server data to the client using splice(), without decoding
+ */
+void
+pipeline_splice_server(struct ev_loop* loop, struct ev_io* watcher, int revents);
+
 #ifdef __cplusplus
 }
 #endif
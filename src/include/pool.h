@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2024 The pgprtdbg community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGPRTDBG_POOL_H
+#define PGPRTDBG_POOL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <ev.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+struct pool;
+
+/**
+ * Create a pool of connections to the servers for an event loop. The
+ * connections are established, and replaced, by watchers of the loop
+ * @param loop The event loop
+ * @param size The number of connections to each server
+ * @param pool The resulting pool
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgprtdbg_pool_init(struct ev_loop* loop, int size, struct pool** pool);
+
+/**
+ * Take an established connection from the pool, and start replacing it
+ * @param pool The pool
+ * @param server The server
+ * @param fd The resulting descriptor
+ * @return 0 upon success, otherwise 1 if no connection is ready
+ */
+int
+pgprtdbg_pool_get(struct pool* pool, int server, int* fd);
+
+/**
+ * Close the descriptors of a pool inherited by a child process, without
+ * touching the event loop of the parent
+ * @param pool The pool
+ */
+void
+pgprtdbg_pool_forget(struct pool* pool);
+
+/**
+ * Destroy a pool, and close its connections
+ * @param pool The pool
+ */
+void
+pgprtdbg_pool_destroy(struct pool* pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -34,26 +34,74 @@ extern "C" {
 #endif
 
 #include <pgprtdbg.h>
+#include <frame.h>
+#include <memory.h>
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 
+struct event_counter;
+
+/** @struct
+ * The decoder state of one direction of a session
+ */
+struct stream
+{
+   struct frame frame; /**< The data not decoded yet */
+   signed char kind;   /**< The kind of the message being decoded */
+   int32_t length;     /**< The length of the message being decoded */
+   char* data;         /**< The message being decoded */
+   size_t available;   /**< The bytes buffered from data, which bound the decoding */
+   size_t skip;        /**< The bytes left of an oversized message, which are skipped */
+   bool invalid;       /**< Did the stream have a bad length, so it is no longer decoded */
+   struct arena arena; /**< The scratch memory of the decoding, like the text, reset after each read */
+};
+
+/** @struct
+ * The decoder state of a session
+ */
+struct decoder
+{
+   struct stream frontend; /**< The messages from the client */
+   struct stream backend;  /**< The messages from the server */
+   bool offline;           /**< Decoded away from the forwarding path, so never reply to the client */
+   bool failed;            /**< Decoding failed, so the rest of the session is skipped */
+   int server;             /**< The server of the session */
+   int key;                /**< The BackendKeyData slot of the session, or -1 */
+   int session;            /**< The session in the trace, as in the names of the save_traffic files */
+};
+
 /**
  * Decode a message from the client
  * @param from The from socket
  * @param to The to socket
  * @param msg The message
+ * @param counter The event counter, or NULL if the message is already counted
+ * @param decoder The decoder state
+ * @return 0 upon success, otherwise 1 if the session should be terminated
  */
-void
-pgprtdbg_client(int from, int to, struct message* msg, struct event_counter* counter);
+int
+pgprtdbg_client(int from, int to, struct message* msg, struct event_counter* counter, struct decoder* decoder);
 
 /**
  * Decode a message from the server
  * @param from The from socket
  * @param to The to socket
  * @param msg The message
+ * @param counter The event counter, or NULL if the message is already counted
+ * @param decoder The decoder state
+ * @return 0 upon success, otherwise 1 if the session should be terminated
+ */
+int
+pgprtdbg_server(int from, int to, struct message* msg, struct event_counter* counter, struct decoder* decoder);
+
+/**
+ * Reset the decoder state, discarding any partial message
+ * @param decoder The decoder state
  */
 void
-pgprtdbg_server(int from, int to, struct message* msg, struct event_counter* counter);
+pgprtdbg_decoder_reset(struct decoder* decoder);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2024 The pgprtdbg community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGPRTDBG_RING_H
+#define PGPRTDBG_RING_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+/** @struct
+ * A single-producer, single-consumer ring of variable length records.
+ * A record is never split, so the consumer can use it in place
+ */
+struct ring
+{
+   atomic_size_t head __attribute__ ((aligned (64))); /**< The consumer position */
+   atomic_size_t tail __attribute__ ((aligned (64))); /**< The producer position */
+   size_t size __attribute__ ((aligned (64)));        /**< The size of the data, a power of 2 */
+   char* data;                                         /**< The data */
+};
+
+/**
+ * Create a ring
+ * @param size The minimum size of the ring; rounded up to a power of 2
+ * @param ring The resulting ring
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgprtdbg_ring_create(size_t size, struct ring** ring);
+
+/**
+ * Initialize a ring in memory owned by the caller, like shared memory
+ * @param ring The ring
+ * @param data The data of the ring
+ * @param size The size of the data; a power of 2
+ */
+void
+pgprtdbg_ring_init(struct ring* ring, void* data, size_t size);
+
+/**
+ * Is the ring empty
+ * @param ring The ring
+ * @return True if empty, otherwise false
+ */
+bool
+pgprtdbg_ring_empty(struct ring* ring);
+
+/**
+ * Destroy a ring
+ * @param ring The ring
+ */
+void
+pgprtdbg_ring_destroy(struct ring* ring);
+
+/**
+ * Add a record made of two parts. Only called by the producer
+ * @param ring The ring
+ * @param first The first part
+ * @param first_length The length of the first part
+ * @param second The second part, or NULL
+ * @param second_length The length of the second part
+ * @return 0 upon success, otherwise 1 if the ring is full
+ */
+int
+pgprtdbg_ring_push(struct ring* ring, void* first, size_t first_length, void* second, size_t second_length);
+
+/**
+ * Get the oldest record. Only called by the consumer
+ * @param ring The ring
+ * @param length The length of the record
+ * @return The record, or NULL if the ring is empty
+ */
+void*
+pgprtdbg_ring_front(struct ring* ring, size_t* length);
+
+/**
+ * Remove the oldest record. Only called by the consumer
+ * @param ring The ring
+ * @param length The length of the record
+ */
+void
+pgprtdbg_ring_pop(struct ring* ring, size_t length);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
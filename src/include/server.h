@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2024 The pgprtdbg community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGPRTDBG_SERVER_H
+#define PGPRTDBG_SERVER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <ev.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define SERVER_RETRY 5
+
+#define CANCEL_REQUEST_LENGTH 16
+#define CANCEL_REQUEST_CODE   80877102
+
+extern size_t keys_offset;
+
+/**
+ * Select a server for a session, using the balance setting. Servers that
+ * are down are skipped until they are due for a retry, unless all are down
+ * @param tried The servers already tried by the session, as a bit mask
+ * @param server The resulting server
+ * @return 0 upon success, otherwise 1 if all servers have been tried
+ */
+int
+pgprtdbg_server_select(unsigned int tried, int* server);
+
+/**
+ * Mark a server as up, after a successful connect
+ * @param server The server
+ */
+void
+pgprtdbg_server_success(int server);
+
+/**
+ * Mark a server as down, after a failed connect
+ * @param server The server
+ */
+void
+pgprtdbg_server_failure(int server);
+
+/**
+ * Get the size of the BackendKeyData table in the shared memory segment
+ * @return The size
+ */
+size_t
+pgprtdbg_server_key_size(void);
+
+/**
+ * Remember the BackendKeyData of a session
+ * @param server The server
+ * @param process The process identifier
+ * @param secret The secret key
+ * @param key The resulting key slot, or -1 if the table is full
+ */
+void
+pgprtdbg_server_key_add(int server, int32_t process, int32_t secret, int* key);
+
+/**
+ * Forget the BackendKeyData of a session
+ * @param key The key slot, or -1
+ */
+void
+pgprtdbg_server_key_remove(int key);
+
+/**
+ * Find the server holding a BackendKeyData
+ * @param process The process identifier
+ * @param secret The secret key
+ * @param server The resulting server
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgprtdbg_server_key_find(int32_t process, int32_t secret, int* server);
+
+/**
+ * Send a CancelRequest to a server on an event loop, without waiting for it
+ * @param loop The event loop
+ * @param server The server
+ * @param packet The CancelRequest
+ */
+void
+pgprtdbg_server_cancel(struct ev_loop* loop, int server, char* packet);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
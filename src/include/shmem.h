@@ -43,6 +43,16 @@ extern "C" {
 int
 pgprtdbg_create_shared_memory(size_t size);
 
+/**
+ * Move the shared memory segment to a segment of another size. Only done
+ * at startup, before other processes map the segment
+ * @param size The current size of the segment
+ * @param new_size The new size of the segment
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgprtdbg_resize_shared_memory(size_t size, size_t new_size);
+
 /**
  * Destroy a shared memory segment
  * @param size The size
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2024 The pgprtdbg community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGPRTDBG_SLOT_H
+#define PGPRTDBG_SLOT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+extern size_t slots_offset;
+
+/**
+ * Get the size of the session slots in the shared memory segment
+ * @return The size
+ */
+size_t
+pgprtdbg_slot_size(void);
+
+/**
+ * Put all session slots on the free list
+ */
+void
+pgprtdbg_slot_init(void);
+
+/**
+ * Take a free session slot
+ * @param slot The resulting slot, from 0 to max_connections - 1
+ * @return 0 upon success, otherwise 1 if all slots are taken
+ */
+int
+pgprtdbg_slot_acquire(int* slot);
+
+/**
+ * Give back a session slot
+ * @param slot The slot
+ */
+void
+pgprtdbg_slot_release(int slot);
+
+/**
+ * Is there a free session slot
+ * @return True if there is, otherwise false
+ */
+bool
+pgprtdbg_slot_available(void);
+
+/**
+ * Set the process serving the session of a slot
+ * @param slot The slot
+ * @param pid The pid
+ */
+void
+pgprtdbg_slot_set_pid(int slot, pid_t pid);
+
+/**
+ * Get the process serving the session of a slot
+ * @param slot The slot
+ * @return The pid, or 0
+ */
+pid_t
+pgprtdbg_slot_pid(int slot);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2024 The pgprtdbg community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGPRTDBG_TRACE_H
+#define PGPRTDBG_TRACE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <pgprtdbg.h>
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+#define TRACE_RING_SIZE (256 * 1024)
+
+extern size_t trace_offset;
+
+/**
+ * Get the size of the trace rings in the shared memory segment, which is
+ * 0 without the trace writer
+ * @return The size
+ */
+size_t
+pgprtdbg_trace_size(void);
+
+/**
+ * Initialize the trace rings
+ */
+void
+pgprtdbg_trace_init(void);
+
+/**
+ * Start the writer process, which drains the trace rings into the output file
+ * @return The pid of the writer process, or -1 upon failure
+ */
+pid_t
+pgprtdbg_trace_writer_start(void);
+
+/**
+ * Stop the writer process, once it has written the lines queued
+ * @param pid The pid of the writer process
+ */
+void
+pgprtdbg_trace_writer_stop(pid_t pid);
+
+/**
+ * Queue a trace line for the writer process. The calling thread takes
+ * a trace ring on its first line, and keeps it until it is released
+ * @param line The line
+ * @param length The length of the line
+ * @return 0 upon success, otherwise 1 if the writer didn't make room in time, and the line is dropped
+ */
+int
+pgprtdbg_trace_write(char* line, size_t length);
+
+/**
+ * Queue data of a save_traffic file for the writer process, which
+ * compresses it into the file
+ * @param name The file name
+ * @param data The data
+ * @param length The length of the data
+ * @param last Is this the end of the file, which the writer then closes
+ * @return 0 upon success, otherwise 1 if the data is dropped
+ */
+int
+pgprtdbg_trace_capture(char* name, char* data, size_t length, bool last);
+
+/**
+ * Output the statistics of the trace rings
+ * @param file The file
+ */
+void
+pgprtdbg_trace_output_statistics(FILE* file);
+
+/**
+ * Release the trace ring of the calling thread; its lines are still written
+ */
+void
+pgprtdbg_trace_release(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
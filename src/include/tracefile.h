@@ -0,0 +1,188 @@
+/*
+ * Copyright (C) 2024 The pgprtdbg community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGPRTDBG_TRACEFILE_H
+#define PGPRTDBG_TRACEFILE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#define TRACEFILE_MAGIC     "PGPRTDBG"
+#define TRACEFILE_VERSION   1
+#define TRACEFILE_ENDIAN    0x0102
+#define TRACEFILE_ALIGNMENT 8
+
+#define TRACEFILE_MAX_PAYLOAD (64 * 1024)
+
+/** @struct
+ * The header at the start of a binary trace file
+ */
+struct tracefile_header
+{
+   char magic[8];     /**< TRACEFILE_MAGIC, without a terminating zero */
+   uint16_t version;  /**< The version of the format */
+   uint16_t endian;   /**< TRACEFILE_ENDIAN in the byte order of the writer */
+   uint32_t reserved; /**< Zero */
+};
+
+/** @struct
+ * A record of a binary trace file. The text and the payload follow it, and
+ * the record is padded to TRACEFILE_ALIGNMENT bytes, so the records of a
+ * mapped file can be read in place
+ */
+struct tracefile_record
+{
+   uint32_t size;           /**< The size of the record, with its text, payload and padding */
+   char direction;          /**< 'C' for a client message, 'S' for a server message */
+   signed char kind;        /**< The kind of the message */
+   uint16_t text_length;    /**< The length of the text */
+   int32_t session;         /**< The session */
+   int32_t from;            /**< The source descriptor */
+   int32_t to;              /**< The destination descriptor */
+   int32_t length;          /**< The length of the message */
+   uint64_t timestamp;      /**< The time in nanoseconds of CLOCK_MONOTONIC */
+   uint32_t payload_length; /**< The number of message bytes kept */
+   uint32_t reserved;       /**< Zero */
+};
+
+/** @struct
+ * A reader of a binary trace file
+ */
+struct tracefile_reader
+{
+   int fd;        /**< The file descriptor */
+   char* data;    /**< The mapped file */
+   size_t size;   /**< The size of the mapped file */
+   size_t offset; /**< The offset of the next record */
+};
+
+/**
+ * Get the size of a record, with its padding
+ * @param text_length The length of the text
+ * @param payload_length The number of message bytes kept
+ * @return The size
+ */
+size_t
+pgprtdbg_tracefile_record_size(size_t text_length, size_t payload_length);
+
+/**
+ * Fill in the header of a binary trace file
+ * @param header The header
+ */
+void
+pgprtdbg_tracefile_header_init(struct tracefile_header* header);
+
+/**
+ * Encode a record into a buffer of pgprtdbg_tracefile_record_size() bytes
+ * @param buffer The buffer
+ * @param direction 'C' for a client message, 'S' for a server message
+ * @param session The session
+ * @param from The source descriptor
+ * @param to The destination descriptor
+ * @param kind The kind of the message
+ * @param length The length of the message
+ * @param text The text, or NULL
+ * @param text_length The length of the text
+ * @param payload The message bytes kept, or NULL
+ * @param payload_length The number of message bytes kept
+ * @return The size of the record
+ */
+size_t
+pgprtdbg_tracefile_record_encode(char* buffer, char direction, int32_t session, int32_t from, int32_t to,
+                                 signed char kind, int32_t length, char* text, size_t text_length,
+                                 char* payload, size_t payload_length);
+
+/**
+ * Format a trace line in the CSV format of the output
+ * @param line The line
+ * @param size The size of the line buffer
+ * @param direction 'C' for a client message, 'S' for a server message
+ * @param from The source descriptor
+ * @param to The destination descriptor
+ * @param kind The kind of the message
+ * @param text The text, or NULL
+ * @param text_length The length of the text
+ * @param sockets Include the socket descriptors
+ * @return The length of the line, which is at most size - 1
+ */
+size_t
+pgprtdbg_tracefile_csv(char* line, size_t size, char direction, int32_t from, int32_t to, signed char kind,
+                       char* text, size_t text_length, bool sockets);
+
+/**
+ * Open a binary trace file for reading. The file is mapped, so records
+ * appended afterwards aren't seen
+ * @param path The path of the file
+ * @param reader The reader
+ * @return 0 upon success, otherwise 1 if the file can't be read or isn't a binary trace file
+ */
+int
+pgprtdbg_tracefile_open(char* path, struct tracefile_reader** reader);
+
+/**
+ * Get the next record. A record that is only partially written is not returned
+ * @param reader The reader
+ * @param record The record, which is valid until the reader is closed
+ * @return 0 upon success, otherwise 1 at the end of the file
+ */
+int
+pgprtdbg_tracefile_next(struct tracefile_reader* reader, struct tracefile_record** record);
+
+/**
+ * Get the text of a record
+ * @param record The record
+ * @return The text, which isn't zero terminated
+ */
+char*
+pgprtdbg_tracefile_text(struct tracefile_record* record);
+
+/**
+ * Get the message bytes kept in a record
+ * @param record The record
+ * @return The payload
+ */
+char*
+pgprtdbg_tracefile_payload(struct tracefile_record* record);
+
+/**
+ * Close a reader
+ * @param reader The reader
+ */
+void
+pgprtdbg_tracefile_close(struct tracefile_reader* reader);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
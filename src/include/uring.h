@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2024 The pgprtdbg community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PGPRTDBG_URING_H
+#define PGPRTDBG_URING_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <worker.h>
+
+#include <ev.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+struct uring;
+
+/**
+ * Create an io_uring instance for an event loop. The completions are
+ * processed by a watcher on the ring descriptor
+ * @param loop The event loop
+ * @param uring The resulting instance
+ * @return 0 upon success, otherwise 1 (io_uring not built in, or not supported by the kernel)
+ */
+int
+pgprtdbg_uring_init(struct ev_loop* loop, struct uring** uring);
+
+/**
+ * Destroy an io_uring instance, once the operations of its sessions are done
+ * @param loop The event loop
+ * @param uring The instance
+ */
+void
+pgprtdbg_uring_destroy(struct ev_loop* loop, struct uring* uring);
+
+/**
+ * Start forwarding a session with multishot receives into registered buffers
+ * and linked sends
+ * @param uring The instance
+ * @param session The session
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgprtdbg_uring_session_start(struct uring* uring, struct worker_session* session);
+
+/**
+ * Cancel the operations of a session
+ * @param uring The instance
+ * @param session The session
+ * @return True if the instance frees the session once its operations are done, otherwise false
+ */
+bool
+pgprtdbg_uring_session_finish(struct uring* uring, struct worker_session* session);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
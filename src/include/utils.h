@@ -133,62 +133,39 @@ pgprtdbg_libev_engine(unsigned int val);
 
 /**
  * Save client traffic in a file
- * @param pid The PID
+ * @param session The session
  * @param identifier The number identifier for the message
  * @param msg The message
  * @return The result
  */
 int
-pgprtdbg_save_client_traffic(pid_t pid, long identifier, struct message* msg);
+pgprtdbg_save_client_traffic(int session, long identifier, struct message* msg);
 
 /**
  * Save server traffic in a file
- * @param pid The PID
+ * @param session The session
  * @param identifier The number identifier for the message
  * @param msg The message
  * @return The result
  */
 int
-pgprtdbg_save_server_traffic(pid_t pid, long identifier, struct message* msg);
+pgprtdbg_save_server_traffic(int session, long identifier, struct message* msg);
 
 /**
  * Begin marker
- * @param pid The PID
+ * @param session The session
  * @return The result
  */
 int
-pgprtdbg_save_begin_marker(pid_t pid);
+pgprtdbg_save_begin_marker(int session);
 
 /**
  * End marker
- * @param pid The PID
+ * @param session The session
  * @return The result
  */
 int
-pgprtdbg_save_end_marker(pid_t pid);
-
-/**
- * Data: Append
- * @param data The existing data
- * @param data_size The existing data size
- * @param new_data The new data
- * @param new_data_size The new data size
- * @param new_size The resulting size
- * @return The result
- */
-void*
-pgprtdbg_data_append(void* data, size_t data_size, void* new_data, size_t new_data_size, size_t* new_size);
-
-/**
- * Data: Remove
- * @param data The existing data
- * @param data_size The existing data size
- * @param remove_size Remove size
- * @param new_size The resulting size
- * @return The result
- */
-void*
-pgprtdbg_data_remove(void* data, size_t data_size, size_t remove_size, size_t* new_size);
+pgprtdbg_save_end_marker(int session);
 
 #ifdef __cplusplus
 }
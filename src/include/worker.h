@@ -33,14 +33,25 @@
 extern "C" {
 #endif
 
+#include <protocol.h>
+
 #include <ev.h>
+#include <stdbool.h>
 #include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/types.h>
 
 #define WORKER_SUCCESS        0
 #define WORKER_FAILURE        1
 #define WORKER_CLIENT_FAILURE 2
 #define WORKER_SERVER_FAILURE 3
 #define WORKER_SERVER_FATAL   4
+#define WORKER_BIND_FAILURE   5
+
+struct worker_loop;
+struct worker_session;
+struct uring_session;
+struct decoder_stage;
 
 /** @struct
  * The worker structure for each IO event
@@ -51,18 +62,88 @@ struct worker_io
    int client_fd;        /**< The client descriptor */
    int server_fd;        /**< The server descriptor */
    struct event_counter* counter;
+   struct worker_session* session; /**< The session */
+   int pipe_fds[2];                /**< The splice pipe of the passthrough mode */
+   int capture_fds[2];             /**< The tee pipe for the capture, if any */
+   int capture_fd;                 /**< The capture file, if any */
+   struct ev_io write_io;          /**< The EV_WRITE watcher of the destination while output is pending */
+   char* queue;                    /**< The pending output for the destination */
+   size_t queue_size;              /**< The size of the queue buffer */
+   size_t queue_offset;            /**< The offset of the first pending byte */
+   size_t queue_length;            /**< The number of pending bytes; in the passthrough mode they are in the pipe */
+   bool draining;                  /**< Finish the session once the pending output is written */
 };
 
-extern volatile int running;
-extern volatile int exit_code;
+/** @struct
+ * A session between a client and a server
+ */
+struct worker_session
+{
+   struct worker_io client_io;     /**< The client watcher */
+   struct worker_io server_io;     /**< The server watcher */
+   struct decoder* decoder;        /**< The decoder state */
+   struct decoder_stage* stage;    /**< The asynchronous decoder, if any */
+   bool untraced;                  /**< Has the asynchronous decoder given up on the session */
+   bool connected;                 /**< Is the server connected */
+   struct ev_io connect_io;        /**< The watcher of a pending connect */
+   struct ev_timer connect_timer;  /**< The timeout of a pending connect */
+   struct ev_timer retry_timer;    /**< Peeks again at a partial startup packet */
+   int server;                     /**< The server, or -1 if not selected yet */
+   unsigned int tried;             /**< The servers that failed to connect, as a bit mask */
+   int address;                    /**< The index of the server address being connected to */
+   int exit_code;                  /**< The exit code */
+   int slot;                       /**< The session slot */
+   struct sockaddr_storage peer;   /**< The address of the client */
+   int traffic_id;                 /**< The session in the trace and the traffic files, unique across processes */
+   long identifier;                /**< The identifier of the last client message */
+   struct worker_loop* owner;      /**< The event loop serving the session */
+   struct uring_session* uring;    /**< The io_uring state, if any */
+   struct worker_session* prev;    /**< The previous session of the event loop */
+   struct worker_session* next;    /**< The next session of the event loop */
+};
 
 /**
  * Create a worker instance
  * @param fd The client descriptor
- * @param client_number The number of the client, from 0 to MAX_NUMBER_OF_COUNTERS - 1
+ * @param slot The session slot of the client
+ * @param server The server of server_fd, or -1 to select one
+ * @param server_fd An established server descriptor, or -1 to connect
+ * @param peer The address of the client
+ */
+void
+pgprtdbg_worker(int fd, int slot, int server, int server_fd, struct sockaddr_storage* peer);
+
+/**
+ * Create a pre-forked worker instance that accepts and serves sessions
+ * one after another until it receives SIGQUIT
+ * @param unix_fd The inherited Unix Domain Socket descriptor, or -1
+ */
+void
+pgprtdbg_worker_pool(int unix_fd);
+
+/**
+ * Start the event loop threads. Each thread accepts connections and
+ * multiplexes its sessions on its own event loop
+ * @param unix_fd The Unix Domain Socket descriptor, or -1
+ * @return 0 upon success, otherwise 1
+ */
+int
+pgprtdbg_worker_threads_start(int unix_fd);
+
+/**
+ * Stop the event loop threads, and close their sessions
+ */
+void
+pgprtdbg_worker_threads_stop(void);
+
+/**
+ * Finish a session; the session must not be used afterwards
+ * @param loop The event loop
+ * @param session The session
+ * @param exit_code The exit code
  */
 void
-pgprtdbg_worker(int fd, int client_number);
+pgprtdbg_worker_session_finish(struct ev_loop* loop, struct worker_session* session, int exit_code);
 
 #ifdef __cplusplus
 }
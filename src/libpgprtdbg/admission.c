@@ -0,0 +1,363 @@
+/*
+ * Copyright (C) 2024 The pgprtdbg community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgprtdbg */
+#include <pgprtdbg.h>
+#include <admission.h>
+#include <counter.h>
+#include <logging.h>
+#include <message.h>
+#include <network.h>
+#include <slot.h>
+
+/* system */
+#include <ev.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** @struct
+ * A client waiting for a connection slot
+ */
+struct admission_client
+{
+   int fd;                       /**< The client descriptor */
+   struct sockaddr_storage peer; /**< The address of the client */
+   ev_tstamp since;              /**< The time the client was queued */
+};
+
+/** @struct
+ * The admission queue of an event loop
+ */
+struct admission
+{
+   struct ev_loop* loop;             /**< The event loop */
+   struct ev_timer timer;            /**< Polls for free slots while needed */
+   admission_accept accept;          /**< Starts and stops the accept watchers */
+   admission_admit admit;            /**< Starts a session */
+   void* data;                       /**< The event loop data */
+   bool paused;                      /**< Are the accept watchers stopped */
+   int capacity;                     /**< The maximum number of queued clients */
+   int head;                         /**< The first queued client */
+   int count;                        /**< The number of queued clients */
+   struct admission_client* clients; /**< The queued clients */
+};
+
+static void admission_cb(struct ev_loop* loop, struct ev_timer* watcher, int revents);
+static void admission_process(struct admission* admission);
+static void admission_admit_client(struct admission* admission, int client_fd, int slot, struct sockaddr_storage* peer);
+static void admission_reject(int client_fd);
+
+bool
+pgprtdbg_admission_acquire(int* slot)
+{
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   if (pgprtdbg_slot_acquire(slot))
+   {
+      return false;
+   }
+
+   atomic_fetch_add(&config->active_connections, 1);
+
+   return true;
+}
+
+void
+pgprtdbg_admission_release(int slot)
+{
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   atomic_fetch_sub(&config->active_connections, 1);
+   pgprtdbg_slot_release(slot);
+}
+
+int
+pgprtdbg_admission_init(struct ev_loop* loop, admission_accept accept, admission_admit admit, void* data, struct admission** admission)
+{
+   struct admission* a = NULL;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   *admission = NULL;
+
+   a = (struct admission*)malloc(sizeof(struct admission));
+   if (a == NULL)
+   {
+      return 1;
+   }
+
+   memset(a, 0, sizeof(struct admission));
+   a->loop = loop;
+   a->accept = accept;
+   a->admit = admit;
+   a->data = data;
+   a->capacity = config->admission_queue;
+
+   if (a->capacity > 0)
+   {
+      a->clients = (struct admission_client*)malloc(a->capacity * sizeof(struct admission_client));
+      if (a->clients == NULL)
+      {
+         free(a);
+         return 1;
+      }
+   }
+
+   ev_timer_init(&a->timer, admission_cb, ADMISSION_POLL, ADMISSION_POLL);
+   a->timer.data = a;
+
+   *admission = a;
+
+   return 0;
+}
+
+void
+pgprtdbg_admission_destroy(struct admission* admission)
+{
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   if (admission == NULL)
+   {
+      return;
+   }
+
+   ev_timer_stop(admission->loop, &admission->timer);
+
+   while (admission->count > 0)
+   {
+      admission_reject(admission->clients[admission->head].fd);
+
+      admission->head = (admission->head + 1) % admission->capacity;
+      admission->count--;
+      atomic_fetch_sub(&config->admission_queued, 1);
+   }
+
+   free(admission->clients);
+   free(admission);
+}
+
+void
+pgprtdbg_admission_forget(struct admission* admission)
+{
+   if (admission == NULL)
+   {
+      return;
+   }
+
+   for (int i = 0; i < admission->count; i++)
+   {
+      pgprtdbg_disconnect(admission->clients[(admission->head + i) % admission->capacity].fd);
+   }
+}
+
+bool
+pgprtdbg_admission_open(struct admission* admission)
+{
+   if (admission->count < admission->capacity || (admission->count == 0 && pgprtdbg_slot_available()))
+   {
+      return true;
+   }
+
+   /* Nothing to do with a new client, so leave it in the backlog */
+   if (!admission->paused)
+   {
+      admission->paused = true;
+      admission->accept(admission->data, false);
+   }
+
+   ev_timer_start(admission->loop, &admission->timer);
+
+   return false;
+}
+
+void
+pgprtdbg_admission_offer(struct admission* admission, int client_fd, struct sockaddr_storage* peer)
+{
+   int slot;
+   int queued;
+   int max;
+   struct admission_client* c;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   /* Clients that are already waiting go first */
+   if (admission->count == 0 && pgprtdbg_admission_acquire(&slot))
+   {
+      admission_admit_client(admission, client_fd, slot, peer);
+      return;
+   }
+
+   if (admission->count >= admission->capacity)
+   {
+      atomic_fetch_add(&config->admission_rejected, 1);
+      admission_reject(client_fd);
+      return;
+   }
+
+   c = &admission->clients[(admission->head + admission->count) % admission->capacity];
+   c->fd = client_fd;
+   memcpy(&c->peer, peer, sizeof(struct sockaddr_storage));
+   c->since = ev_now(admission->loop);
+   admission->count++;
+
+   queued = atomic_fetch_add(&config->admission_queued, 1) + 1;
+   max = atomic_load(&config->admission_queued_max);
+   while (queued > max && !atomic_compare_exchange_weak(&config->admission_queued_max, &max, queued))
+   {
+   }
+
+   pgprtdbg_log_lock();
+   pgprtdbg_log_line("Queued client: %d (%d waiting)", client_fd, queued);
+   pgprtdbg_log_unlock();
+
+   ev_timer_start(admission->loop, &admission->timer);
+}
+
+void
+pgprtdbg_admission_wakeup(struct admission* admission)
+{
+   if (admission != NULL && (admission->count > 0 || admission->paused))
+   {
+      admission_process(admission);
+   }
+}
+
+void
+pgprtdbg_admission_output_statistics(FILE* file)
+{
+   long waits;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   waits = atomic_load(&config->admission_waits);
+
+   fprintf(file, "Admission Queue Max:     %d\n", atomic_load(&config->admission_queued_max));
+   fprintf(file, "Admission Waits:         %ld\n", waits);
+   fprintf(file, "Admission Wait Avg (ms): %ld\n", waits > 0 ? atomic_load(&config->admission_wait_time) / waits : 0);
+   fprintf(file, "Admission Wait Max (ms): %ld\n", atomic_load(&config->admission_wait_max));
+   fprintf(file, "Admission Rejected:      %ld\n", atomic_load(&config->admission_rejected));
+}
+
+static void
+admission_cb(struct ev_loop* loop, struct ev_timer* watcher, int revents)
+{
+   admission_process((struct admission*)watcher->data);
+}
+
+static void
+admission_process(struct admission* admission)
+{
+   int slot = -1;
+   long wait;
+   long max;
+   bool expired;
+   ev_tstamp now;
+   struct admission_client client;
+   struct admission_client* c;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   now = ev_now(admission->loop);
+
+   while (admission->count > 0)
+   {
+      c = &admission->clients[admission->head];
+      expired = now - c->since >= config->admission_timeout;
+
+      if (!expired && !pgprtdbg_admission_acquire(&slot))
+      {
+         break;
+      }
+
+      /* Dequeue first, since starting a session may get back here */
+      memcpy(&client, c, sizeof(struct admission_client));
+      admission->head = (admission->head + 1) % admission->capacity;
+      admission->count--;
+      atomic_fetch_sub(&config->admission_queued, 1);
+
+      if (expired)
+      {
+         pgprtdbg_log_lock();
+         pgprtdbg_log_line("Admission timeout: %d", client.fd);
+         pgprtdbg_log_unlock();
+
+         atomic_fetch_add(&config->admission_rejected, 1);
+         admission_reject(client.fd);
+         continue;
+      }
+
+      wait = (long)((now - client.since) * 1000);
+
+      atomic_fetch_add(&config->admission_waits, 1);
+      atomic_fetch_add(&config->admission_wait_time, wait);
+      max = atomic_load(&config->admission_wait_max);
+      while (wait > max && !atomic_compare_exchange_weak(&config->admission_wait_max, &max, wait))
+      {
+      }
+
+      admission_admit_client(admission, client.fd, slot, &client.peer);
+   }
+
+   if (admission->paused && (admission->count < admission->capacity || (admission->count == 0 && pgprtdbg_slot_available())))
+   {
+      admission->paused = false;
+      admission->accept(admission->data, true);
+   }
+
+   if (!admission->paused && admission->count == 0)
+   {
+      ev_timer_stop(admission->loop, &admission->timer);
+   }
+}
+
+static void
+admission_admit_client(struct admission* admission, int client_fd, int slot, struct sockaddr_storage* peer)
+{
+   pgprtdbg_address_text(peer, pgprtdbg_counter_get(slot)->address, INET6_ADDRSTRLEN);
+
+   admission->admit(admission->data, client_fd, slot, peer);
+}
+
+static void
+admission_reject(int client_fd)
+{
+   pgprtdbg_write_too_many_connections(client_fd);
+   pgprtdbg_disconnect(client_fd);
+}
@@ -0,0 +1,223 @@
+/*
+ * Copyright (C) 2024 The pgprtdbg community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgprtdbg */
+#include <pgprtdbg.h>
+#include <compression.h>
+
+/* system */
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(HAVE_ZLIB)
+#include <zlib.h>
+#endif
+
+#if defined(HAVE_ZLIB)
+
+#define COMPRESSION_LEVEL  1
+#define COMPRESSION_WINDOW (15 + 16)
+#define COMPRESSION_CHUNK  (16 * 1024)
+
+/** @struct
+ * A deflate stream writing one gzip member at a time
+ */
+struct compression
+{
+   z_stream stream; /**< The zlib stream */
+   bool started;    /**< Has the current member any data */
+};
+
+static int compression_deflate(struct compression* compression, FILE* file, int flush, size_t* written);
+#endif
+
+bool
+pgprtdbg_compression_available(void)
+{
+#if defined(HAVE_ZLIB)
+   return true;
+#else
+   return false;
+#endif
+}
+
+int
+pgprtdbg_compression_create(struct compression** compression)
+{
+#if defined(HAVE_ZLIB)
+   struct compression* c = NULL;
+
+   *compression = NULL;
+
+   c = (struct compression*)malloc(sizeof(struct compression));
+   if (c == NULL)
+   {
+      return 1;
+   }
+
+   memset(c, 0, sizeof(struct compression));
+
+   if (deflateInit2(&c->stream, COMPRESSION_LEVEL, Z_DEFLATED, COMPRESSION_WINDOW, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+   {
+      free(c);
+      return 1;
+   }
+
+   *compression = c;
+
+   return 0;
+#else
+   *compression = NULL;
+
+   return 1;
+#endif
+}
+
+int
+pgprtdbg_compression_write(struct compression* compression, FILE* file, char* data, size_t length, size_t* written)
+{
+#if defined(HAVE_ZLIB)
+   *written = 0;
+
+   if (length == 0)
+   {
+      return 0;
+   }
+
+   compression->stream.next_in = (unsigned char*)data;
+   compression->stream.avail_in = (uInt)length;
+   compression->started = true;
+
+   return compression_deflate(compression, file, Z_NO_FLUSH, written);
+#else
+   *written = 0;
+
+   return 1;
+#endif
+}
+
+int
+pgprtdbg_compression_flush(struct compression* compression, FILE* file, size_t* written)
+{
+#if defined(HAVE_ZLIB)
+   *written = 0;
+
+   if (!compression->started)
+   {
+      return 0;
+   }
+
+   /* A sync flush ends on a byte boundary, so a reader gets everything up to here */
+   if (compression_deflate(compression, file, Z_SYNC_FLUSH, written))
+   {
+      return 1;
+   }
+
+   fflush(file);
+
+   return 0;
+#else
+   *written = 0;
+
+   return 1;
+#endif
+}
+
+int
+pgprtdbg_compression_finish(struct compression* compression, FILE* file, size_t* written)
+{
+#if defined(HAVE_ZLIB)
+   int status;
+
+   *written = 0;
+
+   if (!compression->started)
+   {
+      return 0;
+   }
+
+   status = compression_deflate(compression, file, Z_FINISH, written);
+
+   fflush(file);
+
+   deflateReset(&compression->stream);
+   compression->started = false;
+
+   return status;
+#else
+   *written = 0;
+
+   return 1;
+#endif
+}
+
+void
+pgprtdbg_compression_destroy(struct compression* compression)
+{
+#if defined(HAVE_ZLIB)
+   if (compression != NULL)
+   {
+      deflateEnd(&compression->stream);
+      free(compression);
+   }
+#endif
+}
+
+#if defined(HAVE_ZLIB)
+static int
+compression_deflate(struct compression* compression, FILE* file, int flush, size_t* written)
+{
+   unsigned char chunk[COMPRESSION_CHUNK];
+   size_t size;
+
+   /* Until deflate has room left over, it may have more to give */
+   do
+   {
+      compression->stream.next_out = &chunk[0];
+      compression->stream.avail_out = COMPRESSION_CHUNK;
+
+      if (deflate(&compression->stream, flush) == Z_STREAM_ERROR)
+      {
+         return 1;
+      }
+
+      size = COMPRESSION_CHUNK - compression->stream.avail_out;
+
+      if (size > 0 && fwrite(&chunk[0], 1, size, file) != size)
+      {
+         return 1;
+      }
+
+      *written += size;
+   }
+   while (compression->stream.avail_out == 0);
+
+   return 0;
+}
+#endif
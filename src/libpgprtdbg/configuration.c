@@ -28,8 +28,10 @@
 
 /* pgprtdbg */
 #include <pgprtdbg.h>
+#include <compression.h>
 #include <configuration.h>
 #include <logging.h>
+#include <tracefile.h>
 #include <utils.h>
 
 /* system */
@@ -46,6 +48,9 @@ static void extract_key_value(char* str, char** key, char** value);
 static int as_int(char* str);
 static bool as_bool(char* str);
 static int as_logging_type(char* str);
+static int as_balance(char* str);
+static int as_compression(char* str);
+static int as_output_format(char* str);
 
 /**
  *
@@ -59,11 +64,36 @@ pgprtdbg_init_configuration(void)
 
    config->output_sockets = false;
    config->save_traffic = false;
+   config->passthrough = false;
+   config->io_uring = false;
+   config->async_decode = false;
+   config->trace_writer = false;
+   config->output_buffer = DEFAULT_OUTPUT_BUFFER;
+   config->output_flush_interval = DEFAULT_OUTPUT_FLUSH_INTERVAL;
+   config->output_flush_ready = true;
+   config->output_segment_size = 0;
+   config->output_segment_age = 0;
+   config->output_segments = 0;
+   config->compression = COMPRESSION_NONE;
+   config->output_format = OUTPUT_FORMAT_CSV;
+   config->output_payload = 0;
 
    config->buffer_size = DEFAULT_BUFFER_SIZE;
+   config->read_budget = DEFAULT_READ_BUDGET;
+   config->decode_limit = DEFAULT_DECODE_LIMIT;
    config->keep_alive = true;
    config->nodelay = false;
    config->backlog = -1;
+   config->max_connections = DEFAULT_MAX_CONNECTIONS;
+   config->workers = 0;
+   config->threads = 0;
+   config->connect_timeout = DEFAULT_CONNECT_TIMEOUT;
+   config->dns_refresh = DEFAULT_DNS_REFRESH;
+   config->pool_size = 0;
+   config->pool_lifetime = DEFAULT_POOL_LIFETIME;
+   config->balance = BALANCE_ROUND_ROBIN;
+   config->admission_queue = 0;
+   config->admission_timeout = DEFAULT_ADMISSION_TIMEOUT;
 
    config->log_type = PGPRTDBG_LOGGING_TYPE_CONSOLE;
    atomic_init(&config->log_lock, STATE_FREE);
@@ -73,11 +103,11 @@ pgprtdbg_init_configuration(void)
       return 1;
    }
 
-   config->file = NULL;
-
    *config->statistics_output = 0;
 
    atomic_init(&config->active_connections, 0);
+   atomic_init(&config->clients, 0);
+   atomic_init(&config->sessions, 0);
 
    return 0;
 }
@@ -127,15 +157,17 @@ pgprtdbg_read_configuration(char* filename)
                memcpy(&section, line + 1, max);
                if (strcmp(section, "pgprtdbg"))
                {
-                  idx_server++;
-
-                  if (idx_server == 0)
+                  if (idx_server >= 0)
                   {
-                     memcpy(&(config->server[0]), &srv, sizeof(struct server));
+                     memcpy(&(config->server[idx_server]), &srv, sizeof(struct server));
                   }
-                  else
+
+                  idx_server++;
+
+                  if (idx_server >= MAX_NUMBER_OF_SERVERS)
                   {
                      printf("Maximum number of servers exceeded\n");
+                     fclose(file);
                      return 1;
                   }
 
@@ -243,6 +275,149 @@ pgprtdbg_read_configuration(char* filename)
                      unknown = true;
                   }
                }
+               else if (!strcmp(key, "passthrough"))
+               {
+                  if (!strcmp(section, "pgprtdbg"))
+                  {
+                     config->passthrough = as_bool(value);
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "io_uring"))
+               {
+                  if (!strcmp(section, "pgprtdbg"))
+                  {
+                     config->io_uring = as_bool(value);
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "async_decode"))
+               {
+                  if (!strcmp(section, "pgprtdbg"))
+                  {
+                     config->async_decode = as_bool(value);
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "trace_writer"))
+               {
+                  if (!strcmp(section, "pgprtdbg"))
+                  {
+                     config->trace_writer = as_bool(value);
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "output_buffer"))
+               {
+                  if (!strcmp(section, "pgprtdbg"))
+                  {
+                     config->output_buffer = as_int(value);
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "output_flush_interval"))
+               {
+                  if (!strcmp(section, "pgprtdbg"))
+                  {
+                     config->output_flush_interval = as_int(value);
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "output_flush_ready"))
+               {
+                  if (!strcmp(section, "pgprtdbg"))
+                  {
+                     config->output_flush_ready = as_bool(value);
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "output_segment_size"))
+               {
+                  if (!strcmp(section, "pgprtdbg"))
+                  {
+                     config->output_segment_size = as_int(value);
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "output_segment_age"))
+               {
+                  if (!strcmp(section, "pgprtdbg"))
+                  {
+                     config->output_segment_age = as_int(value);
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "output_segments"))
+               {
+                  if (!strcmp(section, "pgprtdbg"))
+                  {
+                     config->output_segments = as_int(value);
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "compression"))
+               {
+                  if (!strcmp(section, "pgprtdbg"))
+                  {
+                     config->compression = as_compression(value);
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "output_format"))
+               {
+                  if (!strcmp(section, "pgprtdbg"))
+                  {
+                     config->output_format = as_output_format(value);
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "output_payload"))
+               {
+                  if (!strcmp(section, "pgprtdbg"))
+                  {
+                     config->output_payload = as_int(value);
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
                else if (!strcmp(key, "unix_socket_dir"))
                {
                   if (!strcmp(section, "pgprtdbg"))
@@ -318,6 +493,28 @@ pgprtdbg_read_configuration(char* filename)
                      unknown = true;
                   }
                }
+               else if (!strcmp(key, "decode_limit"))
+               {
+                  if (!strcmp(section, "pgprtdbg"))
+                  {
+                     config->decode_limit = as_int(value);
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "read_budget"))
+               {
+                  if (!strcmp(section, "pgprtdbg"))
+                  {
+                     config->read_budget = as_int(value);
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
                else if (!strcmp(key, "keep_alive"))
                {
                   if (!strcmp(section, "pgprtdbg"))
@@ -351,6 +548,116 @@ pgprtdbg_read_configuration(char* filename)
                      unknown = true;
                   }
                }
+               else if (!strcmp(key, "max_connections"))
+               {
+                  if (!strcmp(section, "pgprtdbg"))
+                  {
+                     config->max_connections = as_int(value);
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "workers"))
+               {
+                  if (!strcmp(section, "pgprtdbg"))
+                  {
+                     config->workers = as_int(value);
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "threads"))
+               {
+                  if (!strcmp(section, "pgprtdbg"))
+                  {
+                     config->threads = as_int(value);
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "connect_timeout"))
+               {
+                  if (!strcmp(section, "pgprtdbg"))
+                  {
+                     config->connect_timeout = as_int(value);
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "dns_refresh"))
+               {
+                  if (!strcmp(section, "pgprtdbg"))
+                  {
+                     config->dns_refresh = as_int(value);
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "pool_size"))
+               {
+                  if (!strcmp(section, "pgprtdbg"))
+                  {
+                     config->pool_size = as_int(value);
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "pool_lifetime"))
+               {
+                  if (!strcmp(section, "pgprtdbg"))
+                  {
+                     config->pool_lifetime = as_int(value);
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "balance"))
+               {
+                  if (!strcmp(section, "pgprtdbg"))
+                  {
+                     config->balance = as_balance(value);
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "admission_queue"))
+               {
+                  if (!strcmp(section, "pgprtdbg"))
+                  {
+                     config->admission_queue = as_int(value);
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
+               else if (!strcmp(key, "admission_timeout"))
+               {
+                  if (!strcmp(section, "pgprtdbg"))
+                  {
+                     config->admission_timeout = as_int(value);
+                  }
+                  else
+                  {
+                     unknown = true;
+                  }
+               }
                else if (!strcmp(key, "statistics_output"))
                {
                   if (!strcmp(section, "pgprtdbg"))
@@ -384,9 +691,11 @@ pgprtdbg_read_configuration(char* filename)
 
    if (idx_server != -1 && strlen(srv.name) > 0)
    {
-      memcpy(&(config->server[0]), &srv, sizeof(struct server));
+      memcpy(&(config->server[idx_server]), &srv, sizeof(struct server));
    }
 
+   config->number_of_servers = idx_server + 1;
+
    fclose(file);
 
    return 0;
@@ -425,24 +734,167 @@ pgprtdbg_validate_configuration(void)
       config->backlog = 4;
    }
 
-   if (strlen(config->server[0].name) == 0)
+   if (config->read_budget <= 0)
    {
-      printf("pgprtdbg: No server defined\n");
+      config->read_budget = DEFAULT_READ_BUDGET;
+   }
+
+   if (config->decode_limit < 1024)
+   {
+      config->decode_limit = DEFAULT_DECODE_LIMIT;
+   }
+
+   if (config->output_buffer < 0)
+   {
+      config->output_buffer = 0;
+   }
+
+   if (config->output_flush_interval < 0)
+   {
+      config->output_flush_interval = 0;
+   }
+
+   if (config->output_segment_size < 0)
+   {
+      config->output_segment_size = 0;
+   }
+
+   if (config->output_segment_age < 0)
+   {
+      config->output_segment_age = 0;
+   }
+
+   if (config->output_segments < 0)
+   {
+      config->output_segments = 0;
+   }
+
+   if (config->output_payload < 0)
+   {
+      config->output_payload = 0;
+   }
+   else if (config->output_payload > TRACEFILE_MAX_PAYLOAD)
+   {
+      config->output_payload = TRACEFILE_MAX_PAYLOAD;
+   }
+
+   if (config->compression != COMPRESSION_NONE && !pgprtdbg_compression_available())
+   {
+      printf("pgprtdbg: Built without zlib; the output isn't compressed\n");
+      config->compression = COMPRESSION_NONE;
+   }
+
+   /* The reader maps a binary trace as it is, so it can't be compressed */
+   if (config->compression != COMPRESSION_NONE && config->output_format == OUTPUT_FORMAT_BINARY)
+   {
+      printf("pgprtdbg: compression can't be used together with output_format = binary\n");
       return 1;
    }
 
-   if (strlen(config->server[0].host) == 0)
+   /* The output is compressed by the trace writer, away from the forwarding path */
+   if (config->compression != COMPRESSION_NONE)
+   {
+      config->trace_writer = true;
+   }
+
+   if (config->connect_timeout <= 0)
+   {
+      config->connect_timeout = DEFAULT_CONNECT_TIMEOUT;
+   }
+
+   if (config->dns_refresh < 0)
+   {
+      config->dns_refresh = 0;
+   }
+
+   if (config->pool_size < 0)
+   {
+      config->pool_size = 0;
+   }
+
+   if (config->pool_lifetime <= 0)
+   {
+      config->pool_lifetime = DEFAULT_POOL_LIFETIME;
+   }
+
+   if (config->admission_queue < 0)
    {
-      printf("pgprtdbg: No host defined for %s\n", config->server[0].name);
+      config->admission_queue = 0;
+   }
+
+   if (config->admission_timeout <= 0)
+   {
+      config->admission_timeout = DEFAULT_ADMISSION_TIMEOUT;
+   }
+
+   if (config->max_connections <= 0 || config->max_connections > MAX_NUMBER_OF_CONNECTIONS)
+   {
+      printf("pgprtdbg: max_connections (%d) must be between 1 and %d\n", config->max_connections, MAX_NUMBER_OF_CONNECTIONS);
       return 1;
    }
 
-   if (config->server[0].port == 0)
+   if (config->workers < 0)
    {
-      printf("pgprtdbg: No port defined for %s\n", config->server[0].name);
+      config->workers = 0;
+   }
+
+   if (config->workers > config->max_connections)
+   {
+      printf("pgprtdbg: workers (%d) can't be larger than max_connections (%d)\n", config->workers, config->max_connections);
       return 1;
    }
 
+   if (config->threads < 0)
+   {
+      config->threads = 0;
+   }
+
+   if (config->workers > 0 && config->threads > 0)
+   {
+      printf("pgprtdbg: workers and threads can't be used together\n");
+      return 1;
+   }
+
+   /* Every event loop traces, and so does its decoder thread */
+   if (config->threads > 0)
+   {
+      config->trace_rings = config->threads;
+   }
+   else if (config->workers > 0)
+   {
+      config->trace_rings = config->workers;
+   }
+   else
+   {
+      config->trace_rings = config->max_connections;
+   }
+
+   if (config->async_decode)
+   {
+      config->trace_rings *= 2;
+   }
+
+   if (config->number_of_servers <= 0)
+   {
+      printf("pgprtdbg: No server defined\n");
+      return 1;
+   }
+
+   for (int i = 0; i < config->number_of_servers; i++)
+   {
+      if (strlen(config->server[i].host) == 0)
+      {
+         printf("pgprtdbg: No host defined for %s\n", config->server[i].name);
+         return 1;
+      }
+
+      if (config->server[i].port == 0)
+      {
+         printf("pgprtdbg: No port defined for %s\n", config->server[i].name);
+         return 1;
+      }
+   }
+
    return 0;
 }
 
@@ -540,3 +992,41 @@ as_logging_type(char* str)
 
    return 0;
 }
+
+static int
+as_balance(char* str)
+{
+   if (!strcasecmp(str, "round_robin"))
+   {
+      return BALANCE_ROUND_ROBIN;
+   }
+
+   if (!strcasecmp(str, "least_connections"))
+   {
+      return BALANCE_LEAST_CONNECTIONS;
+   }
+
+   return BALANCE_ROUND_ROBIN;
+}
+
+static int
+as_compression(char* str)
+{
+   if (!strcasecmp(str, "gzip"))
+   {
+      return COMPRESSION_GZIP;
+   }
+
+   return COMPRESSION_NONE;
+}
+
+static int
+as_output_format(char* str)
+{
+   if (!strcasecmp(str, "binary"))
+   {
+      return OUTPUT_FORMAT_BINARY;
+   }
+
+   return OUTPUT_FORMAT_CSV;
+}
@@ -28,18 +28,32 @@
 
 /* pgprtdbg */
 #include <pgprtdbg.h>
+#include <admission.h>
 #include <counter.h>
+#include <logging.h>
+#include <trace.h>
 
 /* system */
+#include <stdatomic.h>
 #include <sys/mman.h>
 
-size_t event_counters_offset = sizeof(struct configuration);
+size_t event_counters_offset = 0;
+
+size_t
+pgprtdbg_counter_size(void)
+{
+   struct configuration* config;
+
+   config = (struct configuration*) shmem;
+
+   return config->max_connections * sizeof(struct event_counter);
+}
 
 struct event_counter*
-pgprtdbg_counter_get(int client_number)
+pgprtdbg_counter_get(int slot)
 {
    struct event_counter* event_counters = (struct event_counter*) (shmem + event_counters_offset);
-   struct event_counter* counter = &(event_counters[client_number]);
+   struct event_counter* counter = &(event_counters[slot]);
    return counter;
 }
 
@@ -63,6 +77,7 @@ pgprtdbg_counter_output_statistics(int client_count)
    {
       counter = event_counters[client];
       fprintf(output_file, "Client:                  %d\n", client + 1);
+      fprintf(output_file, "Address:                 %s\n", counter.address);
       fprintf(output_file, "Bytes Sent:              %ld\n", counter.sent_bytes);
       fprintf(output_file, "Messages Sent:           %d\n", counter.sent_messages);
       fprintf(output_file, "Bytes Received:          %ld\n", counter.rcvd_bytes);
@@ -72,4 +87,11 @@ pgprtdbg_counter_output_statistics(int client_count)
          fprintf(output_file, "------------------------------\n");
       }
    }
+   fprintf(output_file, "------------------------------\n");
+   pgprtdbg_admission_output_statistics(output_file);
+
+   if (config->trace_writer)
+   {
+      pgprtdbg_trace_output_statistics(output_file);
+   }
 }
@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2024 The pgprtdbg community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgprtdbg */
+#include <pgprtdbg.h>
+#include <cursor.h>
+#include <utils.h>
+
+/* system */
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+static char empty[1] = {'\0'};
+
+void
+pgprtdbg_cursor_init(struct cursor* cursor, void* data, size_t length)
+{
+   cursor->data = (char*)data;
+   cursor->length = length;
+   cursor->offset = 0;
+   cursor->error = false;
+}
+
+size_t
+pgprtdbg_cursor_remaining(struct cursor* cursor)
+{
+   return cursor->length - cursor->offset;
+}
+
+signed char
+pgprtdbg_cursor_byte(struct cursor* cursor)
+{
+   char* view = pgprtdbg_cursor_view(cursor, 1);
+
+   return view != NULL ? pgprtdbg_read_byte(view) : 0;
+}
+
+int16_t
+pgprtdbg_cursor_int16(struct cursor* cursor)
+{
+   char* view = pgprtdbg_cursor_view(cursor, 2);
+
+   return view != NULL ? pgprtdbg_read_int16(view) : 0;
+}
+
+int32_t
+pgprtdbg_cursor_int32(struct cursor* cursor)
+{
+   char* view = pgprtdbg_cursor_view(cursor, 4);
+
+   return view != NULL ? pgprtdbg_read_int32(view) : 0;
+}
+
+char*
+pgprtdbg_cursor_string(struct cursor* cursor)
+{
+   char* start;
+   char* end;
+
+   start = cursor->data + cursor->offset;
+   end = memchr(start, '\0', pgprtdbg_cursor_remaining(cursor));
+
+   if (end == NULL)
+   {
+      cursor->offset = cursor->length;
+      cursor->error = true;
+      return empty;
+   }
+
+   cursor->offset += end - start + 1;
+
+   return start;
+}
+
+char*
+pgprtdbg_cursor_view(struct cursor* cursor, size_t length)
+{
+   char* view;
+
+   if (unlikely(length > pgprtdbg_cursor_remaining(cursor)))
+   {
+      cursor->offset = cursor->length;
+      cursor->error = true;
+      return NULL;
+   }
+
+   view = cursor->data + cursor->offset;
+   cursor->offset += length;
+
+   return view;
+}
+
+bool
+pgprtdbg_cursor_skip(struct cursor* cursor, size_t length)
+{
+   return pgprtdbg_cursor_view(cursor, length) != NULL;
+}
@@ -0,0 +1,346 @@
+/*
+ * Copyright (C) 2024 The pgprtdbg community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgprtdbg */
+#include <pgprtdbg.h>
+#include <counter.h>
+#include <decoder.h>
+#include <logging.h>
+#include <output.h>
+#include <protocol.h>
+#include <ring.h>
+#include <trace.h>
+#include <worker.h>
+
+/* system */
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define RECORD_CLIENT 0
+#define RECORD_SERVER 1
+#define RECORD_CLOSE  2
+
+/** @struct
+ * The header of a record; the forwarded data follows it
+ */
+struct decoder_record
+{
+   int type;                       /**< The type of the record */
+   int from;                       /**< The source descriptor */
+   int to;                         /**< The destination descriptor */
+   struct decoder* decoder;        /**< The decoder of the session */
+};
+
+/** @struct
+ * A decoder stage
+ */
+struct decoder_stage
+{
+   struct ring* ring;              /**< The records */
+   pthread_t thread;               /**< The decoder thread */
+   atomic_bool running;            /**< Is the stage running */
+   atomic_bool sleeping;           /**< Is the decoder thread waiting for records */
+   int wakeup[2];                  /**< The pipe waking up the decoder thread */
+};
+
+static void* stage_thread(void* arg);
+static void stage_decode(struct decoder_record* record, size_t length);
+static void stage_wakeup(struct decoder_stage* stage, bool force);
+
+int
+pgprtdbg_decoder_stage_start(struct decoder_stage** stage)
+{
+   struct decoder_stage* s = NULL;
+
+   *stage = NULL;
+
+   s = (struct decoder_stage*)malloc(sizeof(struct decoder_stage));
+   if (s == NULL)
+   {
+      return 1;
+   }
+
+   memset(s, 0, sizeof(struct decoder_stage));
+   atomic_init(&s->running, true);
+   atomic_init(&s->sleeping, false);
+   s->wakeup[0] = -1;
+   s->wakeup[1] = -1;
+
+   if (pgprtdbg_ring_create(DECODER_RING_SIZE, &s->ring))
+   {
+      goto error;
+   }
+
+   if (pipe(s->wakeup) == -1)
+   {
+      goto error;
+   }
+
+   fcntl(s->wakeup[0], F_SETFL, O_NONBLOCK);
+   fcntl(s->wakeup[1], F_SETFL, O_NONBLOCK);
+
+   if (pthread_create(&s->thread, NULL, stage_thread, s))
+   {
+      goto error;
+   }
+
+   *stage = s;
+
+   return 0;
+
+error:
+
+   if (s->wakeup[0] != -1)
+   {
+      close(s->wakeup[0]);
+      close(s->wakeup[1]);
+   }
+
+   pgprtdbg_ring_destroy(s->ring);
+   free(s);
+
+   return 1;
+}
+
+void
+pgprtdbg_decoder_stage_stop(struct decoder_stage* stage)
+{
+   if (stage == NULL)
+   {
+      return;
+   }
+
+   atomic_store(&stage->running, false);
+   stage_wakeup(stage, true);
+
+   pthread_join(stage->thread, NULL);
+
+   close(stage->wakeup[0]);
+   close(stage->wakeup[1]);
+
+   pgprtdbg_ring_destroy(stage->ring);
+   free(stage);
+}
+
+void
+pgprtdbg_decoder_stage_trace(struct worker_session* session, bool client, struct message* msg)
+{
+   size_t offset;
+   size_t length;
+   struct decoder_record record;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   /* Counted here, as the counter belongs to the session slot, which may be reused before the decoding */
+   if (client)
+   {
+      session->client_io.counter->sent_messages++;
+      session->client_io.counter->sent_bytes += msg->length;
+   }
+   else
+   {
+      session->client_io.counter->rcvd_messages++;
+      session->client_io.counter->rcvd_bytes += msg->length;
+   }
+
+   if (session->untraced)
+   {
+      return;
+   }
+
+   memset(&record, 0, sizeof(struct decoder_record));
+   record.type = client ? RECORD_CLIENT : RECORD_SERVER;
+   record.from = client ? session->client_io.client_fd : session->client_io.server_fd;
+   record.to = client ? session->client_io.server_fd : session->client_io.client_fd;
+   record.decoder = session->decoder;
+
+   /* A batch is decoded in pieces of at most one read */
+   for (offset = 0; offset < msg->length; offset += length)
+   {
+      length = msg->length - offset;
+      if (length > (size_t)config->buffer_size)
+      {
+         length = config->buffer_size;
+      }
+
+      if (pgprtdbg_ring_push(session->stage->ring, &record, sizeof(struct decoder_record), (char*)msg->data + offset, length))
+      {
+         /* The decoder state would be out of sync after a gap */
+         session->untraced = true;
+
+         pgprtdbg_log_lock();
+         pgprtdbg_log_line("Decoder behind: client %d isn't traced anymore", session->client_io.client_fd);
+         pgprtdbg_log_unlock();
+
+         break;
+      }
+   }
+
+   stage_wakeup(session->stage, false);
+}
+
+void
+pgprtdbg_decoder_stage_close(struct decoder_stage* stage, struct decoder* decoder)
+{
+   struct decoder_record record;
+
+   memset(&record, 0, sizeof(struct decoder_record));
+   record.type = RECORD_CLOSE;
+   record.decoder = decoder;
+
+   /* The decoder is owned by the stage now, so the record can't be dropped */
+   while (pgprtdbg_ring_push(stage->ring, &record, sizeof(struct decoder_record), NULL, 0))
+   {
+      stage_wakeup(stage, true);
+      sched_yield();
+   }
+
+   stage_wakeup(stage, false);
+}
+
+static void*
+stage_thread(void* arg)
+{
+   char buffer[64];
+   size_t length;
+   struct decoder_record* record = NULL;
+   struct decoder_stage* stage = (struct decoder_stage*)arg;
+   struct pollfd pfd;
+
+   while (true)
+   {
+      record = (struct decoder_record*)pgprtdbg_ring_front(stage->ring, &length);
+
+      if (record != NULL)
+      {
+         stage_decode(record, length);
+         pgprtdbg_ring_pop(stage->ring, length);
+         continue;
+      }
+
+      if (!atomic_load(&stage->running))
+      {
+         break;
+      }
+
+      atomic_store(&stage->sleeping, true);
+      atomic_thread_fence(memory_order_seq_cst);
+
+      if (pgprtdbg_ring_front(stage->ring, &length) == NULL && atomic_load(&stage->running))
+      {
+         /* Idle, so the lines decoded so far are written */
+         pgprtdbg_output_flush();
+
+         pfd.fd = stage->wakeup[0];
+         pfd.events = POLLIN;
+         pfd.revents = 0;
+
+         poll(&pfd, 1, 100);
+
+         while (read(stage->wakeup[0], &buffer[0], sizeof(buffer)) > 0)
+         {
+         }
+      }
+
+      atomic_store(&stage->sleeping, false);
+   }
+
+   pgprtdbg_output_release();
+   pgprtdbg_trace_release();
+
+   return NULL;
+}
+
+static void
+stage_decode(struct decoder_record* record, size_t length)
+{
+   struct message msg;
+   struct decoder* decoder = record->decoder;
+
+   if (record->type == RECORD_CLOSE)
+   {
+      pgprtdbg_decoder_reset(decoder);
+      free(decoder);
+      return;
+   }
+
+   if (decoder->failed)
+   {
+      return;
+   }
+
+   memset(&msg, 0, sizeof(struct message));
+   msg.data = (char*)record + sizeof(struct decoder_record);
+   msg.length = length - sizeof(struct decoder_record);
+   msg.max_length = msg.length;
+   msg.kind = (signed char)(*((char*)msg.data));
+
+   if (record->type == RECORD_CLIENT)
+   {
+      if (pgprtdbg_client(record->from, record->to, &msg, NULL, decoder))
+      {
+         decoder->failed = true;
+      }
+   }
+   else
+   {
+      if (pgprtdbg_server(record->from, record->to, &msg, NULL, decoder))
+      {
+         decoder->failed = true;
+      }
+   }
+
+   if (decoder->failed)
+   {
+      pgprtdbg_log_lock();
+      pgprtdbg_log_line("Decoding stopped for client %d", record->type == RECORD_CLIENT ? record->from : record->to);
+      pgprtdbg_log_unlock();
+   }
+}
+
+static void
+stage_wakeup(struct decoder_stage* stage, bool force)
+{
+   ssize_t result;
+
+   /* Pairs with the fence of the decoder thread, so a record is never missed before it sleeps */
+   atomic_thread_fence(memory_order_seq_cst);
+
+   if (atomic_exchange(&stage->sleeping, false) || force)
+   {
+      result = write(stage->wakeup[1], "w", 1);
+      (void)result;
+   }
+}
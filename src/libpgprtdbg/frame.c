@@ -0,0 +1,168 @@
+/*
+ * Copyright (C) 2024 The pgprtdbg community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgprtdbg */
+#include <pgprtdbg.h>
+#include <frame.h>
+
+/* system */
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FRAME_MIN_CAPACITY 8192
+
+static int frame_reserve(struct frame* frame, size_t length);
+
+char*
+pgprtdbg_frame_begin(struct frame* frame, void* data, size_t length, size_t* size)
+{
+   /* The common case: whole messages, so decode straight from the read buffer */
+   if (frame->start == frame->end)
+   {
+      *size = length;
+      return (char*)data;
+   }
+
+   if (frame_reserve(frame, length))
+   {
+      *size = 0;
+      return NULL;
+   }
+
+   memcpy(frame->data + frame->end, data, length);
+   frame->end += length;
+
+   *size = frame->end - frame->start;
+   return frame->data + frame->start;
+}
+
+int
+pgprtdbg_frame_end(struct frame* frame, char* buffer, size_t size, size_t consumed)
+{
+   size_t rest;
+
+   if (buffer == NULL || consumed > size)
+   {
+      return 1;
+   }
+
+   rest = size - consumed;
+
+   if (buffer == frame->data + frame->start)
+   {
+      frame->start += consumed;
+   }
+   else if (rest > 0)
+   {
+      /* Decoded from the read buffer, so keep the partial message */
+      if (frame_reserve(frame, rest))
+      {
+         return 1;
+      }
+
+      memcpy(frame->data + frame->end, buffer + consumed, rest);
+      frame->end += rest;
+   }
+
+   if (frame->start == frame->end)
+   {
+      frame->start = 0;
+      frame->end = 0;
+   }
+
+   return 0;
+}
+
+void
+pgprtdbg_frame_destroy(struct frame* frame)
+{
+   free(frame->data);
+
+   frame->data = NULL;
+   frame->capacity = 0;
+   frame->start = 0;
+   frame->end = 0;
+}
+
+static int
+frame_reserve(struct frame* frame, size_t length)
+{
+   size_t used;
+   size_t capacity;
+   char* data;
+
+   used = frame->end - frame->start;
+
+   if (length > SIZE_MAX - frame->end)
+   {
+      return 1;
+   }
+
+   if (frame->end + length <= frame->capacity)
+   {
+      return 0;
+   }
+
+   /* Compact, since the decoded bytes at the front are free again */
+   if (frame->start > 0)
+   {
+      memmove(frame->data, frame->data + frame->start, used);
+      frame->start = 0;
+      frame->end = used;
+
+      if (used + length <= frame->capacity)
+      {
+         return 0;
+      }
+   }
+
+   capacity = frame->capacity > 0 ? frame->capacity : FRAME_MIN_CAPACITY;
+   while (capacity < used + length)
+   {
+      /* Doubling would wrap, so take exactly what is needed */
+      if (capacity > SIZE_MAX / 2)
+      {
+         capacity = used + length;
+         break;
+      }
+
+      capacity *= 2;
+   }
+
+   data = realloc(frame->data, capacity);
+   if (data == NULL)
+   {
+      return 1;
+   }
+
+   frame->data = data;
+   frame->capacity = capacity;
+
+   return 0;
+}
@@ -32,10 +32,21 @@
 
 /* system */
 #include <stdlib.h>
+#include <stdalign.h>
+#include <stddef.h>
 #include <string.h>
 
-static struct message* message = NULL;
-static void* data = NULL;
+#define ARENA_MIN_CAPACITY 4096
+
+/* Each block starts with the link to the previous block, once outgrown */
+#define ARENA_ALIGN(size) (((size) + alignof(max_align_t) - 1) & ~(alignof(max_align_t) - 1))
+#define ARENA_HEADER      ARENA_ALIGN(sizeof(void*))
+
+/* Each event loop thread has its own message buffer, large enough for a batch of reads */
+static _Thread_local struct message* message = NULL;
+static _Thread_local void* data = NULL;
+static _Thread_local size_t data_size = 0;
+static _Thread_local size_t data_offset = 0;
 
 /**
  *
@@ -54,11 +65,12 @@ pgprtdbg_memory_init(void)
 
    if (!data)
    {
-      data = malloc((size_t)config->buffer_size);
+      data_size = (size_t)config->buffer_size * (size_t)config->read_budget;
+      data = malloc(data_size);
    }
 
    memset(message, 0, sizeof(struct message));
-   memset(data, 0, (size_t)config->buffer_size);
+   data_offset = 0;
 
    message->max_length = (size_t)config->buffer_size;
 }
@@ -78,7 +90,25 @@ pgprtdbg_memory_message(void)
 void*
 pgprtdbg_memory_data(void)
 {
-   return data;
+   return (char*)data + data_offset;
+}
+
+/**
+ *
+ */
+void
+pgprtdbg_memory_advance(size_t length)
+{
+   data_offset += length;
+}
+
+/**
+ *
+ */
+void
+pgprtdbg_memory_rewind(void)
+{
+   data_offset = 0;
 }
 
 /**
@@ -89,8 +119,9 @@ pgprtdbg_memory_free(void)
 {
    size_t length = message->max_length;
 
+   /* Reads overwrite the data, so only the message is cleared */
    memset(message, 0, sizeof(struct message));
-   memset(data, 0, length);
+   data_offset = 0;
 
    message->max_length = length;
 }
@@ -103,4 +134,96 @@ pgprtdbg_memory_destroy(void)
 {
    free(data);
    free(message);
+
+   data = NULL;
+   data_size = 0;
+   data_offset = 0;
+   message = NULL;
+}
+
+void*
+pgprtdbg_arena_alloc(struct arena* arena, size_t size)
+{
+   size_t capacity;
+   char* memory;
+
+   size = ARENA_ALIGN(size);
+
+   if (arena->data == NULL || arena->used + size > arena->capacity)
+   {
+      capacity = arena->capacity > 0 ? arena->capacity * 2 : ARENA_MIN_CAPACITY;
+      while (capacity < ARENA_HEADER + size)
+      {
+         capacity *= 2;
+      }
+
+      memory = (char*)malloc(capacity);
+      if (memory == NULL)
+      {
+         return NULL;
+      }
+
+      /* The memory handed out stays valid, so the old block waits for the reset */
+      if (arena->data != NULL)
+      {
+         *(void**)arena->data = arena->retired;
+         arena->retired = arena->data;
+         arena->peak += arena->used - ARENA_HEADER;
+      }
+
+      arena->data = memory;
+      arena->capacity = capacity;
+      arena->used = ARENA_HEADER;
+   }
+
+   memory = arena->data + arena->used;
+   arena->used += size;
+
+   return memory;
+}
+
+void
+pgprtdbg_arena_reset(struct arena* arena)
+{
+   void* next;
+   size_t used;
+
+   if (arena->data == NULL)
+   {
+      return;
+   }
+
+   used = arena->peak + arena->used;
+
+   while (arena->retired != NULL)
+   {
+      next = *(void**)arena->retired;
+      free(arena->retired);
+      arena->retired = next;
+   }
+
+   arena->used = ARENA_HEADER;
+   arena->peak = 0;
+
+   /* Room for everything used since the last reset in one block */
+   if (used > arena->capacity)
+   {
+      free(arena->data);
+      arena->data = NULL;
+
+      pgprtdbg_arena_alloc(arena, used);
+      arena->used = ARENA_HEADER;
+   }
+}
+
+void
+pgprtdbg_arena_destroy(struct arena* arena)
+{
+   pgprtdbg_arena_reset(arena);
+
+   free(arena->data);
+
+   arena->data = NULL;
+   arena->capacity = 0;
+   arena->used = 0;
 }
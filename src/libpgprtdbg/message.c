@@ -41,6 +41,7 @@
 
 static int read_message(int socket, bool block, struct message** msg);
 static int write_message(int socket, struct message* msg);
+static int write_refusal(int socket, struct message* msg);
 
 int
 pgprtdbg_read_message(int socket, struct message** msg)
@@ -60,13 +61,51 @@ pgprtdbg_write_message(int socket, struct message* msg)
    return write_message(socket, msg);
 }
 
+int
+pgprtdbg_write_nonblock_message(int socket, struct message* msg, ssize_t* written)
+{
+   ssize_t numbytes;
+   ssize_t offset;
+
+   offset = 0;
+
+   while (offset < msg->length)
+   {
+      numbytes = write(socket, msg->data + offset, msg->length - offset);
+
+      if (likely(numbytes > 0))
+      {
+         offset += numbytes;
+      }
+      else if (numbytes == -1 && errno == EINTR)
+      {
+         errno = 0;
+      }
+      else if (numbytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+      {
+         errno = 0;
+         break;
+      }
+      else
+      {
+         *written = offset;
+         return MESSAGE_STATUS_ERROR;
+      }
+   }
+
+   *written = offset;
+
+   return MESSAGE_STATUS_OK;
+}
+
 int
 pgprtdbg_create_message(void* data, ssize_t length, struct message** msg)
 {
    struct message* copy = NULL;
 
-   copy = (struct message*)malloc(sizeof(struct message));
-   copy->data = malloc(length);
+   /* The data follows the structure, so one allocation */
+   copy = (struct message*)malloc(sizeof(struct message) + length);
+   copy->data = copy + 1;
 
    copy->kind = pgprtdbg_read_byte(data);
    copy->length = length;
@@ -82,8 +121,8 @@ pgprtdbg_copy_message(struct message* msg)
 {
    struct message* copy = NULL;
 
-   copy = (struct message*)malloc(sizeof(struct message));
-   copy->data = malloc(msg->length);
+   copy = (struct message*)malloc(sizeof(struct message) + msg->length);
+   copy->data = copy + 1;
 
    copy->kind = msg->kind;
    copy->length = msg->length;
@@ -101,17 +140,7 @@ pgprtdbg_free_message(struct message* msg)
 void
 pgprtdbg_free_copy_message(struct message* msg)
 {
-   if (msg)
-   {
-      if (msg->data)
-      {
-         free(msg->data);
-         msg->data = NULL;
-      }
-
-      free(msg);
-      msg = NULL;
-   }
+   free(msg);
 }
 
 int32_t
@@ -133,7 +162,7 @@ pgprtdbg_write_empty(int socket)
    msg.length = 1;
    msg.data = &zero;
 
-   return pgprtdbg_write_message(socket, &msg);
+   return write_refusal(socket, &msg);
 }
 
 int
@@ -153,7 +182,40 @@ pgprtdbg_write_connection_refused_old(int socket)
    msg.length = size;
    msg.data = &connection_refused;
 
-   return write_message(socket, &msg);
+   return write_refusal(socket, &msg);
+}
+
+int
+pgprtdbg_write_too_many_connections(int socket)
+{
+   int size = 0;
+   char error[MISC_LENGTH];
+   struct message msg;
+
+   memset(&msg, 0, sizeof(struct message));
+   memset(&error, 0, sizeof(error));
+
+   /* ErrorResponse: FATAL 53300 */
+   size += 5;
+   pgprtdbg_write_byte(&error[size], 'S');
+   pgprtdbg_write_string(&error[size + 1], "FATAL");
+   size += 7;
+   pgprtdbg_write_byte(&error[size], 'C');
+   pgprtdbg_write_string(&error[size + 1], "53300");
+   size += 7;
+   pgprtdbg_write_byte(&error[size], 'M');
+   pgprtdbg_write_string(&error[size + 1], "too many connections");
+   size += 22;
+   size += 1;
+
+   pgprtdbg_write_byte(&error[0], 'E');
+   pgprtdbg_write_int32(&error[1], size - 1);
+
+   msg.kind = 'E';
+   msg.length = size;
+   msg.data = &error;
+
+   return write_refusal(socket, &msg);
 }
 
 static int
@@ -180,8 +242,6 @@ read_message(int socket, bool block, struct message** msg)
       }
       else if (numbytes == 0)
       {
-         pgprtdbg_memory_free();
-
          if ((errno == EAGAIN || errno == EWOULDBLOCK) && block)
          {
             keep_read = true;
@@ -194,8 +254,6 @@ read_message(int socket, bool block, struct message** msg)
       }
       else
       {
-         pgprtdbg_memory_free();
-
          if ((errno == EAGAIN || errno == EWOULDBLOCK) && block)
          {
             keep_read = true;
@@ -266,3 +324,12 @@ write_message(int socket, struct message* msg)
 
    return MESSAGE_STATUS_ERROR;
 }
+
+static int
+write_refusal(int socket, struct message* msg)
+{
+   ssize_t written;
+
+   /* The client is disconnected next, so a client that doesn't read never holds up the event loop */
+   return pgprtdbg_write_nonblock_message(socket, msg, &written);
+}
@@ -36,7 +36,10 @@
 #include <fcntl.h>
 #include <ifaddrs.h>
 #include <netdb.h>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -51,6 +54,12 @@
 #include <netinet/tcp.h>
 
 static int bind_host(const char* hostname, int port, int** fds, int* length);
+static void* resolver_thread(void* arg);
+
+static pthread_t resolver;
+static pthread_mutex_t resolver_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t resolver_cond = PTHREAD_COND_INITIALIZER;
+static bool resolver_running = false;
 
 /**
  *
@@ -134,113 +143,314 @@ pgprtdbg_bind(const char* hostname, int port, int** fds, int* length)
  *
  */
 int
-pgprtdbg_connect(const char* hostname, int port, int* fd)
+pgprtdbg_resolve(int server)
 {
    struct addrinfo hints, * servinfo, * p;
-   int yes = 1;
-   socklen_t optlen = sizeof(int);
    int rv;
-   char* sport;
+   int number = 0;
+   char sport[16];
+   struct sockaddr_storage addresses[MAX_ADDRESSES];
+   socklen_t lengths[MAX_ADDRESSES];
+   struct server* srv;
    struct configuration* config;
 
    config = (struct configuration*)shmem;
+   srv = &config->server[server];
 
-   sport = malloc(5);
-   memset(sport, 0, 5);
-   sprintf(sport, "%d", port);
+   memset(&sport, 0, sizeof(sport));
+   snprintf(&sport[0], sizeof(sport), "%d", srv->port);
 
-   /* Connect to server */
    memset(&hints, 0, sizeof hints);
    hints.ai_family = AF_UNSPEC;
    hints.ai_socktype = SOCK_STREAM;
 
-   if ((rv = getaddrinfo(hostname, sport, &hints, &servinfo)) != 0)
+   if ((rv = getaddrinfo(srv->host, &sport[0], &hints, &servinfo)) != 0)
    {
-      free(sport);
-      fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(rv));
+      pgprtdbg_log_lock();
+      pgprtdbg_log_line("pgprtdbg_resolve: %s: %s", srv->host, gai_strerror(rv));
+      pgprtdbg_log_unlock();
       return 1;
    }
 
-   free(sport);
-
-   /* Loop through all the results and connect to the first we can */
-   for (p = servinfo; p != NULL; p = p->ai_next)
+   for (p = servinfo; p != NULL && number < MAX_ADDRESSES; p = p->ai_next)
    {
-      if ((*fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol)) == -1)
+      if (p->ai_addrlen <= sizeof(struct sockaddr_storage))
       {
-         pgprtdbg_log_lock();
-         pgprtdbg_log_line("pgprtdbg_connect: socket: %s", strerror(errno));
-         pgprtdbg_log_unlock();
-         return 1;
+         memset(&addresses[number], 0, sizeof(struct sockaddr_storage));
+         memcpy(&addresses[number], p->ai_addr, p->ai_addrlen);
+         lengths[number] = p->ai_addrlen;
+         number++;
       }
+   }
 
-      if (config->keep_alive)
-      {
-         if (setsockopt(*fd, SOL_SOCKET, SO_KEEPALIVE, &yes, optlen) == -1)
-         {
-            pgprtdbg_log_lock();
-            pgprtdbg_log_line("pgprtdbg_connect: so_keep_alive: %s", strerror(errno));
-            pgprtdbg_log_unlock();
-            pgprtdbg_disconnect(*fd);
-            return 1;
-         }
-      }
+   freeaddrinfo(servinfo);
+
+   if (number == 0)
+   {
+      pgprtdbg_log_lock();
+      pgprtdbg_log_line("pgprtdbg_resolve: %s: no addresses", srv->host);
+      pgprtdbg_log_unlock();
+      return 1;
+   }
 
-      if (config->nodelay)
+   /* Only the resolver writes; an odd sequence tells the readers to retry */
+   atomic_fetch_add(&srv->sequence, 1);
+   atomic_thread_fence(memory_order_release);
+
+   memcpy(&srv->addresses[0], &addresses[0], sizeof(struct sockaddr_storage) * number);
+   memcpy(&srv->address_lengths[0], &lengths[0], sizeof(socklen_t) * number);
+   srv->number_of_addresses = number;
+
+   atomic_thread_fence(memory_order_release);
+   atomic_fetch_add(&srv->sequence, 1);
+
+   return 0;
+}
+
+/**
+ *
+ */
+int
+pgprtdbg_server_address(int server, int index, struct sockaddr_storage* address, socklen_t* length)
+{
+   unsigned int sequence;
+   bool found;
+   struct server* srv;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+   srv = &config->server[server];
+
+   do
+   {
+      while ((sequence = atomic_load(&srv->sequence)) & 1)
       {
-         if (setsockopt(*fd, IPPROTO_TCP, TCP_NODELAY, &yes, optlen) == -1)
-         {
-            pgprtdbg_log_lock();
-            pgprtdbg_log_line("pgprtdbg_connect: tcp_nodelay: %s", strerror(errno));
-            pgprtdbg_log_unlock();
-            pgprtdbg_disconnect(*fd);
-            return 1;
-         }
+         sched_yield();
       }
 
-      if (setsockopt(*fd, SOL_SOCKET, SO_RCVBUF, &config->buffer_size, optlen) == -1)
+      atomic_thread_fence(memory_order_acquire);
+
+      found = index < srv->number_of_addresses;
+      if (found)
       {
-         pgprtdbg_log_lock();
-         pgprtdbg_log_line("pgprtdbg_connect: so_rcvbuf: %s", strerror(errno));
-         pgprtdbg_log_unlock();
-         pgprtdbg_disconnect(*fd);
-         return 1;
+         memcpy(address, &srv->addresses[index], sizeof(struct sockaddr_storage));
+         *length = srv->address_lengths[index];
       }
 
-      if (setsockopt(*fd, SOL_SOCKET, SO_SNDBUF, &config->buffer_size, optlen) == -1)
+      atomic_thread_fence(memory_order_acquire);
+   }
+   while (atomic_load(&srv->sequence) != sequence);
+
+   return found ? 0 : 1;
+}
+
+/**
+ *
+ */
+int
+pgprtdbg_resolver_start(void)
+{
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   for (int i = 0; i < config->number_of_servers; i++)
+   {
+      if (pgprtdbg_resolve(i))
       {
          pgprtdbg_log_lock();
-         pgprtdbg_log_line("pgprtdbg_connect: so_sndbuf: %s", strerror(errno));
+         pgprtdbg_log_line("pgprtdbg: %s isn't resolved yet", config->server[i].host);
          pgprtdbg_log_unlock();
-         pgprtdbg_disconnect(*fd);
-         return 1;
       }
+   }
+
+   if (config->dns_refresh <= 0)
+   {
+      return 0;
+   }
+
+   resolver_running = true;
+
+   if (pthread_create(&resolver, NULL, resolver_thread, NULL))
+   {
+      resolver_running = false;
+      return 1;
+   }
+
+   return 0;
+}
+
+/**
+ *
+ */
+void
+pgprtdbg_resolver_stop(void)
+{
+   bool started;
+
+   pthread_mutex_lock(&resolver_lock);
+   started = resolver_running;
+   resolver_running = false;
+   pthread_cond_signal(&resolver_cond);
+   pthread_mutex_unlock(&resolver_lock);
+
+   if (started)
+   {
+      pthread_join(resolver, NULL);
+   }
+}
+
+/**
+ *
+ */
+int
+pgprtdbg_connect(struct sockaddr* address, socklen_t length, int* fd)
+{
+   int yes = 1;
+   socklen_t optlen = sizeof(int);
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   if ((*fd = socket(address->sa_family, SOCK_STREAM, 0)) == -1)
+   {
+      pgprtdbg_log_lock();
+      pgprtdbg_log_line("pgprtdbg_connect: socket: %s", strerror(errno));
+      pgprtdbg_log_unlock();
+      errno = 0;
+      return 1;
+   }
 
-      if (connect(*fd, p->ai_addr, p->ai_addrlen) == -1)
+   if (config->keep_alive)
+   {
+      if (setsockopt(*fd, SOL_SOCKET, SO_KEEPALIVE, &yes, optlen) == -1)
       {
          pgprtdbg_log_lock();
-         pgprtdbg_log_line("pgprtdbg_connect: %s", strerror(errno));
+         pgprtdbg_log_line("pgprtdbg_connect: so_keep_alive: %s", strerror(errno));
          pgprtdbg_log_unlock();
-         pgprtdbg_disconnect(*fd);
-         return 1;
+         goto error;
       }
+   }
 
-      break;
+   if (pgprtdbg_tcp_nodelay(*fd))
+   {
+      pgprtdbg_log_lock();
+      pgprtdbg_log_line("pgprtdbg_connect: tcp_nodelay: %s", strerror(errno));
+      pgprtdbg_log_unlock();
+      goto error;
    }
 
-   if (p == NULL)
+   if (pgprtdbg_socket_buffers(*fd))
    {
       pgprtdbg_log_lock();
-      pgprtdbg_log_line("pgprtdbg_connect: failed to connect");
+      pgprtdbg_log_line("pgprtdbg_connect: socket buffers: %s", strerror(errno));
       pgprtdbg_log_unlock();
+      goto error;
+   }
+
+   if (pgprtdbg_socket_nonblocking(*fd, true))
+   {
+      pgprtdbg_log_lock();
+      pgprtdbg_log_line("pgprtdbg_connect: nonblocking: %s", strerror(errno));
+      pgprtdbg_log_unlock();
+      goto error;
+   }
+
+   if (connect(*fd, address, length) == -1 && errno != EINPROGRESS)
+   {
+      pgprtdbg_log_lock();
+      pgprtdbg_log_line("pgprtdbg_connect: %s", strerror(errno));
+      pgprtdbg_log_unlock();
+      goto error;
+   }
+
+   errno = 0;
+
+   return 0;
+
+error:
+
+   errno = 0;
+   pgprtdbg_disconnect(*fd);
+   *fd = -1;
+
+   return 1;
+}
+
+/**
+ *
+ */
+int
+pgprtdbg_connect_result(int fd)
+{
+   int error = 0;
+   socklen_t optlen = sizeof(int);
+
+   if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &optlen) == -1 || error != 0)
+   {
+      pgprtdbg_log_lock();
+      pgprtdbg_log_line("pgprtdbg_connect: %s", strerror(error != 0 ? error : errno));
+      pgprtdbg_log_unlock();
+      errno = 0;
       return 1;
    }
 
-   freeaddrinfo(servinfo);
+   return 0;
+}
+
+/**
+ *
+ */
+int
+pgprtdbg_accept(int fd, struct sockaddr_storage* address, int* client_fd)
+{
+   socklen_t length = sizeof(struct sockaddr_storage);
+
+   memset(address, 0, sizeof(struct sockaddr_storage));
+
+#if defined(__linux__)
+   *client_fd = accept4(fd, (struct sockaddr*)address, &length, SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
+   *client_fd = accept(fd, (struct sockaddr*)address, &length);
+   if (*client_fd != -1)
+   {
+      pgprtdbg_socket_nonblocking(*client_fd, true);
+      fcntl(*client_fd, F_SETFD, FD_CLOEXEC);
+   }
+#endif
+
+   if (*client_fd == -1)
+   {
+      /* Drained, or another worker got the connection */
+      errno = 0;
+      return 1;
+   }
 
    return 0;
 }
 
+/**
+ *
+ */
+void
+pgprtdbg_address_text(struct sockaddr_storage* address, char* text, size_t length)
+{
+   memset(text, 0, length);
+
+   if (address->ss_family == AF_INET)
+   {
+      inet_ntop(AF_INET, &((struct sockaddr_in*)address)->sin_addr, text, length);
+   }
+   else if (address->ss_family == AF_INET6)
+   {
+      inet_ntop(AF_INET6, &((struct sockaddr_in6*)address)->sin6_addr, text, length);
+   }
+   else if (address->ss_family == AF_UNIX)
+   {
+      snprintf(text, length, "unix");
+   }
+}
+
 /**
  *
  */
@@ -390,6 +600,47 @@ pgprtdbg_socket_buffers(int fd)
    return 0;
 }
 
+int
+pgprtdbg_socket_nonblocking(int fd, bool value)
+{
+   int flags;
+
+   flags = fcntl(fd, F_GETFL, 0);
+   if (flags == -1)
+   {
+      return 1;
+   }
+
+   if (value)
+   {
+      flags |= O_NONBLOCK;
+   }
+   else
+   {
+      flags &= ~O_NONBLOCK;
+   }
+
+   if (fcntl(fd, F_SETFL, flags) == -1)
+   {
+      return 1;
+   }
+
+   return 0;
+}
+
+int
+pgprtdbg_socket_rcvlowat(int fd, int bytes)
+{
+   socklen_t optlen = sizeof(int);
+
+   if (setsockopt(fd, SOL_SOCKET, SO_RCVLOWAT, &bytes, optlen) == -1)
+   {
+      return 1;
+   }
+
+   return 0;
+}
+
 /**
  *
  */
@@ -456,6 +707,19 @@ bind_host(const char* hostname, int port, int** fds, int* length)
          continue;
       }
 
+      /* Each pre-forked worker or thread binds its own socket, and the kernel spreads the connections */
+      if (config->workers > 0 || config->threads > 0)
+      {
+         if (setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(int)) == -1)
+         {
+            pgprtdbg_log_lock();
+            pgprtdbg_log_line("server: so_reuseport: %s:%d (%s)", hostname, port, strerror(errno));
+            pgprtdbg_log_unlock();
+            pgprtdbg_disconnect(sockfd);
+            continue;
+         }
+      }
+
       if (pgprtdbg_socket_buffers(sockfd))
       {
          pgprtdbg_disconnect(sockfd);
@@ -503,3 +767,37 @@ bind_host(const char* hostname, int port, int** fds, int* length)
 
    return 0;
 }
+
+static void*
+resolver_thread(void* arg)
+{
+   struct timespec deadline;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   pthread_mutex_lock(&resolver_lock);
+
+   while (resolver_running)
+   {
+      clock_gettime(CLOCK_REALTIME, &deadline);
+      deadline.tv_sec += config->dns_refresh;
+
+      pthread_cond_timedwait(&resolver_cond, &resolver_lock, &deadline);
+
+      if (resolver_running)
+      {
+         /* Sessions keep using the previous addresses while resolving */
+         pthread_mutex_unlock(&resolver_lock);
+         for (int i = 0; i < config->number_of_servers; i++)
+         {
+            pgprtdbg_resolve(i);
+         }
+         pthread_mutex_lock(&resolver_lock);
+      }
+   }
+
+   pthread_mutex_unlock(&resolver_lock);
+
+   return NULL;
+}
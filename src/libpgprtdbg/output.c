@@ -0,0 +1,506 @@
+/*
+ * Copyright (C) 2024 The pgprtdbg community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgprtdbg */
+#include <pgprtdbg.h>
+#include <compression.h>
+#include <output.h>
+#include <tracefile.h>
+
+/* system */
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <semaphore.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define SEGMENT_DIGITS 6
+
+static _Thread_local char* buffer = NULL;
+static _Thread_local size_t buffer_length = 0;
+static _Thread_local bool unbuffered = false;
+
+/* The output file of the process, only used under the file lock */
+static FILE* file = NULL;
+static unsigned int file_segment = 0;
+
+/* Only the trace writer writes a compressed output, so its stream is never interleaved */
+static struct compression* compression = NULL;
+
+static void output_append(char* data, size_t length);
+static void output_file_close(void);
+static void output_header(void);
+static bool output_segmented(void);
+static void output_segment_path(unsigned int segment, char* path, size_t size);
+static unsigned int output_segment_last(void);
+static int output_segment_create(unsigned int segment);
+static void output_segment_rotate(void);
+static void output_segment_remove(unsigned int last);
+static void output_segment_trim(unsigned int segment);
+
+int
+pgprtdbg_output_open(void)
+{
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   if (!output_segmented())
+   {
+      config->output_segment = 0;
+
+      file = fopen(config->output, "a+");
+      if (file == NULL)
+      {
+         return 1;
+      }
+
+      fseek(file, 0, SEEK_END);
+      if (ftell(file) == 0)
+      {
+         output_header();
+      }
+
+      return 0;
+   }
+
+   /* Every start gets a segment of its own, after the ones kept */
+   config->output_segment = output_segment_last() + 1;
+
+   if (output_segment_create(config->output_segment))
+   {
+      return 1;
+   }
+
+   output_segment_remove(config->output_segment);
+
+   return 0;
+}
+
+void
+pgprtdbg_output_close(void)
+{
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   if (config->output_segment != 0)
+   {
+      output_segment_trim(config->output_segment);
+   }
+
+   output_file_close();
+
+   pgprtdbg_compression_destroy(compression);
+   compression = NULL;
+}
+
+void
+pgprtdbg_output_write(char* line, size_t length)
+{
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   if (buffer == NULL && !unbuffered)
+   {
+      if (config->output_buffer > 0)
+      {
+         buffer = (char*)malloc(config->output_buffer);
+      }
+
+      unbuffered = buffer == NULL;
+   }
+
+   if (unbuffered || length >= (size_t)config->output_buffer)
+   {
+      pgprtdbg_output_flush();
+      pgprtdbg_output_write_file(line, length);
+      return;
+   }
+
+   if (buffer_length + length > (size_t)config->output_buffer)
+   {
+      pgprtdbg_output_flush();
+   }
+
+   memcpy(buffer + buffer_length, line, length);
+   buffer_length += length;
+
+   if (buffer_length == (size_t)config->output_buffer)
+   {
+      pgprtdbg_output_flush();
+   }
+}
+
+void
+pgprtdbg_output_flush(void)
+{
+   if (buffer_length > 0)
+   {
+      pgprtdbg_output_write_file(buffer, buffer_length);
+      buffer_length = 0;
+   }
+}
+
+void
+pgprtdbg_output_release(void)
+{
+   pgprtdbg_output_flush();
+
+   free(buffer);
+   buffer = NULL;
+   unbuffered = false;
+}
+
+void
+pgprtdbg_output_write_file(char* data, size_t length)
+{
+   char path[MISC_LENGTH];
+   FILE* f = NULL;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   sem_wait(&config->lock);
+
+   if (config->output_segment != 0)
+   {
+      /* Another process may have rotated the output since the last write */
+      if (file_segment != config->output_segment)
+      {
+         output_segment_path(config->output_segment, &path[0], sizeof(path));
+
+         /* The previous segment is written to until the current one can be opened */
+         f = fopen(&path[0], "a");
+         if (f != NULL)
+         {
+            output_file_close();
+
+            file = f;
+            file_segment = config->output_segment;
+         }
+      }
+
+      output_segment_rotate();
+   }
+
+   output_append(data, length);
+
+   sem_post(&config->lock);
+}
+
+static void
+output_append(char* data, size_t length)
+{
+   size_t written = 0;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   if (file == NULL)
+   {
+      return;
+   }
+
+   if (config->compression != COMPRESSION_NONE)
+   {
+      if (compression == NULL && pgprtdbg_compression_create(&compression))
+      {
+         return;
+      }
+
+      pgprtdbg_compression_write(compression, file, data, length, &written);
+      config->output_segment_bytes += written;
+
+      pgprtdbg_compression_flush(compression, file, &written);
+      config->output_segment_bytes += written;
+   }
+   else
+   {
+      fwrite(data, 1, length, file);
+      fflush(file);
+      config->output_segment_bytes += length;
+   }
+}
+
+static void
+output_file_close(void)
+{
+   size_t written = 0;
+
+   if (file == NULL)
+   {
+      return;
+   }
+
+   /* A segment ends with a complete gzip member, and the next one starts a new member */
+   if (compression != NULL)
+   {
+      pgprtdbg_compression_finish(compression, file, &written);
+   }
+
+   fflush(file);
+   fclose(file);
+   file = NULL;
+}
+
+static void
+output_header(void)
+{
+   struct tracefile_header header;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   /* A binary file starts with its header, so every segment can be read on its own */
+   if (config->output_format == OUTPUT_FORMAT_BINARY)
+   {
+      pgprtdbg_tracefile_header_init(&header);
+      output_append((char*)&header, sizeof(struct tracefile_header));
+   }
+}
+
+static bool
+output_segmented(void)
+{
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   return config->output_segment_size > 0 || config->output_segment_age > 0;
+}
+
+static void
+output_segment_path(unsigned int segment, char* path, size_t size)
+{
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   snprintf(path, size, "%s.%0*u", config->output, SEGMENT_DIGITS, segment);
+}
+
+static unsigned int
+output_segment_last(void)
+{
+   char directory[MISC_LENGTH];
+   char name[MISC_LENGTH];
+   char* base = NULL;
+   char* end = NULL;
+   size_t base_length;
+   unsigned long segment;
+   unsigned int last = 0;
+   DIR* dir = NULL;
+   struct dirent* entry = NULL;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   memcpy(&directory[0], config->output, sizeof(directory));
+   memcpy(&name[0], config->output, sizeof(name));
+
+   base = basename(&name[0]);
+   base_length = strlen(base);
+
+   dir = opendir(dirname(&directory[0]));
+   if (dir == NULL)
+   {
+      return 0;
+   }
+
+   while ((entry = readdir(dir)) != NULL)
+   {
+      if (strncmp(entry->d_name, base, base_length) || entry->d_name[base_length] != '.' ||
+          strlen(entry->d_name + base_length + 1) != SEGMENT_DIGITS)
+      {
+         continue;
+      }
+
+      segment = strtoul(entry->d_name + base_length + 1, &end, 10);
+
+      if (*end == '\0' && segment > last)
+      {
+         last = (unsigned int)segment;
+      }
+   }
+
+   closedir(dir);
+
+   return last;
+}
+
+static int
+output_segment_create(unsigned int segment)
+{
+   int fd;
+   char path[MISC_LENGTH];
+   FILE* f = NULL;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   output_segment_path(segment, &path[0], sizeof(path));
+
+   fd = open(&path[0], O_WRONLY | O_CREAT | O_APPEND, 0644);
+   if (fd == -1)
+   {
+      return 1;
+   }
+
+#if defined(__linux__)
+   /* The blocks are reserved up front, but the file only grows as it is written */
+   if (config->output_segment_size > 0)
+   {
+      fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, (off_t)config->output_segment_size * 1024 * 1024);
+   }
+#endif
+
+   f = fdopen(fd, "a");
+   if (f == NULL)
+   {
+      close(fd);
+      return 1;
+   }
+
+   output_file_close();
+
+   file = f;
+   file_segment = segment;
+
+   config->output_segment = segment;
+   config->output_segment_bytes = 0;
+   config->output_segment_start = time(NULL);
+
+   output_header();
+
+   return 0;
+}
+
+static void
+output_segment_rotate(void)
+{
+   bool rotate = false;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   if (config->output_segment_size > 0 &&
+       config->output_segment_bytes >= (size_t)config->output_segment_size * 1024 * 1024)
+   {
+      rotate = true;
+   }
+
+   if (config->output_segment_age > 0 && config->output_segment_bytes > 0 &&
+       time(NULL) - config->output_segment_start >= config->output_segment_age)
+   {
+      rotate = true;
+   }
+
+   if (!rotate)
+   {
+      return;
+   }
+
+   output_segment_trim(config->output_segment);
+
+   /* The current segment stays in use if the next one can't be created */
+   if (output_segment_create(config->output_segment + 1))
+   {
+      config->output_segment_bytes = 0;
+      config->output_segment_start = time(NULL);
+      return;
+   }
+
+   output_segment_remove(config->output_segment);
+}
+
+static void
+output_segment_remove(unsigned int last)
+{
+   char path[MISC_LENGTH];
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   if (config->output_segments == 0 || last <= (unsigned int)config->output_segments)
+   {
+      return;
+   }
+
+   /* The segments before the ones kept, until one that is already gone */
+   for (unsigned int segment = last - config->output_segments; segment > 0; segment--)
+   {
+      output_segment_path(segment, &path[0], sizeof(path));
+
+      if (unlink(&path[0]) == -1 && errno == ENOENT)
+      {
+         errno = 0;
+         break;
+      }
+   }
+}
+
+static void
+output_segment_trim(unsigned int segment)
+{
+   int fd;
+   char path[MISC_LENGTH];
+   struct stat st;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   if (config->output_segment_size == 0)
+   {
+      return;
+   }
+
+   output_segment_path(segment, &path[0], sizeof(path));
+
+   fd = open(&path[0], O_WRONLY);
+   if (fd == -1)
+   {
+      return;
+   }
+
+   /* Truncating at the end gives back the space preallocated past it */
+   if (fstat(fd, &st) == 0 && ftruncate(fd, st.st_size) == -1)
+   {
+      errno = 0;
+   }
+
+   close(fd);
+}
@@ -29,64 +29,131 @@
 /* pgprtdbg */
 #include <pgprtdbg.h>
 #include <logging.h>
+#include <memory.h>
 #include <message.h>
 #include <pipeline.h>
 #include <protocol.h>
 #include <worker.h>
 #include <utils.h>
+#include <counter.h>
+#include <decoder.h>
 
 /* system */
 #include <errno.h>
 #include <ev.h>
+#include <fcntl.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
-long identifier = 0;
+static int splice_move(struct ev_loop* loop, struct worker_io* wi, int from, int to, bool client, bool* to_failed);
+static void splice_capture(struct worker_io* wi, ssize_t length);
+static int queue_append(struct worker_io* wi, void* data, size_t length);
+static void queue_wait(struct ev_loop* loop, struct worker_io* wi, int to);
+static void queue_drain(struct ev_loop* loop, struct ev_io* watcher, int revents);
+static void session_finish(struct ev_loop* loop, struct worker_io* wi, int exit_code);
 
 void
 pipeline_client(struct ev_loop* loop, struct ev_io* watcher, int revents)
 {
    int status = MESSAGE_STATUS_ERROR;
+   bool terminate = false;
+   ssize_t written = 0;
    struct worker_io* wi = NULL;
+   struct message batch;
    struct message* msg = NULL;
    struct configuration* config = NULL;
 
    wi = (struct worker_io*)watcher;
    config = (struct configuration*)shmem;
 
-   status = pgprtdbg_read_message(wi->client_fd, &msg);
-   if (likely(status == MESSAGE_STATUS_OK))
+   pgprtdbg_memory_rewind();
+
+   memset(&batch, 0, sizeof(struct message));
+   batch.data = pgprtdbg_memory_data();
+
+   /* Read until the socket is drained or the budget is spent, and forward it all at once */
+   for (int i = 0; i < config->read_budget; i++)
    {
-      pgprtdbg_client(wi->client_fd, wi->server_fd, msg, wi->counter);
+      status = pgprtdbg_read_message(wi->client_fd, &msg);
+      if (status != MESSAGE_STATUS_OK)
+      {
+         break;
+      }
+
+      if (config->passthrough)
+      {
+         wi->counter->sent_messages++;
+         wi->counter->sent_bytes += msg->length;
+      }
+      else if (wi->session->stage == NULL && pgprtdbg_client(wi->client_fd, wi->server_fd, msg, wi->counter, wi->session->decoder))
+      {
+         goto client_error;
+      }
 
       if (config->save_traffic)
       {
-         identifier++;
-         pgprtdbg_save_client_traffic(getpid(), identifier, msg);
+         wi->session->identifier++;
+         pgprtdbg_save_client_traffic(wi->session->traffic_id, wi->session->identifier, msg);
       }
 
-      status = pgprtdbg_write_message(wi->server_fd, msg);
-      if (unlikely(status != MESSAGE_STATUS_OK))
+      pgprtdbg_memory_advance(msg->length);
+      batch.length += msg->length;
+
+      if (msg->kind == 'X')
+      {
+         terminate = true;
+         break;
+      }
+   }
+
+   if (status == MESSAGE_STATUS_ERROR && (errno == EAGAIN || errno == EWOULDBLOCK))
+   {
+      errno = 0;
+      status = MESSAGE_STATUS_OK;
+   }
+
+   if (likely(batch.length > 0))
+   {
+      if (unlikely(pgprtdbg_write_nonblock_message(wi->server_fd, &batch, &written) != MESSAGE_STATUS_OK))
       {
+         status = MESSAGE_STATUS_ERROR;
          goto server_error;
       }
 
-      if (msg->kind == 'X')
+      if (unlikely(written < batch.length))
+      {
+         if (queue_append(wi, batch.data + written, batch.length - written))
+         {
+            status = MESSAGE_STATUS_ERROR;
+            goto server_error;
+         }
+
+         queue_wait(loop, wi, wi->server_fd);
+      }
+
+      /* Forwarded first, decoded off the critical path */
+      if (wi->session->stage != NULL && !config->passthrough)
       {
-         exit_code = WORKER_SUCCESS;
-         running = 0;
+         pgprtdbg_decoder_stage_trace(wi->session, true, &batch);
       }
    }
+
+   if (terminate)
+   {
+      session_finish(loop, wi, WORKER_SUCCESS);
+      return;
+   }
    else if (status == MESSAGE_STATUS_ZERO)
    {
       goto client_done;
    }
-   else
+   else if (status == MESSAGE_STATUS_ERROR)
    {
       goto client_error;
    }
 
-   ev_break(loop, EVBREAK_ONE);
    return;
 
 client_done:
@@ -95,9 +162,7 @@ client_done:
    pgprtdbg_log_unlock();
 
    errno = 0;
-   ev_break(loop, EVBREAK_ALL);
-   exit_code = WORKER_CLIENT_FAILURE;
-   running = 0;
+   pgprtdbg_worker_session_finish(loop, wi->session, WORKER_CLIENT_FAILURE);
    return;
 
 client_error:
@@ -115,9 +180,7 @@ client_error:
    }
 
    errno = 0;
-   ev_break(loop, EVBREAK_ALL);
-   exit_code = WORKER_CLIENT_FAILURE;
-   running = 0;
+   pgprtdbg_worker_session_finish(loop, wi->session, WORKER_CLIENT_FAILURE);
    return;
 
 server_error:
@@ -135,9 +198,7 @@ server_error:
    }
 
    errno = 0;
-   ev_break(loop, EVBREAK_ALL);
-   exit_code = WORKER_SERVER_FAILURE;
-   running = 0;
+   pgprtdbg_worker_session_finish(loop, wi->session, WORKER_SERVER_FAILURE);
    return;
 }
 
@@ -146,29 +207,47 @@ pipeline_server(struct ev_loop* loop, struct ev_io* watcher, int revents)
 {
    int status = MESSAGE_STATUS_ERROR;
    bool fatal = false;
+   ssize_t written = 0;
    struct worker_io* wi = NULL;
+   struct message batch;
    struct message* msg = NULL;
    struct configuration* config = NULL;
 
    wi = (struct worker_io*)watcher;
    config = (struct configuration*)shmem;
 
-   status = pgprtdbg_read_message(wi->server_fd, &msg);
-   if (likely(status == MESSAGE_STATUS_OK))
+   pgprtdbg_memory_rewind();
+
+   memset(&batch, 0, sizeof(struct message));
+   batch.data = pgprtdbg_memory_data();
+
+   /* Read until the socket is drained or the budget is spent, and forward it all at once */
+   for (int i = 0; i < config->read_budget; i++)
    {
-      pgprtdbg_server(wi->server_fd, wi->client_fd, msg, wi->counter);
+      status = pgprtdbg_read_message(wi->server_fd, &msg);
+      if (status != MESSAGE_STATUS_OK)
+      {
+         break;
+      }
 
-      if (config->save_traffic)
+      if (config->passthrough)
       {
-         pgprtdbg_save_server_traffic(getpid(), identifier, msg);
+         wi->counter->rcvd_messages++;
+         wi->counter->rcvd_bytes += msg->length;
+      }
+      else if (wi->session->stage == NULL && pgprtdbg_server(wi->server_fd, wi->client_fd, msg, wi->counter, wi->session->decoder))
+      {
+         goto server_error;
       }
 
-      status = pgprtdbg_write_message(wi->client_fd, msg);
-      if (unlikely(status != MESSAGE_STATUS_OK))
+      if (config->save_traffic)
       {
-         goto client_error;
+         pgprtdbg_save_server_traffic(wi->session->traffic_id, wi->session->identifier, msg);
       }
 
+      pgprtdbg_memory_advance(msg->length);
+      batch.length += msg->length;
+
       if (unlikely(msg->kind == 'E'))
       {
          fatal = false;
@@ -185,21 +264,56 @@ pipeline_server(struct ev_loop* loop, struct ev_io* watcher, int revents)
 
          if (fatal)
          {
-            exit_code = WORKER_SERVER_FATAL;
-            running = 0;
+            break;
          }
       }
    }
+
+   if (status == MESSAGE_STATUS_ERROR && (errno == EAGAIN || errno == EWOULDBLOCK))
+   {
+      errno = 0;
+      status = MESSAGE_STATUS_OK;
+   }
+
+   if (likely(batch.length > 0))
+   {
+      if (unlikely(pgprtdbg_write_nonblock_message(wi->client_fd, &batch, &written) != MESSAGE_STATUS_OK))
+      {
+         status = MESSAGE_STATUS_ERROR;
+         goto client_error;
+      }
+
+      if (unlikely(written < batch.length))
+      {
+         if (queue_append(wi, batch.data + written, batch.length - written))
+         {
+            status = MESSAGE_STATUS_ERROR;
+            goto client_error;
+         }
+
+         queue_wait(loop, wi, wi->client_fd);
+      }
+
+      if (wi->session->stage != NULL && !config->passthrough)
+      {
+         pgprtdbg_decoder_stage_trace(wi->session, false, &batch);
+      }
+   }
+
+   if (fatal)
+   {
+      session_finish(loop, wi, WORKER_SERVER_FATAL);
+      return;
+   }
    else if (status == MESSAGE_STATUS_ZERO)
    {
       goto server_done;
    }
-   else
+   else if (status == MESSAGE_STATUS_ERROR)
    {
       goto server_error;
    }
 
-   ev_break(loop, EVBREAK_ONE);
    return;
 
 client_error:
@@ -217,9 +331,7 @@ client_error:
    }
 
    errno = 0;
-   ev_break(loop, EVBREAK_ALL);
-   exit_code = WORKER_CLIENT_FAILURE;
-   running = 0;
+   pgprtdbg_worker_session_finish(loop, wi->session, WORKER_CLIENT_FAILURE);
    return;
 
 server_done:
@@ -228,8 +340,7 @@ server_done:
    pgprtdbg_log_unlock();
 
    errno = 0;
-   ev_break(loop, EVBREAK_ALL);
-   running = 0;
+   pgprtdbg_worker_session_finish(loop, wi->session, WORKER_FAILURE);
    return;
 
 server_error:
@@ -247,8 +358,416 @@ server_error:
    }
 
    errno = 0;
-   ev_break(loop, EVBREAK_ALL);
-   exit_code = WORKER_SERVER_FAILURE;
-   running = 0;
+   pgprtdbg_worker_session_finish(loop, wi->session, WORKER_SERVER_FAILURE);
+   return;
+}
+
+bool
+pipeline_splice_available(void)
+{
+#if defined(__linux__)
+   return true;
+#else
+   return false;
+#endif
+}
+
+int
+pipeline_splice_init(struct worker_io* wi, bool client)
+{
+#if defined(__linux__)
+   char filename[MISC_LENGTH];
+   struct configuration* config = NULL;
+
+   config = (struct configuration*)shmem;
+
+   if (pipe2(wi->pipe_fds, O_NONBLOCK | O_CLOEXEC) == -1)
+   {
+      goto error;
+   }
+
+   if (config->save_traffic)
+   {
+      if (pipe2(wi->capture_fds, O_NONBLOCK | O_CLOEXEC) == -1)
+      {
+         goto error;
+      }
+
+      memset(&filename, 0, sizeof(filename));
+      snprintf(&filename[0], sizeof(filename), "%d-%s.raw", wi->session->traffic_id, client ? "client" : "server");
+
+      /* splice() doesn't support O_APPEND */
+      wi->capture_fd = open(&filename[0], O_WRONLY | O_CREAT | O_CLOEXEC, 0640);
+      if (wi->capture_fd == -1)
+      {
+         goto error;
+      }
+
+      lseek(wi->capture_fd, 0, SEEK_END);
+   }
+
+   return 0;
+
+error:
+
+   pgprtdbg_log_lock();
+   pgprtdbg_log_line("pipeline_splice_init: %s", strerror(errno));
+   pgprtdbg_log_unlock();
+   errno = 0;
+
+   pipeline_splice_destroy(wi);
+#endif
+
+   return 1;
+}
+
+void
+pipeline_splice_destroy(struct worker_io* wi)
+{
+   for (int i = 0; i < 2; i++)
+   {
+      if (wi->pipe_fds[i] != -1)
+      {
+         close(wi->pipe_fds[i]);
+         wi->pipe_fds[i] = -1;
+      }
+
+      if (wi->capture_fds[i] != -1)
+      {
+         close(wi->capture_fds[i]);
+         wi->capture_fds[i] = -1;
+      }
+   }
+
+   if (wi->capture_fd != -1)
+   {
+      close(wi->capture_fd);
+      wi->capture_fd = -1;
+   }
+}
+
+void
+pipeline_splice_client(struct ev_loop* loop, struct ev_io* watcher, int revents)
+{
+   int status = MESSAGE_STATUS_ERROR;
+   bool server_failed = false;
+   struct worker_io* wi = NULL;
+
+   wi = (struct worker_io*)watcher;
+
+   status = splice_move(loop, wi, wi->client_fd, wi->server_fd, true, &server_failed);
+   if (likely(status == MESSAGE_STATUS_OK))
+   {
+      return;
+   }
+
+   if (status == MESSAGE_STATUS_ZERO)
+   {
+      pgprtdbg_log_lock();
+      pgprtdbg_log_line("[C] client_done: client_fd %d (%d)", wi->client_fd, status);
+      pgprtdbg_log_unlock();
+
+      errno = 0;
+      pgprtdbg_worker_session_finish(loop, wi->session, WORKER_CLIENT_FAILURE);
+   }
+   else if (server_failed)
+   {
+      pgprtdbg_log_lock();
+      pgprtdbg_log_line("[C] server_error: server_fd %d - %s (%d)", wi->server_fd, strerror(errno), status);
+      pgprtdbg_log_unlock();
+
+      errno = 0;
+      pgprtdbg_worker_session_finish(loop, wi->session, WORKER_SERVER_FAILURE);
+   }
+   else
+   {
+      pgprtdbg_log_lock();
+      pgprtdbg_log_line("[C] client_error: client_fd %d - %s (%d)", wi->client_fd, strerror(errno), status);
+      pgprtdbg_log_unlock();
+
+      errno = 0;
+      pgprtdbg_worker_session_finish(loop, wi->session, WORKER_CLIENT_FAILURE);
+   }
+}
+
+void
+pipeline_splice_server(struct ev_loop* loop, struct ev_io* watcher, int revents)
+{
+   int status = MESSAGE_STATUS_ERROR;
+   bool client_failed = false;
+   struct worker_io* wi = NULL;
+
+   wi = (struct worker_io*)watcher;
+
+   status = splice_move(loop, wi, wi->server_fd, wi->client_fd, false, &client_failed);
+   if (likely(status == MESSAGE_STATUS_OK))
+   {
+      return;
+   }
+
+   if (status == MESSAGE_STATUS_ZERO)
+   {
+      pgprtdbg_log_lock();
+      pgprtdbg_log_line("[C] server_done: server_fd %d (%d)", wi->server_fd, status);
+      pgprtdbg_log_unlock();
+
+      errno = 0;
+      pgprtdbg_worker_session_finish(loop, wi->session, WORKER_FAILURE);
+   }
+   else if (client_failed)
+   {
+      pgprtdbg_log_lock();
+      pgprtdbg_log_line("[S] client_error: client_fd %d - %s (%d)", wi->client_fd, strerror(errno), status);
+      pgprtdbg_log_unlock();
+
+      errno = 0;
+      pgprtdbg_worker_session_finish(loop, wi->session, WORKER_CLIENT_FAILURE);
+   }
+   else
+   {
+      pgprtdbg_log_lock();
+      pgprtdbg_log_line("[S] server_error: server_fd %d - %s (%d)", wi->server_fd, strerror(errno), status);
+      pgprtdbg_log_unlock();
+
+      errno = 0;
+      pgprtdbg_worker_session_finish(loop, wi->session, WORKER_SERVER_FAILURE);
+   }
+}
+
+static int
+splice_move(struct ev_loop* loop, struct worker_io* wi, int from, int to, bool client, bool* to_failed)
+{
+#if defined(__linux__)
+   ssize_t length;
+   ssize_t moved;
+   ssize_t numbytes;
+   struct configuration* config = NULL;
+
+   config = (struct configuration*)shmem;
+
+   for (int i = 0; i < config->read_budget; i++)
+   {
+      length = splice(from, NULL, wi->pipe_fds[1], NULL, config->buffer_size, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+      if (length == 0)
+      {
+         return MESSAGE_STATUS_ZERO;
+      }
+      else if (length == -1)
+      {
+         if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+         {
+            errno = 0;
+            return MESSAGE_STATUS_OK;
+         }
+
+         return MESSAGE_STATUS_ERROR;
+      }
+
+      if (client)
+      {
+         wi->counter->sent_messages++;
+         wi->counter->sent_bytes += length;
+      }
+      else
+      {
+         wi->counter->rcvd_messages++;
+         wi->counter->rcvd_bytes += length;
+      }
+
+      if (wi->capture_fd != -1)
+      {
+         splice_capture(wi, length);
+      }
+
+      moved = 0;
+
+      while (moved < length)
+      {
+         numbytes = splice(wi->pipe_fds[0], NULL, to, NULL, length - moved, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+         if (numbytes == -1)
+         {
+            if (errno == EINTR)
+            {
+               continue;
+            }
+            else if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+               /* The rest stays in the pipe until the destination is writable */
+               errno = 0;
+               wi->queue_length = length - moved;
+               queue_wait(loop, wi, to);
+               return MESSAGE_STATUS_OK;
+            }
+
+            *to_failed = true;
+            return MESSAGE_STATUS_ERROR;
+         }
+
+         moved += numbytes;
+      }
+   }
+
+   return MESSAGE_STATUS_OK;
+#else
+   return MESSAGE_STATUS_ERROR;
+#endif
+}
+
+static void
+splice_capture(struct worker_io* wi, ssize_t length)
+{
+#if defined(__linux__)
+   ssize_t duplicated;
+   ssize_t numbytes;
+
+   /* Duplicate the pipe content without consuming it; a full capture pipe only costs the capture */
+   duplicated = tee(wi->pipe_fds[0], wi->capture_fds[1], length, SPLICE_F_NONBLOCK);
+
+   while (duplicated > 0)
+   {
+      numbytes = splice(wi->capture_fds[0], NULL, wi->capture_fd, NULL, duplicated, SPLICE_F_MOVE);
+
+      if (numbytes <= 0)
+      {
+         break;
+      }
+
+      duplicated -= numbytes;
+   }
+
+   errno = 0;
+#endif
+}
+
+static int
+queue_append(struct worker_io* wi, void* data, size_t length)
+{
+   char* queue = NULL;
+
+   if (wi->queue_offset + wi->queue_length + length > wi->queue_size)
+   {
+      if (wi->queue_offset > 0)
+      {
+         memmove(wi->queue, wi->queue + wi->queue_offset, wi->queue_length);
+         wi->queue_offset = 0;
+      }
+
+      if (wi->queue_length + length > wi->queue_size)
+      {
+         queue = realloc(wi->queue, wi->queue_length + length);
+         if (queue == NULL)
+         {
+            return 1;
+         }
+
+         wi->queue = queue;
+         wi->queue_size = wi->queue_length + length;
+      }
+   }
+
+   memcpy(wi->queue + wi->queue_offset + wi->queue_length, data, length);
+   wi->queue_length += length;
+
+   return 0;
+}
+
+static void
+queue_wait(struct ev_loop* loop, struct worker_io* wi, int to)
+{
+   /* Stop reading the source until the destination has taken the pending output */
+   ev_io_stop(loop, (struct ev_io*)wi);
+
+   if (!ev_is_active(&wi->write_io))
+   {
+      ev_io_init(&wi->write_io, queue_drain, to, EV_WRITE);
+      wi->write_io.data = wi;
+      ev_io_start(loop, &wi->write_io);
+   }
+}
+
+static void
+queue_drain(struct ev_loop* loop, struct ev_io* watcher, int revents)
+{
+   bool client;
+   ssize_t numbytes;
+   struct worker_io* wi = NULL;
+
+   wi = (struct worker_io*)watcher->data;
+   client = wi == &wi->session->client_io;
+
+   while (wi->queue_length > 0)
+   {
+#if defined(__linux__)
+      if (wi->pipe_fds[0] != -1)
+      {
+         numbytes = splice(wi->pipe_fds[0], NULL, watcher->fd, NULL, wi->queue_length, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+      }
+      else
+      {
+         numbytes = write(watcher->fd, wi->queue + wi->queue_offset, wi->queue_length);
+      }
+#else
+      numbytes = write(watcher->fd, wi->queue + wi->queue_offset, wi->queue_length);
+#endif
+
+      if (likely(numbytes > 0))
+      {
+         if (wi->pipe_fds[0] == -1)
+         {
+            wi->queue_offset += numbytes;
+         }
+         wi->queue_length -= numbytes;
+      }
+      else if (numbytes == -1 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+      {
+         errno = 0;
+         return;
+      }
+      else
+      {
+         goto error;
+      }
+   }
+
+   wi->queue_offset = 0;
+   ev_io_stop(loop, &wi->write_io);
+
+   if (wi->draining)
+   {
+      pgprtdbg_worker_session_finish(loop, wi->session, wi->session->exit_code);
+      return;
+   }
+
+   ev_io_start(loop, (struct ev_io*)wi);
    return;
+
+error:
+   pgprtdbg_log_lock();
+   if (client)
+   {
+      pgprtdbg_log_line("[C] server_error: server_fd %d - %s", watcher->fd, strerror(errno));
+   }
+   else
+   {
+      pgprtdbg_log_line("[S] client_error: client_fd %d - %s", watcher->fd, strerror(errno));
+   }
+   pgprtdbg_log_unlock();
+
+   errno = 0;
+   pgprtdbg_worker_session_finish(loop, wi->session, client ? WORKER_SERVER_FAILURE : WORKER_CLIENT_FAILURE);
+}
+
+static void
+session_finish(struct ev_loop* loop, struct worker_io* wi, int exit_code)
+{
+   if (wi->queue_length > 0)
+   {
+      wi->draining = true;
+      wi->session->exit_code = exit_code;
+      return;
+   }
+
+   pgprtdbg_worker_session_finish(loop, wi->session, exit_code);
 }
@@ -0,0 +1,312 @@
+/*
+ * Copyright (C) 2024 The pgprtdbg community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgprtdbg */
+#include <pgprtdbg.h>
+#include <logging.h>
+#include <network.h>
+#include <pool.h>
+#include <server.h>
+
+/* system */
+#include <errno.h>
+#include <ev.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#define POOL_RETRY 1.
+
+/** @struct
+ * A connection of the pool
+ */
+struct pool_connection
+{
+   struct ev_io io;        /**< Writable once connected, readable if closed by the server */
+   struct ev_timer timer;  /**< The connect timeout, the lifetime, or the retry delay */
+   struct pool* pool;      /**< The pool */
+   int fd;                 /**< The descriptor, or -1 */
+   int server;             /**< The server */
+   int address;            /**< The index of the server address */
+   bool ready;             /**< Is the connection established */
+};
+
+/** @struct
+ * A pool of connections
+ */
+struct pool
+{
+   struct ev_loop* loop;                /**< The event loop */
+   int size;                            /**< The number of connections */
+   int per_server;                      /**< The number of connections of each server */
+   struct pool_connection* connections; /**< The connections */
+};
+
+static void connection_start(struct pool_connection* c);
+static void connection_stop(struct pool_connection* c);
+static void connection_close(struct pool_connection* c);
+static void connect_cb(struct ev_loop* loop, struct ev_io* watcher, int revents);
+static void closed_cb(struct ev_loop* loop, struct ev_io* watcher, int revents);
+static void timer_cb(struct ev_loop* loop, struct ev_timer* watcher, int revents);
+
+int
+pgprtdbg_pool_init(struct ev_loop* loop, int size, struct pool** pool)
+{
+   struct pool* p = NULL;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   *pool = NULL;
+
+   p = (struct pool*)malloc(sizeof(struct pool));
+   if (p == NULL)
+   {
+      return 1;
+   }
+
+   p->loop = loop;
+   p->per_server = size;
+   p->size = size * config->number_of_servers;
+   p->connections = (struct pool_connection*)malloc(p->size * sizeof(struct pool_connection));
+   if (p->connections == NULL)
+   {
+      free(p);
+      return 1;
+   }
+   memset(p->connections, 0, p->size * sizeof(struct pool_connection));
+
+   for (int i = 0; i < p->size; i++)
+   {
+      p->connections[i].pool = p;
+      p->connections[i].fd = -1;
+      p->connections[i].server = i / size;
+      ev_init(&p->connections[i].io, connect_cb);
+      p->connections[i].io.data = &p->connections[i];
+      ev_init(&p->connections[i].timer, timer_cb);
+      p->connections[i].timer.data = &p->connections[i];
+
+      connection_start(&p->connections[i]);
+   }
+
+   *pool = p;
+
+   return 0;
+}
+
+int
+pgprtdbg_pool_get(struct pool* pool, int server, int* fd)
+{
+   char b;
+   ssize_t r;
+   struct pool_connection* c;
+
+   *fd = -1;
+
+   if (pool == NULL || server < 0)
+   {
+      return 1;
+   }
+
+   for (int i = server * pool->per_server; i < (server + 1) * pool->per_server; i++)
+   {
+      c = &pool->connections[i];
+
+      if (!c->ready)
+      {
+         continue;
+      }
+
+      connection_stop(c);
+
+      /* The server may have closed it since the last loop iteration */
+      r = recv(c->fd, &b, 1, MSG_PEEK | MSG_DONTWAIT);
+      if (r == 0 || (r == -1 && errno != EAGAIN && errno != EWOULDBLOCK))
+      {
+         errno = 0;
+         connection_close(c);
+         connection_start(c);
+         continue;
+      }
+      errno = 0;
+
+      *fd = c->fd;
+      c->fd = -1;
+      c->ready = false;
+
+      connection_start(c);
+
+      return 0;
+   }
+
+   return 1;
+}
+
+void
+pgprtdbg_pool_forget(struct pool* pool)
+{
+   if (pool == NULL)
+   {
+      return;
+   }
+
+   for (int i = 0; i < pool->size; i++)
+   {
+      pgprtdbg_disconnect(pool->connections[i].fd);
+      pool->connections[i].fd = -1;
+   }
+}
+
+void
+pgprtdbg_pool_destroy(struct pool* pool)
+{
+   if (pool == NULL)
+   {
+      return;
+   }
+
+   for (int i = 0; i < pool->size; i++)
+   {
+      connection_stop(&pool->connections[i]);
+      connection_close(&pool->connections[i]);
+   }
+
+   free(pool->connections);
+   free(pool);
+}
+
+static void
+connection_start(struct pool_connection* c)
+{
+   socklen_t length;
+   struct sockaddr_storage address;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   while (!pgprtdbg_server_address(c->server, c->address, &address, &length))
+   {
+      if (pgprtdbg_connect((struct sockaddr*)&address, length, &c->fd))
+      {
+         c->address++;
+         continue;
+      }
+
+      ev_io_set(&c->io, c->fd, EV_WRITE);
+      ev_set_cb(&c->io, connect_cb);
+      ev_io_start(c->pool->loop, &c->io);
+
+      ev_timer_set(&c->timer, config->connect_timeout, 0.);
+      ev_timer_start(c->pool->loop, &c->timer);
+
+      return;
+   }
+
+   /* The server isn't reachable right now */
+   pgprtdbg_server_failure(c->server);
+   c->address = 0;
+   ev_timer_set(&c->timer, POOL_RETRY, 0.);
+   ev_timer_start(c->pool->loop, &c->timer);
+}
+
+static void
+connection_stop(struct pool_connection* c)
+{
+   ev_io_stop(c->pool->loop, &c->io);
+   ev_timer_stop(c->pool->loop, &c->timer);
+}
+
+static void
+connection_close(struct pool_connection* c)
+{
+   pgprtdbg_disconnect(c->fd);
+   c->fd = -1;
+   c->ready = false;
+}
+
+static void
+connect_cb(struct ev_loop* loop, struct ev_io* watcher, int revents)
+{
+   struct pool_connection* c = (struct pool_connection*)watcher->data;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   connection_stop(c);
+
+   if (pgprtdbg_connect_result(c->fd))
+   {
+      connection_close(c);
+      c->address++;
+      connection_start(c);
+      return;
+   }
+
+   pgprtdbg_server_success(c->server);
+   c->address = 0;
+   c->ready = true;
+
+   /* Replaced before the server gives up waiting for a startup message */
+   ev_io_set(&c->io, c->fd, EV_READ);
+   ev_set_cb(&c->io, closed_cb);
+   ev_io_start(loop, &c->io);
+
+   ev_timer_set(&c->timer, config->pool_lifetime, 0.);
+   ev_timer_start(loop, &c->timer);
+}
+
+static void
+closed_cb(struct ev_loop* loop, struct ev_io* watcher, int revents)
+{
+   struct pool_connection* c = (struct pool_connection*)watcher->data;
+
+   connection_stop(c);
+   connection_close(c);
+   connection_start(c);
+}
+
+static void
+timer_cb(struct ev_loop* loop, struct ev_timer* watcher, int revents)
+{
+   struct pool_connection* c = (struct pool_connection*)watcher->data;
+
+   connection_stop(c);
+
+   if (c->fd != -1 && !c->ready)
+   {
+      pgprtdbg_log_lock();
+      pgprtdbg_log_line("pgprtdbg: Connect timeout");
+      pgprtdbg_log_unlock();
+
+      c->address++;
+   }
+
+   connection_close(c);
+   connection_start(c);
+}
@@ -29,12 +29,19 @@
 /* pgprtdbg */
 #include <pgprtdbg.h>
 #include <logging.h>
+#include <memory.h>
 #include <message.h>
+#include <output.h>
 #include <pipeline.h>
 #include <protocol.h>
+#include <server.h>
+#include <trace.h>
+#include <tracefile.h>
 #include <worker.h>
 #include <utils.h>
 #include <counter.h>
+#include <cursor.h>
+#include <frame.h>
 
 /* system */
 #include <ev.h>
@@ -46,60 +53,105 @@
 #include <unistd.h>
 #include <sys/types.h>
 
-static void output_write(char* id, int from, int to, signed char kind, char* text);
-
-static void fe_zero(int client_fd, char** text);
-static void fe_B(char** text);
-static void fe_C(char** text);
-static void fe_D(char** text);
-static void fe_E(char** text);
-static void fe_F(char** text);
-static void fe_H(char** text);
-static void fe_P(char** text);
-static void fe_Q(char** text);
-static void fe_S(char** text);
-static void fe_X(char** text);
-static void fe_c(char** text);
-static void fe_d(char** text);
-static void fe_f(char** text);
-static void fe_p(char** text);
-
-static void be_one(char** text);
-static void be_two(char** text);
-static void be_three(char** text);
-static void be_A(char** text);
-static void be_C(char** text);
-static void be_D(char** text);
-static void be_E(char** text);
-static void be_G(char** text);
-static void be_H(char** text);
-static void be_I(char** text);
-static void be_K(char** text);
-static void be_N(char** text);
-static void be_R(char** text);
-static void be_S(char** text);
-static void be_T(char** text);
-static void be_V(char** text);
-static void be_W(char** text);
-static void be_Z(char** text);
-static void be_c(char** text);
-static void be_d(char** text);
-static void be_n(char** text);
-static void be_s(char** text);
-static void be_t(char** text);
-static void be_v(char** text);
-
-static signed char kind = 0;
-static int32_t length = 0;
-
-static size_t data_size = 0;
-static size_t new_data_size = 0;
-static void* data = NULL;
+/* The kind and the length */
+#define MESSAGE_HEADER_SIZE 5
+
+static void output_write(struct decoder* decoder, struct stream* s, char direction, int from, int to, bool complete, char* text);
+static size_t stream_skip_start(struct stream* s, char* id, size_t available);
+static size_t stream_skip(struct stream* s, char* id, size_t available);
+static void stream_invalid(struct stream* s, char* id);
+
+static int fe_zero(struct stream* s, int client_fd, char** text);
+static void fe_B(struct stream* s, struct decoder* decoder, struct cursor* c, char** text);
+static void fe_P(struct stream* s, struct decoder* decoder, struct cursor* c, char** text);
+static void fe_d(struct stream* s, struct decoder* decoder, struct cursor* c, char** text);
+static void fe_p(struct stream* s, struct decoder* decoder, struct cursor* c, char** text);
+
+static void be_D(struct stream* s, struct decoder* decoder, struct cursor* c, char** text);
+static void be_E(struct stream* s, struct decoder* decoder, struct cursor* c, char** text);
+static void be_K(struct stream* s, struct decoder* decoder, struct cursor* c, char** text);
+static void be_R(struct stream* s, struct decoder* decoder, struct cursor* c, char** text);
+static void be_T(struct stream* s, struct decoder* decoder, struct cursor* c, char** text);
+static void be_d(struct stream* s, struct decoder* decoder, struct cursor* c, char** text);
+
+/* The layout of a message lists the fields after the header. Each field is a
+ * type, a label and a ';'. The types are b for a byte, h for an int16, i for
+ * an int32 and s for a string. A message that needs more has a decode
+ * function instead */
+#define FRONTEND_MESSAGES(X)        \
+   X('B', fe_B, NULL)               \
+   X('C', NULL, "bType;sPortal;")   \
+   X('D', NULL, "bType;sName;")     \
+   X('E', NULL, "sPortal;iMaxRows;") \
+   X('F', NULL, "")                 \
+   X('H', NULL, "")                 \
+   X('P', fe_P, NULL)               \
+   X('Q', NULL, "sQuery;")          \
+   X('S', NULL, "")                 \
+   X('X', NULL, "")                 \
+   X('c', NULL, "")                 \
+   X('d', fe_d, NULL)               \
+   X('f', NULL, "sFailure;")        \
+   X('p', fe_p, NULL)
+
+#define BACKEND_MESSAGES(X)         \
+   X('1', NULL, "")                 \
+   X('2', NULL, "")                 \
+   X('3', NULL, "")                 \
+   X('A', NULL, "")                 \
+   X('C', NULL, "sTag;")            \
+   X('D', be_D, NULL)               \
+   X('E', be_E, NULL)               \
+   X('G', NULL, "")                 \
+   X('H', NULL, "")                 \
+   X('I', NULL, "")                 \
+   X('K', be_K, NULL)               \
+   X('N', NULL, "")                 \
+   X('R', be_R, NULL)               \
+   X('S', NULL, "sName;sValue;")    \
+   X('T', be_T, NULL)               \
+   X('V', NULL, "")                 \
+   X('W', NULL, "")                 \
+   X('Z', NULL, "bState;")          \
+   X('c', NULL, "")                 \
+   X('d', be_d, NULL)               \
+   X('n', NULL, "")                 \
+   X('s', NULL, "")                 \
+   X('t', NULL, "")                 \
+   X('v', NULL, "")
+
+#define MESSAGE_TYPE(kind, function, fields) [(unsigned char)(kind)] = {.decode = function, .layout = fields},
+
+typedef void (*decode_function)(struct stream* s, struct decoder* decoder, struct cursor* c, char** text);
+
+/** @struct
+ * Defines how a message kind is decoded
+ */
+struct message_type
+{
+   decode_function decode; /**< The decode function, or NULL to decode the layout */
+   const char* layout;     /**< The fields after the header, or NULL for an unknown kind */
+};
 
-void
-pgprtdbg_client(int from, int to, struct message* msg, struct event_counter* counter)
+static const struct message_type frontend_messages[256] = {FRONTEND_MESSAGES(MESSAGE_TYPE)};
+static const struct message_type backend_messages[256] = {BACKEND_MESSAGES(MESSAGE_TYPE)};
+
+static bool decode_message(struct stream* s, struct decoder* decoder, const struct message_type* types, char* id, char** text);
+static void decode_layout(struct stream* s, struct cursor* c, char* id, const char* layout);
+
+int
+pgprtdbg_client(int from, int to, struct message* msg, struct event_counter* counter, struct decoder* decoder)
 {
+   int status = 0;
    char* text = NULL;
+   char* buffer = NULL;
+   struct stream* s = &decoder->frontend;
+   size_t size = 0;
+   size_t offset = 0;
+   size_t skipped = 0;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
 
    pgprtdbg_log_lock();
    pgprtdbg_log_line("--------");
@@ -107,88 +159,96 @@ pgprtdbg_client(int from, int to, struct message* msg, struct event_counter* cou
    pgprtdbg_log_line("FE/Message (%d):", msg->length);
    pgprtdbg_log_mem(msg->data, msg->length);
 
-   counter->sent_messages++;
-   counter->sent_bytes += msg->length;
+   if (counter != NULL)
+   {
+      counter->sent_messages++;
+      counter->sent_bytes += msg->length;
+   }
 
-   data = pgprtdbg_data_append(data, data_size, msg->data, msg->length, &new_data_size);
-   data_size = new_data_size;
+   /* Without its framing the rest of the stream can't be decoded, so it is only forwarded */
+   if (s->invalid)
+   {
+      pgprtdbg_log_unlock();
+      return 0;
+   }
 
-   while (data_size > 0)
+   /* The rest of an oversized message is never buffered */
+   if (s->skip > 0)
    {
-      kind = pgprtdbg_read_byte(data);
+      skipped = stream_skip(s, "FE", msg->length);
+   }
 
-      if (kind == 0 && data_size >= 8)
+   buffer = pgprtdbg_frame_begin(&s->frame, (char*)msg->data + skipped, msg->length - skipped, &size);
+
+   while (offset < size)
+   {
+      s->data = buffer + offset;
+      s->available = size - offset;
+      s->kind = pgprtdbg_read_byte(s->data);
+
+      if (s->kind == 0 && size - offset >= 8)
       {
-         length = pgprtdbg_read_int32(data);
-         fe_zero(from, &text);
+         s->length = pgprtdbg_read_int32(s->data);
+
+         if (s->length < 8)
+         {
+            stream_invalid(s, "FE");
+            offset = size;
+            goto done;
+         }
+
+         if ((size_t)s->length > (size_t)config->decode_limit)
+         {
+            offset += stream_skip_start(s, "FE", size - offset);
+            continue;
+         }
 
-         data = pgprtdbg_data_remove(data, data_size, length, &new_data_size);
-         data_size = new_data_size;
+         /* Keep a partial startup message in the frame, like any other message */
+         if (size - offset < (size_t)s->length)
+         {
+            goto done;
+         }
+
+         if (fe_zero(s, decoder->offline ? -1 : from, &text))
+         {
+            status = 1;
+            goto done;
+         }
+
+         offset += s->length;
       }
-      else if (kind != 0 && data_size >= 5)
+      else if (s->kind != 0 && size - offset >= 5)
       {
-         length = pgprtdbg_read_int32(data + 1);
+         s->length = pgprtdbg_read_int32(s->data + 1);
+
+         if (s->length < 4)
+         {
+            stream_invalid(s, "FE");
+            offset = size;
+            goto done;
+         }
+
+         if ((size_t)s->length + 1 > (size_t)config->decode_limit)
+         {
+            output_write(decoder, s, 'C', from, to, false, NULL);
+            offset += stream_skip_start(s, "FE", size - offset);
+            continue;
+         }
 
-         if (data_size < length + 1)
+         if (size - offset < (size_t)s->length + 1)
          {
             goto done;
          }
 
-         switch (kind)
+         if (!decode_message(s, decoder, frontend_messages, "FE", &text))
          {
-            case 'B':
-               fe_B(&text);
-               break;
-            case 'C':
-               fe_C(&text);
-               break;
-            case 'D':
-               fe_D(&text);
-               break;
-            case 'E':
-               fe_E(&text);
-               break;
-            case 'F':
-               fe_F(&text);
-               break;
-            case 'H':
-               fe_H(&text);
-               break;
-            case 'P':
-               fe_P(&text);
-               break;
-            case 'Q':
-               fe_Q(&text);
-               break;
-            case 'S':
-               fe_S(&text);
-               break;
-            case 'X':
-               fe_X(&text);
-               break;
-            case 'c':
-               fe_c(&text);
-               break;
-            case 'd':
-               fe_d(&text);
-               break;
-            case 'f':
-               fe_f(&text);
-               break;
-            case 'p':
-               fe_p(&text);
-               break;
-            default:
-               pgprtdbg_log_line("Unsupported client message: %d", kind);
-               break;
+            pgprtdbg_log_line("Unsupported client message: %d", s->kind);
          }
 
-         output_write("C", from, to, kind, text);
-         free(text);
+         output_write(decoder, s, 'C', from, to, true, text);
          text = NULL;
 
-         data = pgprtdbg_data_remove(data, data_size, length + 1, &new_data_size);
-         data_size = new_data_size;
+         offset += s->length + 1;
       }
       else
       {
@@ -198,13 +258,28 @@ pgprtdbg_client(int from, int to, struct message* msg, struct event_counter* cou
 
 done:
 
+   pgprtdbg_frame_end(&s->frame, buffer, size, offset);
+   pgprtdbg_arena_reset(&s->arena);
+   s->data = NULL;
+
    pgprtdbg_log_unlock();
+
+   return status;
 }
 
-void
-pgprtdbg_server(int from, int to, struct message* msg, struct event_counter* counter)
+int
+pgprtdbg_server(int from, int to, struct message* msg, struct event_counter* counter, struct decoder* decoder)
 {
    char* text = NULL;
+   char* buffer = NULL;
+   struct stream* s = &decoder->backend;
+   size_t size = 0;
+   size_t offset = 0;
+   size_t skipped = 0;
+   bool ready = false;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
 
    pgprtdbg_log_lock();
    pgprtdbg_log_line("--------");
@@ -212,118 +287,76 @@ pgprtdbg_server(int from, int to, struct message* msg, struct event_counter* cou
    pgprtdbg_log_line("BE/Message (%d):", msg->length);
    pgprtdbg_log_mem(msg->data, msg->length);
 
-   counter->rcvd_messages++;
-   counter->rcvd_bytes += msg->length;
+   if (counter != NULL)
+   {
+      counter->rcvd_messages++;
+      counter->rcvd_bytes += msg->length;
+   }
+
+   if (s->invalid)
+   {
+      pgprtdbg_log_unlock();
+      return 0;
+   }
+
+   /* The rest of an oversized message is never buffered */
+   if (s->skip > 0)
+   {
+      skipped = stream_skip(s, "BE", msg->length);
+   }
 
-   data = pgprtdbg_data_append(data, data_size, msg->data, msg->length, &new_data_size);
-   data_size = new_data_size;
+   buffer = pgprtdbg_frame_begin(&s->frame, (char*)msg->data + skipped, msg->length - skipped, &size);
 
-   while (data_size > 0)
+   while (offset < size)
    {
-      kind = pgprtdbg_read_byte(data);
+      s->data = buffer + offset;
+      s->available = size - offset;
+      s->kind = pgprtdbg_read_byte(s->data);
 
-      if (kind == 'N' && data_size == 1)
+      if (s->kind == 'N' && size - offset == 1)
       {
-         length = 1;
-         be_N(&text);
+         s->length = 1;
+         pgprtdbg_log_line("BE: N");
 
-         data = pgprtdbg_data_remove(data, data_size, length, &new_data_size);
-         data_size = new_data_size;
+         offset += s->length;
       }
-      else if (kind != 0 && data_size >= 5)
+      else if (s->kind != 0 && size - offset >= 5)
       {
-         length = pgprtdbg_read_int32(data + 1);
+         s->length = pgprtdbg_read_int32(s->data + 1);
 
-         if (data_size < length + 1)
+         if (s->length < 4)
          {
+            stream_invalid(s, "BE");
+            offset = size;
             goto done;
          }
 
-         switch (kind)
+         if ((size_t)s->length + 1 > (size_t)config->decode_limit)
          {
-            case '1':
-               be_one(&text);
-               break;
-            case '2':
-               be_two(&text);
-               break;
-            case '3':
-               be_three(&text);
-               break;
-            case 'A':
-               be_A(&text);
-               break;
-            case 'C':
-               be_C(&text);
-               break;
-            case 'D':
-               be_D(&text);
-               break;
-            case 'E':
-               be_E(&text);
-               break;
-            case 'G':
-               be_G(&text);
-               break;
-            case 'H':
-               be_H(&text);
-               break;
-            case 'I':
-               be_I(&text);
-               break;
-            case 'K':
-               be_K(&text);
-               break;
-            case 'N':
-               be_N(&text);
-               break;
-            case 'R':
-               be_R(&text);
-               break;
-            case 'S':
-               be_S(&text);
-               break;
-            case 'T':
-               be_T(&text);
-               break;
-            case 'V':
-               be_V(&text);
-               break;
-            case 'W':
-               be_W(&text);
-               break;
-            case 'Z':
-               be_Z(&text);
-               break;
-            case 'c':
-               be_c(&text);
-               break;
-            case 'd':
-               be_d(&text);
-               break;
-            case 'n':
-               be_n(&text);
-               break;
-            case 's':
-               be_s(&text);
-               break;
-            case 't':
-               be_t(&text);
-               break;
-            case 'v':
-               be_v(&text);
-               break;
-            default:
-               pgprtdbg_log_line("Unsupported server message: %d", kind);
-               break;
+            output_write(decoder, s, 'S', from, to, false, NULL);
+            offset += stream_skip_start(s, "BE", size - offset);
+            continue;
+         }
+
+         if (size - offset < (size_t)s->length + 1)
+         {
+            goto done;
          }
 
-         output_write("S", from, to, kind, text);
-         free(text);
+         if (!decode_message(s, decoder, backend_messages, "BE", &text))
+         {
+            pgprtdbg_log_line("Unsupported server message: %d", s->kind);
+         }
+
+         output_write(decoder, s, 'S', from, to, true, text);
          text = NULL;
 
-         data = pgprtdbg_data_remove(data, data_size, length + 1, &new_data_size);
-         data_size = new_data_size;
+         if (s->kind == 'Z')
+         {
+            ready = true;
+         }
+
+         offset += s->length + 1;
       }
       else
       {
@@ -333,142 +366,241 @@ pgprtdbg_server(int from, int to, struct message* msg, struct event_counter* cou
 
 done:
 
+   pgprtdbg_frame_end(&s->frame, buffer, size, offset);
+   pgprtdbg_arena_reset(&s->arena);
+   s->data = NULL;
+
+   /* A ReadyForQuery ends a query, so its trace is written right away */
+   if (ready && config->output_flush_ready)
+   {
+      pgprtdbg_output_flush();
+   }
+
    pgprtdbg_log_unlock();
+
+   return 0;
+}
+
+void
+pgprtdbg_decoder_reset(struct decoder* decoder)
+{
+   pgprtdbg_frame_destroy(&decoder->frontend.frame);
+   pgprtdbg_frame_destroy(&decoder->backend.frame);
+   pgprtdbg_arena_destroy(&decoder->frontend.arena);
+   pgprtdbg_arena_destroy(&decoder->backend.arena);
+
+   pgprtdbg_server_key_remove(decoder->key);
+   decoder->key = -1;
 }
 
 static void
-output_write(char* id, int from, int to, signed char kind, char* text)
+output_write(struct decoder* decoder, struct stream* s, char direction, int from, int to, bool complete, char* text)
 {
    char line[MISC_LENGTH];
+   char* record = NULL;
+   size_t size;
+   size_t text_length = 0;
+   size_t payload_length = 0;
    struct configuration* config;
 
-   memset(&line, 0, sizeof(line));
    config = (struct configuration*)shmem;
 
-   sem_wait(&config->lock);
+   if (text != NULL)
+   {
+      text_length = strlen(text);
+   }
 
-   if ((kind >= 'A' && kind <= 'Z') || (kind >= 'a' && kind <= 'z') || (kind >= '0' && kind <= '9') || kind == '?')
+   if (config->output_format == OUTPUT_FORMAT_BINARY)
    {
-      if (text != NULL)
+      /* Only a message that is buffered as a whole can have its bytes kept */
+      if (complete)
       {
-         if (config->output_sockets)
-         {
-            snprintf(&line[0], sizeof(line), "%s,%d,%d,%c,%s\n", id, from, to, kind, text);
-         }
-         else
-         {
-            snprintf(&line[0], sizeof(line), "%s,%c,%s\n", id, kind, text);
-         }
+         payload_length = MIN((size_t)config->output_payload, (size_t)s->length + 1);
       }
-      else
+
+      text_length = MIN(text_length, (size_t)UINT16_MAX);
+
+      record = (char*)pgprtdbg_arena_alloc(&s->arena, pgprtdbg_tracefile_record_size(text_length, payload_length));
+      if (record == NULL)
       {
-         if (config->output_sockets)
-         {
-            snprintf(&line[0], sizeof(line), "%s,%d,%d,%c\n", id, from, to, kind);
-         }
-         else
-         {
-            snprintf(&line[0], sizeof(line), "%s,%c\n", id, kind);
-         }
+         return;
       }
+
+      size = pgprtdbg_tracefile_record_encode(record, direction, decoder->session, from, to, s->kind, s->length,
+                                              text, text_length, s->data, payload_length);
    }
    else
    {
-      if (text != NULL)
-      {
-         if (config->output_sockets)
-         {
-            snprintf(&line[0], sizeof(line), "%s,%d,%d,%d,%s\n", id, from, to, kind, text);
-         }
-         else
-         {
-            snprintf(&line[0], sizeof(line), "%s,%d,%s\n", id, kind, text);
-         }
-      }
-      else
-      {
-         if (config->output_sockets)
-         {
-            snprintf(&line[0], sizeof(line), "%s,%d,%d,%d\n", id, from, to, kind);
-         }
-         else
-         {
-            snprintf(&line[0], sizeof(line), "%s,%d\n", id, kind);
-         }
-      }
+      size = pgprtdbg_tracefile_csv(&line[0], sizeof(line), direction, from, to, s->kind,
+                                    text, text_length, config->output_sockets);
+      record = &line[0];
    }
 
-   fputs(line, config->file);
-   fflush(config->file);
+   if (config->trace_writer)
+   {
+      pgprtdbg_trace_write(record, size);
+      return;
+   }
 
-   sem_post(&config->lock);
+   pgprtdbg_output_write(record, size);
+}
+
+static size_t
+stream_skip_start(struct stream* s, char* id, size_t available)
+{
+   size_t total;
+   size_t consumed;
+
+   /* The messages of the startup have no kind byte */
+   total = s->kind == 0 ? (size_t)s->length : (size_t)s->length + 1;
+   consumed = MIN(available, total);
+   s->skip = total - consumed;
+
+   pgprtdbg_log_line("%s: %c", id, s->kind);
+   pgprtdbg_log_line("    Length: %d", s->length);
+   pgprtdbg_log_line("    Skipped: %zu of %zu", consumed, total);
+
+   return consumed;
+}
+
+static size_t
+stream_skip(struct stream* s, char* id, size_t available)
+{
+   size_t total;
+   size_t consumed;
+
+   total = s->kind == 0 ? (size_t)s->length : (size_t)s->length + 1;
+   consumed = MIN(available, s->skip);
+   s->skip -= consumed;
+
+   pgprtdbg_log_line("%s: %c", id, s->kind);
+   pgprtdbg_log_line("    Skipped: %zu of %zu", total - s->skip, total);
+
+   return consumed;
 }
 
-/* fe_zero */
 static void
-fe_zero(int client_fd, char** text)
+stream_invalid(struct stream* s, char* id)
+{
+   pgprtdbg_log_line("%s: Invalid length %d of a message of kind %d; the rest is not decoded", id, s->length, s->kind);
+
+   /* Nothing after the bad length can be framed, so nothing of it is kept */
+   s->invalid = true;
+   s->skip = 0;
+}
+
+static bool
+decode_message(struct stream* s, struct decoder* decoder, const struct message_type* types, char* id, char** text)
+{
+   const struct message_type* type = &types[(unsigned char)s->kind];
+   struct cursor c;
+
+   pgprtdbg_cursor_init(&c, s->data, MIN((size_t)s->length + 1, s->available));
+   pgprtdbg_cursor_skip(&c, MESSAGE_HEADER_SIZE);
+
+   if (type->decode != NULL)
+   {
+      type->decode(s, decoder, &c, text);
+   }
+   else if (type->layout != NULL)
+   {
+      decode_layout(s, &c, id, type->layout);
+   }
+   else
+   {
+      return false;
+   }
+
+   if (c.error)
+   {
+      pgprtdbg_log_line("    Malformed message");
+   }
+
+   return true;
+}
+
+static void
+decode_layout(struct stream* s, struct cursor* c, char* id, const char* layout)
+{
+   int label_length;
+   const char* label;
+
+   pgprtdbg_log_line("%s: %c", id, s->kind);
+
+   for (const char* field = layout; *field != '\0'; field = label + label_length + 1)
+   {
+      label = field + 1;
+      label_length = (int)(strchr(label, ';') - label);
+
+      switch (*field)
+      {
+         case 'b':
+            pgprtdbg_log_line("    %.*s: %c", label_length, label, pgprtdbg_cursor_byte(c));
+            break;
+         case 'h':
+            pgprtdbg_log_line("    %.*s: %d", label_length, label, pgprtdbg_cursor_int16(c));
+            break;
+         case 'i':
+            pgprtdbg_log_line("    %.*s: %d", label_length, label, pgprtdbg_cursor_int32(c));
+            break;
+         case 's':
+            pgprtdbg_log_line("    %.*s: %s", label_length, label, pgprtdbg_cursor_string(c));
+            break;
+         default:
+            break;
+      }
+   }
+}
+
+/* fe_zero */
+static int
+fe_zero(struct stream* s, int client_fd, char** text)
 {
-   int start, end;
    int counter;
-   signed char c;
    char** array = NULL;
    int32_t request;
+   struct cursor c;
+   struct cursor scan;
+
+   pgprtdbg_cursor_init(&c, s->data, MIN((size_t)s->length, s->available));
+   pgprtdbg_cursor_skip(&c, 4);
 
-   request = pgprtdbg_read_int32(data + 4);
+   request = pgprtdbg_cursor_int32(&c);
 
    pgprtdbg_log_line("FE: 0");
    pgprtdbg_log_line("    Request: %d", request);
 
    if (request == 196608)
    {
+      /* The parameters are zero terminated strings, followed by a zero */
       counter = 0;
-
-      /* We know where the parameters start, and we know that the message is zero terminated */
-      for (int i = 8; i < length - 1; i++)
+      scan = c;
+      while (pgprtdbg_cursor_remaining(&scan) > 1 && !scan.error)
       {
-         c = pgprtdbg_read_byte(data + i);
-         if (c == 0)
-         {
-            counter++;
-         }
+         pgprtdbg_cursor_string(&scan);
+         counter++;
       }
 
-      array = (char**)malloc(sizeof(char*) * counter);
-
-      counter = 0;
-      start = 8;
-      end = 8;
-
-      for (int i = 8; i < length - 1; i++)
+      array = (char**)pgprtdbg_arena_alloc(&s->arena, sizeof(char*) * counter);
+      if (array == NULL)
       {
-         c = pgprtdbg_read_byte(data + i);
-         end++;
-         if (c == 0)
-         {
-            array[counter] = (char*)malloc(end - start);
-            memset(array[counter], 0, end - start);
-            memcpy(array[counter], data + start, end - start);
-
-            start = end;
-            counter++;
-         }
+         return 0;
       }
 
       for (int i = 0; i < counter; i++)
       {
-         pgprtdbg_log_line("    Data: %s", array[i]);
+         array[i] = pgprtdbg_cursor_string(&c);
       }
 
       for (int i = 0; i < counter; i++)
       {
-         free(array[i]);
+         pgprtdbg_log_line("    Data: %s", array[i]);
       }
-      free(array);
    }
    else if (request == 80877102)
    {
-      pgprtdbg_log_line("    PID: %d", pgprtdbg_read_int32(data + 8));
-      pgprtdbg_log_line("    Secret: %d", pgprtdbg_read_int32(data + 12));
+      pgprtdbg_log_line("    PID: %d", pgprtdbg_cursor_int32(&c));
+      pgprtdbg_log_line("    Secret: %d", pgprtdbg_cursor_int32(&c));
    }
    else if (request == 80877103)
    {
@@ -481,73 +613,51 @@ fe_zero(int client_fd, char** text)
    else if (request == 131072)
    {
       /* Protocol v2: Not supported */
-      pgprtdbg_write_connection_refused_old(client_fd);
-      pgprtdbg_write_empty(client_fd);
+      if (client_fd != -1)
+      {
+         pgprtdbg_write_connection_refused_old(client_fd);
+         pgprtdbg_write_empty(client_fd);
+      }
    }
    else
    {
-      exit(1);
+      pgprtdbg_log_line("    Unknown request");
+      return 1;
    }
+
+   return 0;
 }
 
 /* fe_B */
 static void
-fe_B(char** text)
+fe_B(struct stream* s, struct decoder* decoder, struct cursor* c, char** text)
 {
-   int o = 0;
    char* destination;
    char* source;
    int16_t codes;
    int16_t values;
    int16_t results;
+   int32_t size;
 
-   o += 1;
-   /* length */
-   o += 4;
-
-   destination = pgprtdbg_read_string(data + o);
-   o += strlen(destination) + 1;
-
-   source = pgprtdbg_read_string(data + o);
-   o += strlen(source) + 1;
-
-   codes = pgprtdbg_read_int16(data + o);
-   o += 2;
-
-   for (int16_t i = 0; i < codes; i++)
-   {
-      pgprtdbg_read_int16(data + o);
-      o += 2;
-   }
+   destination = pgprtdbg_cursor_string(c);
+   source = pgprtdbg_cursor_string(c);
 
-   values = pgprtdbg_read_int16(data + o);
-   o += 2;
+   codes = pgprtdbg_cursor_int16(c);
+   pgprtdbg_cursor_skip(c, codes * 2);
 
-   for (int16_t i = 0; i < values; i++)
+   values = pgprtdbg_cursor_int16(c);
+   for (int16_t i = 0; i < values && !c->error; i++)
    {
-      int32_t size;
-
-      size = pgprtdbg_read_int32(data + o);
-      o += 4;
+      size = pgprtdbg_cursor_int32(c);
 
       if (size != -1)
       {
-         for (int32_t j = 0; j < size; j++)
-         {
-            pgprtdbg_read_byte(data + o);
-            o += 1;
-         }
+         pgprtdbg_cursor_skip(c, size);
       }
    }
 
-   results = pgprtdbg_read_int16(data + o);
-   o += 2;
-
-   for (int16_t i = 0; i < results; i++)
-   {
-      pgprtdbg_read_int16(data + o);
-      o += 2;
-   }
+   results = pgprtdbg_cursor_int16(c);
+   pgprtdbg_cursor_skip(c, results * 2);
 
    pgprtdbg_log_line("FE: B");
    pgprtdbg_log_line("    Destination: %s", destination);
@@ -557,349 +667,70 @@ fe_B(char** text)
    pgprtdbg_log_line("    Results: %d", results);
 }
 
-/* fe_C */
-static void
-fe_C(char** text)
-{
-   int o = 0;
-   char type;
-   char* portal;
-
-   o += 1;
-   /* length */
-   o += 4;
-
-   type = pgprtdbg_read_byte(data + o);
-   o += 1;
-
-   portal = pgprtdbg_read_string(data + o);
-   o += strlen(portal) + 1;
-
-   pgprtdbg_log_line("FE: C");
-   pgprtdbg_log_line("    Type: %c", type);
-   pgprtdbg_log_line("    Portal: %s", portal);
-}
-
-/* fe_D */
-static void
-fe_D(char** text)
-{
-   int o = 0;
-   char type;
-   char* name;
-
-   o += 1;
-   /* length */
-   o += 4;
-
-   type = pgprtdbg_read_byte(data + o);
-   o += 1;
-
-   name = pgprtdbg_read_string(data + o);
-   o += strlen(name) + 1;
-
-   pgprtdbg_log_line("FE: D");
-   pgprtdbg_log_line("    Type: %c", type);
-   pgprtdbg_log_line("    Name: %s", name);
-}
-
-/* fe_E */
-static void
-fe_E(char** text)
-{
-   int o = 0;
-   char* portal;
-   int32_t rows;
-
-   o += 1;
-   /* length */
-   o += 4;
-
-   portal = pgprtdbg_read_string(data + o);
-   o += strlen(portal) + 1;
-
-   rows = pgprtdbg_read_int32(data + o);
-   o += 4;
-
-   pgprtdbg_log_line("FE: E");
-   pgprtdbg_log_line("    Portal: %s", portal);
-   pgprtdbg_log_line("    MaxRows: %d", rows);
-}
-
-/* fe_F */
-static void
-fe_F(char** text)
-{
-}
-
-/* fe_H */
-static void
-fe_H(char** text)
-{
-   int o = 0;
-
-   o += 1;
-   /* length */
-   o += 4;
-
-   pgprtdbg_log_line("FE: H");
-}
-
 /* fe_P */
 static void
-fe_P(char** text)
+fe_P(struct stream* s, struct decoder* decoder, struct cursor* c, char** text)
 {
-   int o = 0;
    char* destination;
    char* query;
    int16_t parameters;
 
-   o += 1;
-   /* length */
-   o += 4;
-
-   destination = pgprtdbg_read_string(data + o);
-   o += strlen(destination) + 1;
-
-   query = pgprtdbg_read_string(data + o);
-   o += strlen(query) + 1;
-
-   parameters = pgprtdbg_read_int16(data + o);
-   o += 2;
+   destination = pgprtdbg_cursor_string(c);
+   query = pgprtdbg_cursor_string(c);
+   parameters = pgprtdbg_cursor_int16(c);
 
    pgprtdbg_log_line("FE: P");
    pgprtdbg_log_line("    Destination: %s", destination);
    pgprtdbg_log_line("    Query: %s", query);
    pgprtdbg_log_line("    Parameters: %d", parameters);
 
-   for (int16_t i = 0; i < parameters; i++)
+   for (int16_t i = 0; i < parameters && !c->error; i++)
    {
-      int32_t oid;
-
-      oid = pgprtdbg_read_int32(data + o);
-      o += 4;
-
-      pgprtdbg_log_line("    OID: %d", oid);
+      pgprtdbg_log_line("    OID: %d", pgprtdbg_cursor_int32(c));
    }
 }
 
-/* fe_Q */
-static void
-fe_Q(char** text)
-{
-   int o = 0;
-   char* query;
-
-   o += 1;
-   /* length */
-   o += 4;
-
-   query = pgprtdbg_read_string(data + o);
-   o += strlen(query) + 1;
-
-   pgprtdbg_log_line("FE: Q");
-   pgprtdbg_log_line("    Query: %s", query);
-}
-
-/* fe_S */
-static void
-fe_S(char** text)
-{
-   int o = 0;
-
-   o += 1;
-   /* length */
-   o += 4;
-
-   pgprtdbg_log_line("FE: S");
-}
-
-/* fe_X */
-static void
-fe_X(char** text)
-{
-   int o = 0;
-
-   o += 1;
-   /* length */
-   o += 4;
-
-   pgprtdbg_log_line("FE: X");
-}
-
-/* fe_c */
-static void
-fe_c(char** text)
-{
-   int o = 0;
-
-   o += 1;
-   /* length */
-   o += 4;
-
-   pgprtdbg_log_line("FE: c");
-}
-
 /* fe_d */
 static void
-fe_d(char** text)
+fe_d(struct stream* s, struct decoder* decoder, struct cursor* c, char** text)
 {
-   int o = 0;
-
-   o += 1;
-   /* length */
-   o += 4;
-
-   for (int32_t j = 0; j < length - 4; j++)
-   {
-      pgprtdbg_read_byte(data + o);
-      o += 1;
-   }
-
+   /* The COPY data is never looked at */
    pgprtdbg_log_line("FE: d");
-   pgprtdbg_log_line("    Size: %d", length - 4);
-}
-
-/* fe_f */
-static void
-fe_f(char** text)
-{
-   int o = 0;
-   char* failure;
-
-   o += 1;
-   /* length */
-   o += 4;
-
-   failure = pgprtdbg_read_string(data + o);
-   o += strlen(failure) + 1;
-
-   pgprtdbg_log_line("FE: f");
-   pgprtdbg_log_line("    Failure: %s", failure);
+   pgprtdbg_log_line("    Size: %d", s->length - 4);
 }
 
 /* fe_p */
 static void
-fe_p(char** text)
+fe_p(struct stream* s, struct decoder* decoder, struct cursor* c, char** text)
 {
-   int o = 0;
-
-   o += 1;
-   /* length */
-   o += 4;
+   size_t size = pgprtdbg_cursor_remaining(c);
 
    pgprtdbg_log_line("FE: p");
-   pgprtdbg_log_mem(data + o, length - 4);
-}
-
-/* be_one */
-static void
-be_one(char** text)
-{
-   int o = 0;
-
-   o += 1;
-   /* length */
-   o += 4;
-
-   pgprtdbg_log_line("BE: 1");
-}
-
-/* be_two */
-static void
-be_two(char** text)
-{
-   int o = 0;
-
-   o += 1;
-   /* length */
-   o += 4;
-
-   pgprtdbg_log_line("BE: 2");
-}
-
-/* be_three */
-static void
-be_three(char** text)
-{
-   int o = 0;
-
-   o += 1;
-   /* length */
-   o += 4;
-
-   pgprtdbg_log_line("BE: 3");
-}
-
-/* be_A */
-static void
-be_A(char** text)
-{
-   int o = 0;
-
-   o += 1;
-   /* length */
-   o += 4;
-
-   pgprtdbg_log_line("BE: A");
-}
-
-/* be_C */
-static void
-be_C(char** text)
-{
-   int o = 0;
-   char* str = NULL;
-
-   o += 1;
-   /* length */
-   o += 4;
-
-   str = pgprtdbg_read_string(data + o);
-   o += strlen(str) + 1;
-
-   pgprtdbg_log_line("BE: C");
-   pgprtdbg_log_line("    Tag: %s", str);
+   pgprtdbg_log_mem(pgprtdbg_cursor_view(c, size), size);
 }
 
 /* be_D */
 static void
-be_D(char** text)
+be_D(struct stream* s, struct decoder* decoder, struct cursor* c, char** text)
 {
-   int o = 0;
    int16_t number_of_columns;
    int32_t column_length;
 
-   o += 1;
-   /* length */
-   o += 4;
-
-   number_of_columns = pgprtdbg_read_int16(data + o);
-   o += 2;
+   number_of_columns = pgprtdbg_cursor_int16(c);
 
    pgprtdbg_log_line("BE: D");
    pgprtdbg_log_line("    Columns: %d", number_of_columns);
-   for (int16_t i = 1; i <= number_of_columns; i++)
+   for (int16_t i = 1; i <= number_of_columns && !c->error; i++)
    {
-      column_length = pgprtdbg_read_int32(data + o);
-      o += 4;
+      column_length = pgprtdbg_cursor_int32(c);
 
       pgprtdbg_log_line("    Column: %d", i);
       pgprtdbg_log_line("    Length: %d", column_length);
 
       if (column_length != -1)
       {
-         char buf[column_length];
-
          pgprtdbg_log_line("    Data: XXXX");
-
-         memset(&buf, 0, column_length);
-
-         for (int32_t j = 0; j < column_length; j++)
-         {
-            buf[j] = pgprtdbg_read_byte(data + o);
-            o += 1;
-         }
+         pgprtdbg_cursor_skip(c, column_length);
       }
       else
       {
@@ -910,118 +741,50 @@ be_D(char** text)
 
 /* be_E */
 static void
-be_E(char** text)
+be_E(struct stream* s, struct decoder* decoder, struct cursor* c, char** text)
 {
-   int o = 0;
    signed char type;
    char* str;
 
-   o += 1;
-   /* length */
-   o += 4;
-
    pgprtdbg_log_line("BE: E");
 
-   while (o < length - 4)
+   while (pgprtdbg_cursor_remaining(c) > 1)
    {
-      type = pgprtdbg_read_byte(data + o);
-      str = pgprtdbg_read_string(data + o + 1);
+      type = pgprtdbg_cursor_byte(c);
+      str = pgprtdbg_cursor_string(c);
 
       pgprtdbg_log_line("    Code: %c", type);
       pgprtdbg_log_line("    Value: %s", str);
-
-      o += (strlen(str) + 2);
    }
 }
 
-/* be_G */
-static void
-be_G(char** text)
-{
-   int o = 0;
-
-   o += 1;
-   /* length */
-   o += 4;
-
-   pgprtdbg_log_line("BE: G");
-}
-
-/* be_H */
-static void
-be_H(char** text)
-{
-   int o = 0;
-
-   o += 1;
-   /* length */
-   o += 4;
-
-   pgprtdbg_log_line("BE: H");
-}
-
-/* be_I */
-static void
-be_I(char** text)
-{
-   int o = 0;
-
-   o += 1;
-   /* length */
-   o += 4;
-
-   pgprtdbg_log_line("BE: I");
-}
-
 /* be_K */
 static void
-be_K(char** text)
+be_K(struct stream* s, struct decoder* decoder, struct cursor* c, char** text)
 {
-   int o = 0;
    int32_t process;
    int32_t secret;
 
-   o += 1;
-   /* length */
-   o += 4;
-
-   process = pgprtdbg_read_int32(data + o);
-   o += 4;
-
-   secret = pgprtdbg_read_int32(data + o);
-   o += 4;
+   process = pgprtdbg_cursor_int32(c);
+   secret = pgprtdbg_cursor_int32(c);
 
    pgprtdbg_log_line("BE: K");
    pgprtdbg_log_line("    Process: %d", process);
    pgprtdbg_log_line("    Secret: %d", secret);
-}
-
-/* be_N */
-static void
-be_N(char** text)
-{
-   int o = 0;
-
-   o += 1;
-   /* length */
-   o += 4;
 
-   pgprtdbg_log_line("BE: N");
+   if (decoder->key == -1 && !c->error)
+   {
+      pgprtdbg_server_key_add(decoder->server, process, secret, &decoder->key);
+   }
 }
 
 /* be_R */
 static void
-be_R(char** text)
+be_R(struct stream* s, struct decoder* decoder, struct cursor* c, char** text)
 {
-   int o = 0;
    int32_t type;
 
-   o += 1;
-   /* length */
-   o += 4;
-
-   type = pgprtdbg_read_int32(data + o);
-   o += 4;
+   type = pgprtdbg_cursor_int32(c);
 
    pgprtdbg_log_line("BE: R");
 
@@ -1037,7 +800,7 @@ be_R(char** text)
          pgprtdbg_log_line("    CleartextPassword");
          break;
       case 5:
-         o += 4;
+         pgprtdbg_cursor_skip(c, 4);
          break;
       case 6:
          pgprtdbg_log_line("    SCMCredential");
@@ -1053,55 +816,29 @@ be_R(char** text)
          break;
       case 10:
          pgprtdbg_log_line("    SASL");
-         while (o < length - 8)
+         while (pgprtdbg_cursor_remaining(c) > 1)
          {
-            char* mechanism = pgprtdbg_read_string(data + o);
-            pgprtdbg_log_line("    %s", mechanism);
-            o += strlen(mechanism) + 1;
+            pgprtdbg_log_line("    %s", pgprtdbg_cursor_string(c));
          }
-         o += 1;
+         pgprtdbg_cursor_skip(c, 1);
          break;
       case 11:
          pgprtdbg_log_line("    SASLContinue");
-         o += length - 8;
+         pgprtdbg_cursor_skip(c, pgprtdbg_cursor_remaining(c));
          break;
       case 12:
          pgprtdbg_log_line("    SASLFinal");
-         o += length - 8;
+         pgprtdbg_cursor_skip(c, pgprtdbg_cursor_remaining(c));
          break;
       default:
          break;
    }
 }
 
-/* be_S */
-static void
-be_S(char** text)
-{
-   int o = 0;
-   char* name = NULL;
-   char* value = NULL;
-
-   o += 1;
-   /* length */
-   o += 4;
-
-   name = pgprtdbg_read_string(data + o);
-   o += strlen(name) + 1;
-
-   value = pgprtdbg_read_string(data + o);
-   o += strlen(value) + 1;
-
-   pgprtdbg_log_line("BE: S");
-   pgprtdbg_log_line("    Name: %s", name);
-   pgprtdbg_log_line("    Value: %s", value);
-}
-
 /* be_T */
 static void
-be_T(char** text)
+be_T(struct stream* s, struct decoder* decoder, struct cursor* c, char** text)
 {
-   int o = 0;
    int16_t number_of_fields;
    char* field_name = NULL;
    int32_t oid;
@@ -1111,37 +848,19 @@ be_T(char** text)
    int32_t type_modifier;
    int16_t format;
 
-   o += 1;
-   /* length */
-   o += 4;
-
-   number_of_fields = pgprtdbg_read_int16(data + o);
-   o += 2;
+   number_of_fields = pgprtdbg_cursor_int16(c);
 
    pgprtdbg_log_line("BE: T");
    pgprtdbg_log_line("    Number: %d", number_of_fields);
-   for (int16_t i = 0; i < number_of_fields; i++)
+   for (int16_t i = 0; i < number_of_fields && !c->error; i++)
    {
-      field_name = pgprtdbg_read_string(data + o);
-      o += strlen(field_name) + 1;
-
-      oid = pgprtdbg_read_int32(data + o);
-      o += 4;
-
-      attr = pgprtdbg_read_int16(data + o);
-      o += 2;
-
-      type_oid = pgprtdbg_read_int32(data + o);
-      o += 4;
-
-      type_length = pgprtdbg_read_int16(data + o);
-      o += 2;
-
-      type_modifier = pgprtdbg_read_int32(data + o);
-      o += 4;
-
-      format = pgprtdbg_read_int16(data + o);
-      o += 2;
+      field_name = pgprtdbg_cursor_string(c);
+      oid = pgprtdbg_cursor_int32(c);
+      attr = pgprtdbg_cursor_int16(c);
+      type_oid = pgprtdbg_cursor_int32(c);
+      type_length = pgprtdbg_cursor_int16(c);
+      type_modifier = pgprtdbg_cursor_int32(c);
+      format = pgprtdbg_cursor_int16(c);
 
       pgprtdbg_log_line("    Name: %s", field_name);
       pgprtdbg_log_line("    OID: %d", oid);
@@ -1153,133 +872,11 @@ be_T(char** text)
    }
 }
 
-/* be_V */
-static void
-be_V(char** text)
-{
-   int o = 0;
-
-   o += 1;
-   /* length */
-   o += 4;
-
-   pgprtdbg_log_line("BE: V");
-}
-
-/* be_W */
-static void
-be_W(char** text)
-{
-   int o = 0;
-
-   o += 1;
-   /* length */
-   o += 4;
-
-   pgprtdbg_log_line("BE: W");
-}
-
-/* be_Z */
-static void
-be_Z(char** text)
-{
-   int o = 0;
-   char buf[2];
-
-   o += 1;
-   /* length */
-   o += 4;
-
-   memset(&buf, 0, 2);
-
-   buf[0] = pgprtdbg_read_byte(data + o);
-   o += 1;
-
-   pgprtdbg_log_line("BE: Z");
-   pgprtdbg_log_line("    State: %s", buf);
-}
-
-/* be_c */
-static void
-be_c(char** text)
-{
-   int o = 0;
-
-   o += 1;
-   /* length */
-   o += 4;
-
-   pgprtdbg_log_line("BE: c");
-}
-
 /* be_d */
 static void
-be_d(char** text)
+be_d(struct stream* s, struct decoder* decoder, struct cursor* c, char** text)
 {
-   int o = 0;
-
-   o += 1;
-   /* length */
-   o += 4;
-
-   for (int32_t j = 0; j < length - 4; j++)
-   {
-      pgprtdbg_read_byte(data + o);
-      o += 1;
-   }
-
+   /* The COPY data is never looked at */
    pgprtdbg_log_line("BE: d");
-   pgprtdbg_log_line("    Size: %d", length - 4);
-}
-
-/* be_n */
-static void
-be_n(char** text)
-{
-   int o = 0;
-
-   o += 1;
-   /* length */
-   o += 4;
-
-   pgprtdbg_log_line("BE: n");
-}
-
-/* be_s */
-static void
-be_s(char** text)
-{
-   int o = 0;
-
-   o += 1;
-   /* length */
-   o += 4;
-
-   pgprtdbg_log_line("BE: s");
-}
-
-/* be_t */
-static void
-be_t(char** text)
-{
-   int o = 0;
-
-   o += 1;
-   /* length */
-   o += 4;
-
-   pgprtdbg_log_line("BE: t");
-}
-
-/* be_v */
-static void
-be_v(char** text)
-{
-   int o = 0;
-
-   o += 1;
-   /* length */
-   o += 4;
-
-   pgprtdbg_log_line("BE: v");
+   pgprtdbg_log_line("    Size: %d", s->length - 4);
 }
@@ -0,0 +1,194 @@
+/*
+ * Copyright (C) 2024 The pgprtdbg community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgprtdbg */
+#include <pgprtdbg.h>
+#include <ring.h>
+
+/* system */
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define RING_ALIGN(x) (((x) + 7) & ~((size_t)7))
+#define RING_WRAP     SIZE_MAX
+
+int
+pgprtdbg_ring_create(size_t size, struct ring** ring)
+{
+   size_t s = 64;
+   struct ring* r = NULL;
+
+   *ring = NULL;
+
+   while (s < size)
+   {
+      s <<= 1;
+   }
+
+   r = (struct ring*)aligned_alloc(64, sizeof(struct ring));
+   if (r == NULL)
+   {
+      return 1;
+   }
+
+   memset(r, 0, sizeof(struct ring));
+
+   r->data = (char*)aligned_alloc(64, s);
+   if (r->data == NULL)
+   {
+      free(r);
+      return 1;
+   }
+
+   atomic_init(&r->head, 0);
+   atomic_init(&r->tail, 0);
+   r->size = s;
+
+   *ring = r;
+
+   return 0;
+}
+
+void
+pgprtdbg_ring_init(struct ring* ring, void* data, size_t size)
+{
+   atomic_init(&ring->head, 0);
+   atomic_init(&ring->tail, 0);
+   ring->size = size;
+   ring->data = (char*)data;
+}
+
+bool
+pgprtdbg_ring_empty(struct ring* ring)
+{
+   return atomic_load_explicit(&ring->head, memory_order_acquire) == atomic_load_explicit(&ring->tail, memory_order_acquire);
+}
+
+void
+pgprtdbg_ring_destroy(struct ring* ring)
+{
+   if (ring != NULL)
+   {
+      free(ring->data);
+      free(ring);
+   }
+}
+
+int
+pgprtdbg_ring_push(struct ring* ring, void* first, size_t first_length, void* second, size_t second_length)
+{
+   size_t head;
+   size_t tail;
+   size_t offset;
+   size_t length;
+   size_t needed;
+
+   length = first_length + second_length;
+   needed = sizeof(size_t) + RING_ALIGN(length);
+
+   tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+   head = atomic_load_explicit(&ring->head, memory_order_acquire);
+   offset = tail & (ring->size - 1);
+
+   if (offset + needed > ring->size)
+   {
+      /* The record doesn't fit before the end, so skip the rest of the ring */
+      if (ring->size - (tail - head) < (ring->size - offset) + needed)
+      {
+         return 1;
+      }
+
+      *(size_t*)(ring->data + offset) = RING_WRAP;
+      tail += ring->size - offset;
+      offset = 0;
+   }
+   else if (ring->size - (tail - head) < needed)
+   {
+      return 1;
+   }
+
+   *(size_t*)(ring->data + offset) = length;
+   memcpy(ring->data + offset + sizeof(size_t), first, first_length);
+   if (second != NULL)
+   {
+      memcpy(ring->data + offset + sizeof(size_t) + first_length, second, second_length);
+   }
+
+   atomic_store_explicit(&ring->tail, tail + needed, memory_order_release);
+
+   return 0;
+}
+
+void*
+pgprtdbg_ring_front(struct ring* ring, size_t* length)
+{
+   size_t head;
+   size_t tail;
+   size_t offset;
+   size_t l;
+
+   head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+   tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+   if (head == tail)
+   {
+      return NULL;
+   }
+
+   offset = head & (ring->size - 1);
+   l = *(size_t*)(ring->data + offset);
+
+   if (l == RING_WRAP)
+   {
+      head += ring->size - offset;
+      atomic_store_explicit(&ring->head, head, memory_order_release);
+
+      if (head == tail)
+      {
+         return NULL;
+      }
+
+      offset = 0;
+      l = *(size_t*)ring->data;
+   }
+
+   *length = l;
+
+   return ring->data + offset + sizeof(size_t);
+}
+
+void
+pgprtdbg_ring_pop(struct ring* ring, size_t length)
+{
+   size_t head;
+
+   head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+   atomic_store_explicit(&ring->head, head + sizeof(size_t) + RING_ALIGN(length), memory_order_release);
+}
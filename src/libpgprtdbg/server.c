@@ -0,0 +1,317 @@
+/*
+ * Copyright (C) 2024 The pgprtdbg community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgprtdbg */
+#include <pgprtdbg.h>
+#include <logging.h>
+#include <network.h>
+#include <server.h>
+
+/* system */
+#include <errno.h>
+#include <ev.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/** @struct
+ * A CancelRequest on its way to a server
+ */
+struct cancel_request
+{
+   struct ev_io io;                    /**< Writable once connected */
+   struct ev_timer timer;              /**< The connect timeout */
+   int fd;                             /**< The descriptor */
+   char packet[CANCEL_REQUEST_LENGTH]; /**< The CancelRequest */
+};
+
+size_t keys_offset = 0;
+
+static bool server_available(int server, unsigned int tried, bool up);
+static struct backend_key* server_keys(void);
+static void cancel_cb(struct ev_loop* loop, struct ev_io* watcher, int revents);
+static void cancel_timeout_cb(struct ev_loop* loop, struct ev_timer* watcher, int revents);
+static void cancel_done(struct ev_loop* loop, struct cancel_request* cr);
+
+int
+pgprtdbg_server_select(unsigned int tried, int* server)
+{
+   int start;
+   int index;
+   int connections;
+   int least = INT_MAX;
+   bool up = true;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   *server = -1;
+   start = (int)(atomic_fetch_add(&config->round_robin, 1) % config->number_of_servers);
+
+   /* Servers that are down only get sessions when there is nothing else */
+   for (int pass = 0; pass < 2 && *server == -1; pass++, up = false)
+   {
+      for (int i = 0; i < config->number_of_servers; i++)
+      {
+         index = (start + i) % config->number_of_servers;
+
+         if (!server_available(index, tried, up))
+         {
+            continue;
+         }
+
+         if (config->balance == BALANCE_ROUND_ROBIN)
+         {
+            *server = index;
+            break;
+         }
+
+         connections = atomic_load(&config->server[index].connections);
+         if (connections < least)
+         {
+            least = connections;
+            *server = index;
+         }
+      }
+   }
+
+   return *server == -1 ? 1 : 0;
+}
+
+void
+pgprtdbg_server_success(int server)
+{
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   if (atomic_exchange(&config->server[server].state, SERVER_UP) != SERVER_UP)
+   {
+      pgprtdbg_log_lock();
+      pgprtdbg_log_line("pgprtdbg: Server %s is up", config->server[server].name);
+      pgprtdbg_log_unlock();
+   }
+}
+
+void
+pgprtdbg_server_failure(int server)
+{
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   atomic_store(&config->server[server].retry, (long)time(NULL) + SERVER_RETRY);
+
+   if (atomic_exchange(&config->server[server].state, SERVER_DOWN) != SERVER_DOWN)
+   {
+      pgprtdbg_log_lock();
+      pgprtdbg_log_line("pgprtdbg: Server %s is down", config->server[server].name);
+      pgprtdbg_log_unlock();
+   }
+}
+
+size_t
+pgprtdbg_server_key_size(void)
+{
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   return config->max_connections * sizeof(struct backend_key);
+}
+
+void
+pgprtdbg_server_key_add(int server, int32_t process, int32_t secret, int* key)
+{
+   int free_process;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   *key = -1;
+
+   if (process == 0)
+   {
+      return;
+   }
+
+   for (int i = 0; i < config->max_connections; i++)
+   {
+      free_process = 0;
+
+      if (atomic_compare_exchange_strong(&server_keys()[i].process, &free_process, -1))
+      {
+         server_keys()[i].secret = secret;
+         server_keys()[i].server = server;
+         atomic_store(&server_keys()[i].process, process);
+
+         *key = i;
+         return;
+      }
+   }
+}
+
+void
+pgprtdbg_server_key_remove(int key)
+{
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   if (key >= 0 && key < config->max_connections)
+   {
+      atomic_store(&server_keys()[key].process, 0);
+   }
+}
+
+int
+pgprtdbg_server_key_find(int32_t process, int32_t secret, int* server)
+{
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   *server = -1;
+
+   if (process == 0 || process == -1)
+   {
+      return 1;
+   }
+
+   for (int i = 0; i < config->max_connections; i++)
+   {
+      if (atomic_load(&server_keys()[i].process) == process && server_keys()[i].secret == secret)
+      {
+         *server = server_keys()[i].server;
+         return 0;
+      }
+   }
+
+   return 1;
+}
+
+void
+pgprtdbg_server_cancel(struct ev_loop* loop, int server, char* packet)
+{
+   socklen_t length;
+   struct sockaddr_storage address;
+   struct cancel_request* cr = NULL;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   if (pgprtdbg_server_address(server, 0, &address, &length))
+   {
+      return;
+   }
+
+   cr = (struct cancel_request*)malloc(sizeof(struct cancel_request));
+   if (cr == NULL)
+   {
+      return;
+   }
+
+   memset(cr, 0, sizeof(struct cancel_request));
+   memcpy(&cr->packet[0], packet, CANCEL_REQUEST_LENGTH);
+
+   if (pgprtdbg_connect((struct sockaddr*)&address, length, &cr->fd))
+   {
+      free(cr);
+      return;
+   }
+
+   ev_io_init(&cr->io, cancel_cb, cr->fd, EV_WRITE);
+   cr->io.data = cr;
+   ev_io_start(loop, &cr->io);
+
+   ev_timer_init(&cr->timer, cancel_timeout_cb, config->connect_timeout, 0.);
+   cr->timer.data = cr;
+   ev_timer_start(loop, &cr->timer);
+}
+
+static bool
+server_available(int server, unsigned int tried, bool up)
+{
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   if (tried & (1U << server))
+   {
+      return false;
+   }
+
+   if (!up)
+   {
+      return true;
+   }
+
+   return atomic_load(&config->server[server].state) == SERVER_UP ||
+          atomic_load(&config->server[server].retry) <= (long)time(NULL);
+}
+
+static void
+cancel_cb(struct ev_loop* loop, struct ev_io* watcher, int revents)
+{
+   struct cancel_request* cr = (struct cancel_request*)watcher->data;
+
+   if (!pgprtdbg_connect_result(cr->fd))
+   {
+      /* 16 bytes always fit in an empty socket buffer */
+      if (write(cr->fd, &cr->packet[0], CANCEL_REQUEST_LENGTH) != CANCEL_REQUEST_LENGTH)
+      {
+         errno = 0;
+      }
+   }
+
+   cancel_done(loop, cr);
+}
+
+static void
+cancel_timeout_cb(struct ev_loop* loop, struct ev_timer* watcher, int revents)
+{
+   cancel_done(loop, (struct cancel_request*)watcher->data);
+}
+
+static void
+cancel_done(struct ev_loop* loop, struct cancel_request* cr)
+{
+   ev_io_stop(loop, &cr->io);
+   ev_timer_stop(loop, &cr->timer);
+   pgprtdbg_disconnect(cr->fd);
+   free(cr);
+}
+
+static struct backend_key*
+server_keys(void)
+{
+   return (struct backend_key*)((char*)shmem + keys_offset);
+}
@@ -33,6 +33,7 @@
 /* system */
 #include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/mman.h>
 
 void* shmem = NULL;
@@ -51,7 +52,25 @@ pgprtdbg_create_shared_memory(size_t size)
       return 1;
    }
 
-   memset(shmem, 0, size);
+   /* Anonymous mappings are zero filled, and pages are only backed once used */
+
+   return 0;
+}
+
+int
+pgprtdbg_resize_shared_memory(size_t size, size_t new_size)
+{
+   void* old = shmem;
+
+   if (pgprtdbg_create_shared_memory(new_size))
+   {
+      shmem = old;
+      return 1;
+   }
+
+   /* mremap() can't grow a shared anonymous mapping past its backing object, so copy */
+   memcpy(shmem, old, MIN(size, new_size));
+   munmap(old, size);
 
    return 0;
 }
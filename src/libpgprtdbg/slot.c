@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2024 The pgprtdbg community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgprtdbg */
+#include <pgprtdbg.h>
+#include <slot.h>
+
+/* system */
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* The free list head is the index + 1 of the first free slot, tagged with a
+ * version in the upper half so that a stale compare-and-swap fails (ABA) */
+#define SLOT_INDEX(head)     ((uint32_t)((head) & 0xFFFFFFFF))
+#define SLOT_TAG(head)       ((head) >> 32)
+#define SLOT_HEAD(tag, index) (((uint64_t)(tag) << 32) | (uint64_t)(index))
+
+size_t slots_offset = 0;
+
+static struct slot* slots(void);
+
+size_t
+pgprtdbg_slot_size(void)
+{
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   return config->max_connections * sizeof(struct slot);
+}
+
+void
+pgprtdbg_slot_init(void)
+{
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   for (int i = 0; i < config->max_connections; i++)
+   {
+      atomic_init(&slots()[i].pid, 0);
+      atomic_init(&slots()[i].next, i + 1 < config->max_connections ? i + 2 : 0);
+   }
+
+   atomic_init(&config->free_slots, SLOT_HEAD(0, 1));
+}
+
+int
+pgprtdbg_slot_acquire(int* slot)
+{
+   uint64_t head;
+   uint32_t index;
+   int used;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   head = atomic_load(&config->free_slots);
+
+   do
+   {
+      index = SLOT_INDEX(head);
+      if (index == 0)
+      {
+         return 1;
+      }
+   }
+   while (!atomic_compare_exchange_weak(&config->free_slots, &head,
+                                        SLOT_HEAD(SLOT_TAG(head) + 1, atomic_load(&slots()[index - 1].next))));
+
+   *slot = (int)index - 1;
+
+   /* The statistics cover the slots used so far */
+   used = atomic_load(&config->clients);
+   while (*slot + 1 > used && !atomic_compare_exchange_weak(&config->clients, &used, *slot + 1))
+   {
+   }
+
+   return 0;
+}
+
+void
+pgprtdbg_slot_release(int slot)
+{
+   uint64_t head;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   if (slot < 0 || slot >= config->max_connections)
+   {
+      return;
+   }
+
+   atomic_store(&slots()[slot].pid, 0);
+
+   head = atomic_load(&config->free_slots);
+
+   do
+   {
+      atomic_store(&slots()[slot].next, (int)SLOT_INDEX(head));
+   }
+   while (!atomic_compare_exchange_weak(&config->free_slots, &head, SLOT_HEAD(SLOT_TAG(head) + 1, slot + 1)));
+}
+
+bool
+pgprtdbg_slot_available(void)
+{
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   return SLOT_INDEX(atomic_load(&config->free_slots)) != 0;
+}
+
+void
+pgprtdbg_slot_set_pid(int slot, pid_t pid)
+{
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   if (slot >= 0 && slot < config->max_connections)
+   {
+      atomic_store(&slots()[slot].pid, pid);
+   }
+}
+
+pid_t
+pgprtdbg_slot_pid(int slot)
+{
+   return atomic_load(&slots()[slot].pid);
+}
+
+static struct slot*
+slots(void)
+{
+   return (struct slot*)((char*)shmem + slots_offset);
+}
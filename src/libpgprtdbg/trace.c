@@ -0,0 +1,559 @@
+/*
+ * Copyright (C) 2024 The pgprtdbg community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgprtdbg */
+#include <pgprtdbg.h>
+#include <compression.h>
+#include <counter.h>
+#include <logging.h>
+#include <output.h>
+#include <ring.h>
+#include <trace.h>
+
+/* system */
+#include <errno.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define TRACE_UNSET -1
+
+/* A producer waits at most TRACE_WAITS times TRACE_WAIT nanoseconds for the writer */
+#define TRACE_WAIT  100000
+#define TRACE_WAITS 1000
+
+#define TRACE_CAPTURE_CHUNK (TRACE_RING_SIZE / 4)
+
+#define WRITER_BUFFER_SIZE (1024 * 1024)
+#define WRITER_CAPTURES    64
+
+/** @struct
+ * A trace ring in the shared memory segment
+ */
+struct trace_slot
+{
+   atomic_int owner;          /**< The pid of the producer, or 0 if free */
+   struct ring ring;          /**< The trace lines */
+};
+
+/** @struct
+ * The header of a record in a trace ring
+ */
+struct trace_record
+{
+   uint16_t capture; /**< The length of the capture file name after the header, or 0 for a trace line */
+   bool last;        /**< Does the record end the capture file */
+};
+
+/** @struct
+ * A capture file open in the writer process
+ */
+struct writer_capture
+{
+   char name[MISC_LENGTH];          /**< The file name, or empty if free */
+   FILE* file;                      /**< The file */
+   struct compression* compression; /**< The compression stream of the file */
+   unsigned long used;              /**< The last write, as a sequence number */
+   bool pending;                    /**< Has the stream data that isn't flushed yet */
+};
+
+size_t trace_offset = 0;
+
+static _Thread_local int slot = TRACE_UNSET;
+static _Thread_local bool dropping = false;
+static volatile sig_atomic_t writer_running = 1;
+
+static struct writer_capture captures[WRITER_CAPTURES];
+static unsigned long captures_used = 0;
+
+static struct trace_slot* trace_slots(void);
+static char* trace_data(int index);
+static int trace_push(void* first, size_t first_length, void* second, size_t second_length);
+static int trace_acquire(void);
+static void writer_loop(void);
+static size_t writer_drain(char* buffer);
+static void writer_capture(char* name, size_t name_length, char* data, size_t length, bool last);
+static void writer_capture_close(struct writer_capture* capture);
+static void writer_capture_flush(void);
+static void writer_reclaim(void);
+static void writer_cb(int signum);
+
+size_t
+pgprtdbg_trace_size(void)
+{
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   if (!config->trace_writer)
+   {
+      return 0;
+   }
+
+   return (size_t)config->trace_rings * (sizeof(struct trace_slot) + TRACE_RING_SIZE);
+}
+
+void
+pgprtdbg_trace_init(void)
+{
+   struct trace_slot* slots = trace_slots();
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   for (int i = 0; i < config->trace_rings; i++)
+   {
+      atomic_init(&slots[i].owner, 0);
+      pgprtdbg_ring_init(&slots[i].ring, trace_data(i), TRACE_RING_SIZE);
+   }
+}
+
+pid_t
+pgprtdbg_trace_writer_start(void)
+{
+   pid_t pid;
+   sigset_t mask;
+   struct sigaction sa;
+
+   pid = fork();
+
+   if (pid == 0)
+   {
+      memset(&sa, 0, sizeof(struct sigaction));
+      sa.sa_handler = writer_cb;
+      sigemptyset(&sa.sa_mask);
+
+      sigaction(SIGTERM, &sa, NULL);
+      sigaction(SIGINT, &sa, NULL);
+      sigaction(SIGQUIT, &sa, NULL);
+      sigaction(SIGHUP, &sa, NULL);
+
+      /* A writer restarted from the main loop may inherit the signals blocked by libev */
+      sigemptyset(&mask);
+      sigaddset(&mask, SIGTERM);
+      sigaddset(&mask, SIGINT);
+      sigaddset(&mask, SIGQUIT);
+      sigaddset(&mask, SIGHUP);
+      sigprocmask(SIG_UNBLOCK, &mask, NULL);
+
+      writer_loop();
+
+      exit(0);
+   }
+
+   return pid;
+}
+
+void
+pgprtdbg_trace_writer_stop(pid_t pid)
+{
+   if (pid > 0)
+   {
+      kill(pid, SIGTERM);
+      waitpid(pid, NULL, 0);
+   }
+}
+
+int
+pgprtdbg_trace_write(char* line, size_t length)
+{
+   struct trace_record header;
+
+   memset(&header, 0, sizeof(struct trace_record));
+
+   return trace_push(&header, sizeof(struct trace_record), line, length);
+}
+
+int
+pgprtdbg_trace_capture(char* name, char* data, size_t length, bool last)
+{
+   char first[sizeof(struct trace_record) + MISC_LENGTH];
+   size_t name_length;
+   size_t offset = 0;
+   size_t chunk;
+   struct trace_record header;
+
+   name_length = strlen(name);
+   if (name_length == 0 || name_length >= MISC_LENGTH)
+   {
+      return 1;
+   }
+
+   memset(&header, 0, sizeof(struct trace_record));
+   header.capture = (uint16_t)name_length;
+   memcpy(&first[sizeof(struct trace_record)], name, name_length);
+
+   /* A record has to fit in the ring, so a large one is split */
+   do
+   {
+      chunk = MIN(length - offset, (size_t)TRACE_CAPTURE_CHUNK);
+      header.last = last && offset + chunk == length;
+      memcpy(&first[0], &header, sizeof(struct trace_record));
+
+      if (trace_push(&first[0], sizeof(struct trace_record) + name_length, chunk > 0 ? data + offset : NULL, chunk))
+      {
+         return 1;
+      }
+
+      offset += chunk;
+   }
+   while (offset < length);
+
+   return 0;
+}
+
+void
+pgprtdbg_trace_output_statistics(FILE* file)
+{
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   fprintf(file, "Trace Records Dropped:   %ld\n", atomic_load(&config->trace_dropped));
+}
+
+void
+pgprtdbg_trace_release(void)
+{
+   struct trace_slot* slots = trace_slots();
+
+   if (slot >= 0)
+   {
+      atomic_store(&slots[slot].owner, 0);
+   }
+
+   slot = TRACE_UNSET;
+}
+
+static struct trace_slot*
+trace_slots(void)
+{
+   return (struct trace_slot*)((char*)shmem + trace_offset);
+}
+
+static char*
+trace_data(int index)
+{
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   return (char*)shmem + trace_offset + (size_t)config->trace_rings * sizeof(struct trace_slot) + (size_t)index * TRACE_RING_SIZE;
+}
+
+static int
+trace_push(void* first, size_t first_length, void* second, size_t second_length)
+{
+   struct timespec wait = {0, TRACE_WAIT};
+   struct trace_slot* slots = trace_slots();
+   int waits;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   /* Once a record is dropped, the next ones don't wait until the writer catches up */
+   waits = dropping ? TRACE_WAITS : 0;
+
+   while (true)
+   {
+      if ((slot != TRACE_UNSET || !trace_acquire()) &&
+          !pgprtdbg_ring_push(&slots[slot].ring, first, first_length, second, second_length))
+      {
+         dropping = false;
+         return 0;
+      }
+
+      /* Only ever waits for the writer, never for another producer */
+      if (waits++ >= TRACE_WAITS)
+      {
+         break;
+      }
+
+      nanosleep(&wait, NULL);
+   }
+
+   /* The writer is behind or gone, so the record is lost rather than holding up the forwarding */
+   dropping = true;
+   atomic_fetch_add(&config->trace_dropped, 1);
+
+   return 1;
+}
+
+static int
+trace_acquire(void)
+{
+   int owner;
+   struct trace_slot* slots = trace_slots();
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   /* There is a ring for each producer, but a released ring is only taken again once the writer has emptied it */
+   for (int i = 0; i < config->trace_rings; i++)
+   {
+      owner = 0;
+
+      if (atomic_load(&slots[i].owner) == 0 && pgprtdbg_ring_empty(&slots[i].ring) &&
+          atomic_compare_exchange_strong(&slots[i].owner, &owner, (int)getpid()))
+      {
+         slot = i;
+         return 0;
+      }
+   }
+
+   return 1;
+}
+
+static void
+writer_loop(void)
+{
+   char* buffer = NULL;
+   int idle = 0;
+   size_t written;
+   struct timespec wait = {0, 1000000};
+
+   buffer = (char*)malloc(WRITER_BUFFER_SIZE);
+   if (buffer == NULL)
+   {
+      return;
+   }
+
+   while (true)
+   {
+      written = writer_drain(buffer);
+
+      if (written > 0)
+      {
+         idle = 0;
+         continue;
+      }
+
+      /* Once stopped, the producers get a moment to queue their last lines */
+      if (!writer_running && ++idle > 100)
+      {
+         break;
+      }
+
+      if (writer_running && ++idle % 1000 == 0)
+      {
+         writer_reclaim();
+      }
+
+      nanosleep(&wait, NULL);
+   }
+
+   for (int i = 0; i < WRITER_CAPTURES; i++)
+   {
+      writer_capture_close(&captures[i]);
+      pgprtdbg_compression_destroy(captures[i].compression);
+      captures[i].compression = NULL;
+   }
+
+   pgprtdbg_output_release();
+   pgprtdbg_output_close();
+   free(buffer);
+}
+
+static size_t
+writer_drain(char* buffer)
+{
+   size_t length;
+   size_t offset = 0;
+   size_t total = 0;
+   char* record = NULL;
+   char* line = NULL;
+   size_t line_length;
+   struct trace_record* header = NULL;
+   struct trace_slot* slots = trace_slots();
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   for (int i = 0; i < config->trace_rings; i++)
+   {
+      while ((record = (char*)pgprtdbg_ring_front(&slots[i].ring, &length)) != NULL)
+      {
+         header = (struct trace_record*)record;
+         line = record + sizeof(struct trace_record);
+         line_length = length - sizeof(struct trace_record);
+
+         if (header->capture > 0)
+         {
+            writer_capture(line, header->capture, line + header->capture, line_length - header->capture, header->last);
+         }
+         else
+         {
+            if (offset + line_length > WRITER_BUFFER_SIZE)
+            {
+               pgprtdbg_output_write_file(buffer, offset);
+               offset = 0;
+            }
+
+            memcpy(buffer + offset, line, line_length);
+            offset += line_length;
+         }
+
+         total += length;
+
+         pgprtdbg_ring_pop(&slots[i].ring, length);
+      }
+   }
+
+   if (offset > 0)
+   {
+      pgprtdbg_output_write_file(buffer, offset);
+   }
+
+   writer_capture_flush();
+
+   return total;
+}
+
+static void
+writer_capture(char* name, size_t name_length, char* data, size_t length, bool last)
+{
+   char path[MISC_LENGTH];
+   size_t written;
+   struct writer_capture* capture = NULL;
+   struct writer_capture* oldest = NULL;
+
+   memcpy(&path[0], name, name_length);
+   path[name_length] = '\0';
+
+   for (int i = 0; i < WRITER_CAPTURES && capture == NULL; i++)
+   {
+      if (!strcmp(captures[i].name, &path[0]))
+      {
+         capture = &captures[i];
+      }
+      else if (oldest == NULL || captures[i].used < oldest->used)
+      {
+         oldest = &captures[i];
+      }
+   }
+
+   if (capture == NULL)
+   {
+      /* The least recently written file makes room; when it is written again it gets a new gzip member */
+      writer_capture_close(oldest);
+
+      if (oldest->compression == NULL && pgprtdbg_compression_create(&oldest->compression))
+      {
+         return;
+      }
+
+      oldest->file = fopen(&path[0], "a");
+      if (oldest->file == NULL)
+      {
+         return;
+      }
+
+      memcpy(oldest->name, &path[0], sizeof(path));
+      capture = oldest;
+   }
+
+   capture->used = ++captures_used;
+
+   if (length > 0)
+   {
+      pgprtdbg_compression_write(capture->compression, capture->file, data, length, &written);
+      capture->pending = true;
+   }
+
+   if (last)
+   {
+      writer_capture_close(capture);
+   }
+}
+
+static void
+writer_capture_close(struct writer_capture* capture)
+{
+   size_t written;
+
+   if (capture->file != NULL)
+   {
+      pgprtdbg_compression_finish(capture->compression, capture->file, &written);
+      fclose(capture->file);
+   }
+
+   memset(capture->name, 0, sizeof(capture->name));
+   capture->file = NULL;
+   capture->used = 0;
+   capture->pending = false;
+}
+
+static void
+writer_capture_flush(void)
+{
+   size_t written;
+
+   for (int i = 0; i < WRITER_CAPTURES; i++)
+   {
+      if (captures[i].pending)
+      {
+         pgprtdbg_compression_flush(captures[i].compression, captures[i].file, &written);
+         captures[i].pending = false;
+      }
+   }
+}
+
+static void
+writer_reclaim(void)
+{
+   int owner;
+   struct trace_slot* slots = trace_slots();
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   /* A producer that died without releasing its ring */
+   for (int i = 0; i < config->trace_rings; i++)
+   {
+      owner = atomic_load(&slots[i].owner);
+
+      if (owner != 0 && pgprtdbg_ring_empty(&slots[i].ring) && kill(owner, 0) == -1 && errno == ESRCH)
+      {
+         atomic_compare_exchange_strong(&slots[i].owner, &owner, 0);
+      }
+
+      errno = 0;
+   }
+}
+
+static void
+writer_cb(int signum)
+{
+   writer_running = 0;
+}
@@ -0,0 +1,292 @@
+/*
+ * Copyright (C) 2024 The pgprtdbg community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgprtdbg */
+#include <pgprtdbg.h>
+#include <tracefile.h>
+
+/* system */
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static bool printable(signed char kind);
+
+size_t
+pgprtdbg_tracefile_record_size(size_t text_length, size_t payload_length)
+{
+   size_t size = sizeof(struct tracefile_record) + text_length + payload_length;
+
+   return (size + TRACEFILE_ALIGNMENT - 1) & ~((size_t)TRACEFILE_ALIGNMENT - 1);
+}
+
+void
+pgprtdbg_tracefile_header_init(struct tracefile_header* header)
+{
+   memset(header, 0, sizeof(struct tracefile_header));
+   memcpy(&header->magic[0], TRACEFILE_MAGIC, sizeof(header->magic));
+   header->version = TRACEFILE_VERSION;
+   header->endian = TRACEFILE_ENDIAN;
+}
+
+size_t
+pgprtdbg_tracefile_record_encode(char* buffer, char direction, int32_t session, int32_t from, int32_t to,
+                                 signed char kind, int32_t length, char* text, size_t text_length,
+                                 char* payload, size_t payload_length)
+{
+   size_t size;
+   struct timespec now;
+   struct tracefile_record* record = (struct tracefile_record*)buffer;
+
+   size = pgprtdbg_tracefile_record_size(text_length, payload_length);
+
+   clock_gettime(CLOCK_MONOTONIC, &now);
+
+   record->size = (uint32_t)size;
+   record->direction = direction;
+   record->kind = kind;
+   record->text_length = (uint16_t)text_length;
+   record->session = session;
+   record->from = from;
+   record->to = to;
+   record->length = length;
+   record->timestamp = (uint64_t)now.tv_sec * 1000000000 + (uint64_t)now.tv_nsec;
+   record->payload_length = (uint32_t)payload_length;
+   record->reserved = 0;
+
+   if (text_length > 0)
+   {
+      memcpy(buffer + sizeof(struct tracefile_record), text, text_length);
+   }
+
+   if (payload_length > 0)
+   {
+      memcpy(buffer + sizeof(struct tracefile_record) + text_length, payload, payload_length);
+   }
+
+   /* The padding is written too, so a file never holds stale memory */
+   memset(buffer + sizeof(struct tracefile_record) + text_length + payload_length, 0,
+          size - sizeof(struct tracefile_record) - text_length - payload_length);
+
+   return size;
+}
+
+size_t
+pgprtdbg_tracefile_csv(char* line, size_t size, char direction, int32_t from, int32_t to, signed char kind,
+                       char* text, size_t text_length, bool sockets)
+{
+   int t = (int)text_length;
+
+   line[0] = '\0';
+
+   if (printable(kind))
+   {
+      if (text != NULL)
+      {
+         if (sockets)
+         {
+            snprintf(line, size, "%c,%d,%d,%c,%.*s\n", direction, from, to, kind, t, text);
+         }
+         else
+         {
+            snprintf(line, size, "%c,%c,%.*s\n", direction, kind, t, text);
+         }
+      }
+      else
+      {
+         if (sockets)
+         {
+            snprintf(line, size, "%c,%d,%d,%c\n", direction, from, to, kind);
+         }
+         else
+         {
+            snprintf(line, size, "%c,%c\n", direction, kind);
+         }
+      }
+   }
+   else
+   {
+      if (text != NULL)
+      {
+         if (sockets)
+         {
+            snprintf(line, size, "%c,%d,%d,%d,%.*s\n", direction, from, to, kind, t, text);
+         }
+         else
+         {
+            snprintf(line, size, "%c,%d,%.*s\n", direction, kind, t, text);
+         }
+      }
+      else
+      {
+         if (sockets)
+         {
+            snprintf(line, size, "%c,%d,%d,%d\n", direction, from, to, kind);
+         }
+         else
+         {
+            snprintf(line, size, "%c,%d\n", direction, kind);
+         }
+      }
+   }
+
+   return strlen(line);
+}
+
+int
+pgprtdbg_tracefile_open(char* path, struct tracefile_reader** reader)
+{
+   struct stat st;
+   struct tracefile_header* header = NULL;
+   struct tracefile_reader* r = NULL;
+
+   *reader = NULL;
+
+   r = (struct tracefile_reader*)malloc(sizeof(struct tracefile_reader));
+   if (r == NULL)
+   {
+      return 1;
+   }
+
+   memset(r, 0, sizeof(struct tracefile_reader));
+   r->fd = -1;
+   r->data = MAP_FAILED;
+
+   r->fd = open(path, O_RDONLY);
+   if (r->fd == -1)
+   {
+      goto error;
+   }
+
+   if (fstat(r->fd, &st) == -1 || (size_t)st.st_size < sizeof(struct tracefile_header))
+   {
+      goto error;
+   }
+
+   r->size = (size_t)st.st_size;
+   r->data = mmap(NULL, r->size, PROT_READ, MAP_PRIVATE, r->fd, 0);
+   if (r->data == MAP_FAILED)
+   {
+      goto error;
+   }
+
+   madvise(r->data, r->size, MADV_SEQUENTIAL);
+
+   header = (struct tracefile_header*)r->data;
+
+   if (memcmp(&header->magic[0], TRACEFILE_MAGIC, sizeof(header->magic)) ||
+       header->version == 0 || header->version > TRACEFILE_VERSION ||
+       header->endian != TRACEFILE_ENDIAN)
+   {
+      goto error;
+   }
+
+   r->offset = sizeof(struct tracefile_header);
+
+   *reader = r;
+
+   return 0;
+
+error:
+
+   pgprtdbg_tracefile_close(r);
+
+   return 1;
+}
+
+int
+pgprtdbg_tracefile_next(struct tracefile_reader* reader, struct tracefile_record** record)
+{
+   struct tracefile_record* r = NULL;
+
+   *record = NULL;
+
+   if (reader->size - reader->offset < sizeof(struct tracefile_record))
+   {
+      return 1;
+   }
+
+   r = (struct tracefile_record*)(reader->data + reader->offset);
+
+   if (r->size < pgprtdbg_tracefile_record_size(r->text_length, r->payload_length) ||
+       r->size % TRACEFILE_ALIGNMENT != 0 || r->size > reader->size - reader->offset)
+   {
+      return 1;
+   }
+
+   reader->offset += r->size;
+   *record = r;
+
+   return 0;
+}
+
+char*
+pgprtdbg_tracefile_text(struct tracefile_record* record)
+{
+   return (char*)record + sizeof(struct tracefile_record);
+}
+
+char*
+pgprtdbg_tracefile_payload(struct tracefile_record* record)
+{
+   return (char*)record + sizeof(struct tracefile_record) + record->text_length;
+}
+
+void
+pgprtdbg_tracefile_close(struct tracefile_reader* reader)
+{
+   if (reader == NULL)
+   {
+      return;
+   }
+
+   if (reader->data != MAP_FAILED)
+   {
+      munmap(reader->data, reader->size);
+   }
+
+   if (reader->fd != -1)
+   {
+      close(reader->fd);
+   }
+
+   free(reader);
+}
+
+static bool
+printable(signed char kind)
+{
+   return (kind >= 'A' && kind <= 'Z') || (kind >= 'a' && kind <= 'z') || (kind >= '0' && kind <= '9') || kind == '?';
+}
@@ -0,0 +1,1036 @@
+/*
+ * Copyright (C) 2024 The pgprtdbg community
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice, this list
+ * of conditions and the following disclaimer.
+ *
+ * 2. Redistributions in binary form must reproduce the above copyright notice, this
+ * list of conditions and the following disclaimer in the documentation and/or other
+ * materials provided with the distribution.
+ *
+ * 3. Neither the name of the copyright holder nor the names of its contributors may
+ * be used to endorse or promote products derived from this software without specific
+ * prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY
+ * EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL
+ * THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT
+ * OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR
+ * TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* pgprtdbg */
+#include <pgprtdbg.h>
+#include <counter.h>
+#include <decoder.h>
+#include <logging.h>
+#include <protocol.h>
+#include <uring.h>
+#include <utils.h>
+#include <worker.h>
+
+/* system */
+#include <errno.h>
+#include <ev.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#if defined(HAVE_IO_URING)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#endif
+
+#if defined(HAVE_IO_URING)
+
+#define URING_ENTRIES 256
+#define URING_BUFFERS 8
+
+#define URING_OP_RECV   1
+#define URING_OP_SEND   2
+#define URING_OP_CANCEL 3
+#define URING_OP_MASK   3
+
+struct uring_session;
+
+/** @struct
+ * One direction of a session. The received buffers are sent in order, as one
+ * chain of linked sends, and given back to the kernel once sent
+ */
+struct uring_direction
+{
+   struct uring_session* owner;      /**< The session */
+   bool client;                      /**< Is this the client to server direction */
+   int from;                         /**< The source descriptor */
+   int to;                           /**< The destination descriptor */
+   unsigned short bgid;              /**< The buffer group */
+   struct io_uring_buf_ring* ring;   /**< The provided buffer ring */
+   size_t ring_size;                 /**< The size of the buffer ring mapping */
+   unsigned short ring_tail;         /**< The tail of the buffer ring */
+   char* buffers;                    /**< The buffers */
+   int bids[URING_BUFFERS];          /**< The received buffers, the first ones are being sent */
+   int lengths[URING_BUFFERS];       /**< The lengths of the received buffers */
+   int head;                         /**< The first received buffer */
+   int length;                       /**< The number of received buffers */
+   int sending;                      /**< The number of buffers being sent */
+   bool armed;                       /**< Is the multishot receive active */
+   bool draining;                    /**< Finish the session once the received buffers are sent */
+   int exit_code;                    /**< The exit code when draining */
+   bool dirty;                       /**< Is the direction on the dirty list */
+   struct uring_direction* next;     /**< The next direction on the dirty list */
+};
+
+/** @struct
+ * The io_uring state of a session
+ */
+struct uring_session
+{
+   struct uring_direction directions[2]; /**< Client to server, and server to client */
+   struct worker_session* session;       /**< The session */
+   int operations;                       /**< The number of operations in flight */
+   bool closing;                         /**< Is the session finished */
+   struct uring_session* next;           /**< The next closing session */
+};
+
+/** @struct
+ * An io_uring instance
+ */
+struct uring
+{
+   struct ev_io io;                  /**< The watcher of the ring descriptor */
+   struct ev_loop* loop;             /**< The event loop */
+   int fd;                           /**< The ring descriptor */
+   void* sq_ring;                    /**< The submission queue mapping */
+   size_t sq_ring_size;              /**< The size of the submission queue mapping */
+   void* cq_ring;                    /**< The completion queue mapping */
+   size_t cq_ring_size;              /**< The size of the completion queue mapping */
+   struct io_uring_sqe* sqes;        /**< The submission queue entries */
+   size_t sqes_size;                 /**< The size of the submission queue entries */
+   unsigned* sq_head;                /**< The submission queue head */
+   unsigned* sq_tail;                /**< The submission queue tail */
+   unsigned* sq_array;               /**< The submission queue index array */
+   unsigned sq_mask;                 /**< The submission queue mask */
+   unsigned sq_entries;              /**< The number of submission queue entries */
+   unsigned sq_local_tail;           /**< The tail including the entries not yet published */
+   unsigned* cq_head;                /**< The completion queue head */
+   unsigned* cq_tail;                /**< The completion queue tail */
+   unsigned cq_mask;                 /**< The completion queue mask */
+   struct io_uring_cqe* cqes;        /**< The completion queue entries */
+   unsigned pending;                 /**< The number of entries not yet submitted */
+   unsigned short next_bgid;         /**< The next unused buffer group */
+   unsigned short* free_bgids;       /**< The released buffer groups */
+   int free_bgids_length;            /**< The number of released buffer groups */
+   struct uring_direction* dirty;    /**< The directions with work after the completions */
+   struct uring_session* closing;    /**< The finished sessions with operations in flight */
+};
+
+static int uring_setup(struct uring* uring);
+static struct io_uring_sqe* uring_sqe(struct uring* uring);
+static bool uring_sqe_reserve(struct uring* uring, unsigned count);
+static void uring_submit(struct uring* uring);
+static void uring_reap(struct uring* uring);
+static void uring_flush(struct uring* uring);
+static void uring_cb(struct ev_loop* loop, struct ev_io* watcher, int revents);
+static int direction_init(struct uring* uring, struct uring_session* us, struct uring_direction* dir, int from, int to, bool client);
+static void direction_destroy(struct uring* uring, struct uring_direction* dir, bool registered);
+static void direction_dirty(struct uring* uring, struct uring_direction* dir);
+static int direction_recv(struct uring* uring, struct uring_direction* dir);
+static int direction_send(struct uring* uring, struct uring_direction* dir);
+static void direction_cancel(struct uring* uring, struct uring_direction* dir, int op);
+static void direction_buffer(struct uring_direction* dir, int bid);
+static void direction_received(struct uring* uring, struct uring_direction* dir, struct io_uring_cqe* cqe);
+static void direction_sent(struct uring* uring, struct uring_direction* dir, struct io_uring_cqe* cqe);
+static void direction_failed(struct uring* uring, struct uring_direction* dir, bool source, int error);
+static void session_destroy(struct uring* uring, struct uring_session* us, bool registered);
+
+int
+pgprtdbg_uring_init(struct ev_loop* loop, struct uring** uring)
+{
+   struct uring* u = NULL;
+   struct io_uring_buf_reg reg;
+   void* probe = MAP_FAILED;
+
+   *uring = NULL;
+
+   u = (struct uring*)malloc(sizeof(struct uring));
+   if (u == NULL)
+   {
+      return 1;
+   }
+
+   memset(u, 0, sizeof(struct uring));
+   u->fd = -1;
+
+   if (uring_setup(u))
+   {
+      goto error;
+   }
+
+   /* Provided buffer rings are needed for the multishot receives */
+   probe = mmap(NULL, sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+   if (probe == MAP_FAILED)
+   {
+      goto error;
+   }
+
+   memset(&reg, 0, sizeof(struct io_uring_buf_reg));
+   reg.ring_addr = (unsigned long)probe;
+   reg.ring_entries = 1;
+   reg.bgid = 0;
+
+   if (syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+   {
+      goto error;
+   }
+
+   syscall(__NR_io_uring_register, u->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+   munmap(probe, sizeof(struct io_uring_buf));
+
+   u->loop = loop;
+   ev_io_init(&u->io, uring_cb, u->fd, EV_READ);
+   u->io.data = u;
+   ev_io_start(loop, &u->io);
+
+   *uring = u;
+
+   return 0;
+
+error:
+
+   if (probe != MAP_FAILED)
+   {
+      munmap(probe, sizeof(struct io_uring_buf));
+   }
+
+   pgprtdbg_uring_destroy(NULL, u);
+   errno = 0;
+
+   return 1;
+}
+
+void
+pgprtdbg_uring_destroy(struct ev_loop* loop, struct uring* uring)
+{
+   struct uring_session* us = NULL;
+
+   if (uring == NULL)
+   {
+      return;
+   }
+
+   if (loop != NULL)
+   {
+      ev_io_stop(loop, &uring->io);
+   }
+
+   /* The canceled operations complete quickly, but don't wait forever */
+   for (int i = 0; uring->closing != NULL && i < 100; i++)
+   {
+      uring_submit(uring);
+      syscall(__NR_io_uring_enter, uring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+      uring_reap(uring);
+      uring_flush(uring);
+   }
+
+   if (uring->fd != -1)
+   {
+      close(uring->fd);
+   }
+
+   while (uring->closing != NULL)
+   {
+      us = uring->closing;
+      uring->closing = us->next;
+      session_destroy(uring, us, false);
+   }
+
+   if (uring->sqes != NULL)
+   {
+      munmap(uring->sqes, uring->sqes_size);
+   }
+
+   if (uring->cq_ring != NULL && uring->cq_ring != uring->sq_ring)
+   {
+      munmap(uring->cq_ring, uring->cq_ring_size);
+   }
+
+   if (uring->sq_ring != NULL)
+   {
+      munmap(uring->sq_ring, uring->sq_ring_size);
+   }
+
+   free(uring->free_bgids);
+   free(uring);
+}
+
+int
+pgprtdbg_uring_session_start(struct uring* uring, struct worker_session* session)
+{
+   struct uring_session* us = NULL;
+
+   us = (struct uring_session*)malloc(sizeof(struct uring_session));
+   if (us == NULL)
+   {
+      return 1;
+   }
+
+   memset(us, 0, sizeof(struct uring_session));
+   us->session = session;
+
+   if (direction_init(uring, us, &us->directions[0], session->client_io.client_fd, session->client_io.server_fd, true))
+   {
+      free(us);
+      return 1;
+   }
+
+   if (direction_init(uring, us, &us->directions[1], session->client_io.server_fd, session->client_io.client_fd, false))
+   {
+      direction_destroy(uring, &us->directions[0], true);
+      free(us);
+      return 1;
+   }
+
+   session->uring = us;
+
+   if (direction_recv(uring, &us->directions[0]) || direction_recv(uring, &us->directions[1]))
+   {
+      /* The session finish cancels what was queued */
+      uring_submit(uring);
+      return 1;
+   }
+
+   uring_submit(uring);
+
+   return 0;
+}
+
+bool
+pgprtdbg_uring_session_finish(struct uring* uring, struct worker_session* session)
+{
+   struct uring_session* us = NULL;
+   struct uring_direction* dir = NULL;
+
+   us = session->uring;
+   if (us == NULL || us->closing)
+   {
+      return false;
+   }
+
+   us->closing = true;
+
+   for (int i = 0; i < 2; i++)
+   {
+      dir = &us->directions[i];
+
+      if (dir->armed)
+      {
+         direction_cancel(uring, dir, URING_OP_RECV);
+      }
+
+      if (dir->sending > 0)
+      {
+         direction_cancel(uring, dir, URING_OP_SEND);
+      }
+   }
+
+   uring_submit(uring);
+
+   if (us->operations == 0)
+   {
+      session->uring = NULL;
+      us->session = NULL;
+      session_destroy(uring, us, true);
+      return false;
+   }
+
+   /* The kernel may still use the buffers, so the session is freed once its operations are done */
+   us->next = uring->closing;
+   uring->closing = us;
+
+   return true;
+}
+
+static int
+uring_setup(struct uring* uring)
+{
+   struct io_uring_params params;
+   void* sq = NULL;
+   void* cq = NULL;
+
+   memset(&params, 0, sizeof(struct io_uring_params));
+
+   uring->fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+   if (uring->fd < 0)
+   {
+      uring->fd = -1;
+      return 1;
+   }
+
+   if (!(params.features & IORING_FEAT_SINGLE_MMAP))
+   {
+      return 1;
+   }
+
+   uring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+   uring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+   if (uring->cq_ring_size > uring->sq_ring_size)
+   {
+      uring->sq_ring_size = uring->cq_ring_size;
+   }
+   uring->cq_ring_size = uring->sq_ring_size;
+
+   sq = mmap(NULL, uring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQ_RING);
+   if (sq == MAP_FAILED)
+   {
+      return 1;
+   }
+
+   uring->sq_ring = sq;
+   uring->cq_ring = sq;
+   cq = sq;
+
+   uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+   uring->sqes = mmap(NULL, uring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQES);
+   if (uring->sqes == MAP_FAILED)
+   {
+      uring->sqes = NULL;
+      return 1;
+   }
+
+   uring->sq_head = (unsigned*)((char*)sq + params.sq_off.head);
+   uring->sq_tail = (unsigned*)((char*)sq + params.sq_off.tail);
+   uring->sq_array = (unsigned*)((char*)sq + params.sq_off.array);
+   uring->sq_mask = *(unsigned*)((char*)sq + params.sq_off.ring_mask);
+   uring->sq_entries = params.sq_entries;
+   uring->sq_local_tail = *uring->sq_tail;
+
+   uring->cq_head = (unsigned*)((char*)cq + params.cq_off.head);
+   uring->cq_tail = (unsigned*)((char*)cq + params.cq_off.tail);
+   uring->cq_mask = *(unsigned*)((char*)cq + params.cq_off.ring_mask);
+   uring->cqes = (struct io_uring_cqe*)((char*)cq + params.cq_off.cqes);
+
+   return 0;
+}
+
+static struct io_uring_sqe*
+uring_sqe(struct uring* uring)
+{
+   unsigned index;
+   struct io_uring_sqe* sqe = NULL;
+
+   if (!uring_sqe_reserve(uring, 1))
+   {
+      return NULL;
+   }
+
+   index = uring->sq_local_tail & uring->sq_mask;
+   sqe = &uring->sqes[index];
+   memset(sqe, 0, sizeof(struct io_uring_sqe));
+   uring->sq_array[index] = index;
+
+   uring->sq_local_tail++;
+   uring->pending++;
+
+   return sqe;
+}
+
+static bool
+uring_sqe_reserve(struct uring* uring, unsigned count)
+{
+   unsigned head;
+
+   head = __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE);
+
+   if (uring->sq_entries - (uring->sq_local_tail - head) >= count)
+   {
+      return true;
+   }
+
+   uring_submit(uring);
+
+   head = __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE);
+
+   return uring->sq_entries - (uring->sq_local_tail - head) >= count;
+}
+
+static void
+uring_submit(struct uring* uring)
+{
+   int submitted;
+
+   if (uring->pending == 0)
+   {
+      return;
+   }
+
+   __atomic_store_n(uring->sq_tail, uring->sq_local_tail, __ATOMIC_RELEASE);
+
+   submitted = syscall(__NR_io_uring_enter, uring->fd, uring->pending, 0, 0, NULL, 0);
+   if (submitted > 0)
+   {
+      uring->pending -= submitted;
+   }
+   else if (submitted < 0 && errno != EAGAIN && errno != EBUSY && errno != EINTR)
+   {
+      pgprtdbg_log_lock();
+      pgprtdbg_log_line("uring_submit: %s", strerror(errno));
+      pgprtdbg_log_unlock();
+   }
+
+   errno = 0;
+}
+
+static void
+uring_reap(struct uring* uring)
+{
+   unsigned head;
+   unsigned tail;
+   uint64_t op;
+   struct io_uring_cqe* cqe = NULL;
+   struct uring_direction* dir = NULL;
+
+   head = *uring->cq_head;
+   tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+
+   while (head != tail)
+   {
+      cqe = &uring->cqes[head & uring->cq_mask];
+
+      dir = (struct uring_direction*)(uintptr_t)(cqe->user_data & ~(uint64_t)URING_OP_MASK);
+      op = cqe->user_data & URING_OP_MASK;
+
+      if (!(cqe->flags & IORING_CQE_F_MORE))
+      {
+         dir->owner->operations--;
+      }
+
+      if (op == URING_OP_RECV)
+      {
+         if (!(cqe->flags & IORING_CQE_F_MORE))
+         {
+            dir->armed = false;
+         }
+
+         direction_received(uring, dir, cqe);
+      }
+      else if (op == URING_OP_SEND)
+      {
+         direction_sent(uring, dir, cqe);
+      }
+
+      head++;
+
+      if (head == tail)
+      {
+         __atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+         tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+      }
+   }
+
+   __atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+}
+
+static void
+uring_flush(struct uring* uring)
+{
+   struct uring_direction* dir = NULL;
+   struct uring_session* us = NULL;
+   struct uring_session** p = NULL;
+
+   while (uring->dirty != NULL)
+   {
+      dir = uring->dirty;
+      uring->dirty = dir->next;
+      dir->next = NULL;
+      dir->dirty = false;
+
+      if (dir->owner->closing)
+      {
+         continue;
+      }
+
+      if (dir->draining && dir->length == 0)
+      {
+         pgprtdbg_worker_session_finish(uring->loop, dir->owner->session, dir->exit_code);
+         continue;
+      }
+
+      if (dir->sending == 0 && dir->length > 0)
+      {
+         if (direction_send(uring, dir))
+         {
+            direction_failed(uring, dir, false, ENOMEM);
+            continue;
+         }
+      }
+
+      if (!dir->armed && !dir->draining && dir->length < URING_BUFFERS)
+      {
+         if (direction_recv(uring, dir))
+         {
+            direction_failed(uring, dir, true, ENOMEM);
+            continue;
+         }
+      }
+   }
+
+   uring_submit(uring);
+
+   p = &uring->closing;
+   while (*p != NULL)
+   {
+      us = *p;
+
+      if (us->operations == 0)
+      {
+         *p = us->next;
+         session_destroy(uring, us, true);
+      }
+      else
+      {
+         p = &us->next;
+      }
+   }
+}
+
+static void
+uring_cb(struct ev_loop* loop, struct ev_io* watcher, int revents)
+{
+   struct uring* uring = (struct uring*)watcher->data;
+
+   uring_reap(uring);
+   uring_flush(uring);
+}
+
+static int
+direction_init(struct uring* uring, struct uring_session* us, struct uring_direction* dir, int from, int to, bool client)
+{
+   struct io_uring_buf_reg reg;
+   struct configuration* config = NULL;
+
+   config = (struct configuration*)shmem;
+
+   memset(dir, 0, sizeof(struct uring_direction));
+   dir->owner = us;
+   dir->client = client;
+   dir->from = from;
+   dir->to = to;
+
+   if (uring->free_bgids_length > 0)
+   {
+      dir->bgid = uring->free_bgids[--uring->free_bgids_length];
+   }
+   else
+   {
+      dir->bgid = uring->next_bgid++;
+   }
+
+   dir->ring_size = URING_BUFFERS * sizeof(struct io_uring_buf);
+   dir->ring = mmap(NULL, dir->ring_size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+   if (dir->ring == MAP_FAILED)
+   {
+      dir->ring = NULL;
+      goto error;
+   }
+
+   dir->buffers = (char*)malloc(URING_BUFFERS * (size_t)config->buffer_size);
+   if (dir->buffers == NULL)
+   {
+      goto error;
+   }
+
+   memset(&reg, 0, sizeof(struct io_uring_buf_reg));
+   reg.ring_addr = (unsigned long)dir->ring;
+   reg.ring_entries = URING_BUFFERS;
+   reg.bgid = dir->bgid;
+
+   if (syscall(__NR_io_uring_register, uring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+   {
+      goto error;
+   }
+
+   for (int i = 0; i < URING_BUFFERS; i++)
+   {
+      direction_buffer(dir, i);
+   }
+
+   return 0;
+
+error:
+
+   pgprtdbg_log_lock();
+   pgprtdbg_log_line("direction_init: %s", strerror(errno));
+   pgprtdbg_log_unlock();
+   errno = 0;
+
+   direction_destroy(uring, dir, false);
+
+   return 1;
+}
+
+static void
+direction_destroy(struct uring* uring, struct uring_direction* dir, bool registered)
+{
+   struct io_uring_buf_reg reg;
+   unsigned short* bgids = NULL;
+
+   if (registered)
+   {
+      memset(&reg, 0, sizeof(struct io_uring_buf_reg));
+      reg.bgid = dir->bgid;
+
+      syscall(__NR_io_uring_register, uring->fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+   }
+
+   if (dir->ring != NULL)
+   {
+      munmap(dir->ring, dir->ring_size);
+      dir->ring = NULL;
+   }
+
+   free(dir->buffers);
+   dir->buffers = NULL;
+
+   bgids = (unsigned short*)realloc(uring->free_bgids, (uring->free_bgids_length + 1) * sizeof(unsigned short));
+   if (bgids != NULL)
+   {
+      uring->free_bgids = bgids;
+      uring->free_bgids[uring->free_bgids_length++] = dir->bgid;
+   }
+}
+
+static void
+direction_dirty(struct uring* uring, struct uring_direction* dir)
+{
+   if (!dir->dirty)
+   {
+      dir->dirty = true;
+      dir->next = uring->dirty;
+      uring->dirty = dir;
+   }
+}
+
+static int
+direction_recv(struct uring* uring, struct uring_direction* dir)
+{
+   struct io_uring_sqe* sqe = NULL;
+
+   sqe = uring_sqe(uring);
+   if (sqe == NULL)
+   {
+      return 1;
+   }
+
+   sqe->opcode = IORING_OP_RECV;
+   sqe->fd = dir->from;
+   sqe->ioprio = IORING_RECV_MULTISHOT;
+   sqe->flags = IOSQE_BUFFER_SELECT;
+   sqe->buf_group = dir->bgid;
+   sqe->user_data = (uint64_t)(uintptr_t)dir | URING_OP_RECV;
+
+   dir->armed = true;
+   dir->owner->operations++;
+
+   return 0;
+}
+
+static int
+direction_send(struct uring* uring, struct uring_direction* dir)
+{
+   int index;
+   struct io_uring_sqe* sqe = NULL;
+   struct configuration* config = NULL;
+
+   config = (struct configuration*)shmem;
+
+   /* The whole chain or nothing, as a partial chain would link to the next entry queued */
+   if (!uring_sqe_reserve(uring, (unsigned)dir->length))
+   {
+      return 1;
+   }
+
+   /* Linked, so the kernel keeps the order of the buffers */
+   for (int i = 0; i < dir->length; i++)
+   {
+      sqe = uring_sqe(uring);
+
+      index = (dir->head + i) % URING_BUFFERS;
+
+      sqe->opcode = IORING_OP_SEND;
+      sqe->fd = dir->to;
+      sqe->addr = (unsigned long)(dir->buffers + dir->bids[index] * (size_t)config->buffer_size);
+      sqe->len = dir->lengths[index];
+      sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+      sqe->flags = i < dir->length - 1 ? IOSQE_IO_LINK : 0;
+      sqe->user_data = (uint64_t)(uintptr_t)dir | URING_OP_SEND;
+
+      dir->sending++;
+      dir->owner->operations++;
+   }
+
+   return 0;
+}
+
+static void
+direction_cancel(struct uring* uring, struct uring_direction* dir, int op)
+{
+   struct io_uring_sqe* sqe = NULL;
+
+   sqe = uring_sqe(uring);
+   if (sqe == NULL)
+   {
+      return;
+   }
+
+   sqe->opcode = IORING_OP_ASYNC_CANCEL;
+   sqe->fd = -1;
+   sqe->addr = (uint64_t)(uintptr_t)dir | op;
+   sqe->cancel_flags = IORING_ASYNC_CANCEL_ALL;
+   sqe->user_data = (uint64_t)(uintptr_t)dir | URING_OP_CANCEL;
+
+   dir->owner->operations++;
+}
+
+static void
+direction_buffer(struct uring_direction* dir, int bid)
+{
+   struct io_uring_buf* buf = NULL;
+   struct configuration* config = NULL;
+
+   config = (struct configuration*)shmem;
+
+   buf = &dir->ring->bufs[dir->ring_tail & (URING_BUFFERS - 1)];
+   buf->addr = (unsigned long)(dir->buffers + bid * (size_t)config->buffer_size);
+   buf->len = config->buffer_size;
+   buf->bid = bid;
+
+   dir->ring_tail++;
+   __atomic_store_n(&dir->ring->tail, dir->ring_tail, __ATOMIC_RELEASE);
+}
+
+static void
+direction_received(struct uring* uring, struct uring_direction* dir, struct io_uring_cqe* cqe)
+{
+   int bid;
+   int index;
+   bool fatal = false;
+   struct message msg;
+   struct worker_session* session = NULL;
+   struct worker_io* wi = NULL;
+   struct configuration* config = NULL;
+
+   config = (struct configuration*)shmem;
+
+   if (dir->owner->closing)
+   {
+      return;
+   }
+
+   session = dir->owner->session;
+   wi = dir->client ? &session->client_io : &session->server_io;
+
+   if (likely(cqe->res > 0))
+   {
+      bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+
+      memset(&msg, 0, sizeof(struct message));
+      msg.data = dir->buffers + bid * (size_t)config->buffer_size;
+      msg.kind = (signed char)(*((char*)msg.data));
+      msg.length = cqe->res;
+      msg.max_length = config->buffer_size;
+
+      if (dir->client)
+      {
+         if (config->passthrough)
+         {
+            wi->counter->sent_messages++;
+            wi->counter->sent_bytes += msg.length;
+         }
+         else if (session->stage != NULL)
+         {
+            pgprtdbg_decoder_stage_trace(session, true, &msg);
+         }
+         else if (pgprtdbg_client(dir->from, dir->to, &msg, wi->counter, session->decoder))
+         {
+            direction_failed(uring, dir, true, 0);
+            return;
+         }
+
+         if (config->save_traffic)
+         {
+            session->identifier++;
+            pgprtdbg_save_client_traffic(session->traffic_id, session->identifier, &msg);
+         }
+
+         if (msg.kind == 'X')
+         {
+            dir->draining = true;
+            dir->exit_code = WORKER_SUCCESS;
+         }
+      }
+      else
+      {
+         if (config->passthrough)
+         {
+            wi->counter->rcvd_messages++;
+            wi->counter->rcvd_bytes += msg.length;
+         }
+         else if (session->stage != NULL)
+         {
+            pgprtdbg_decoder_stage_trace(session, false, &msg);
+         }
+         else if (pgprtdbg_server(dir->from, dir->to, &msg, wi->counter, session->decoder))
+         {
+            direction_failed(uring, dir, true, 0);
+            return;
+         }
+
+         if (config->save_traffic)
+         {
+            pgprtdbg_save_server_traffic(session->traffic_id, session->identifier, &msg);
+         }
+
+         if (unlikely(msg.kind == 'E'))
+         {
+            if (!strncmp(msg.data + 6, "FATAL", 5) || !strncmp(msg.data + 6, "PANIC", 5))
+            {
+               fatal = true;
+            }
+
+            if (!strncmp(msg.data + 20, "0A000", 5))
+            {
+               fatal = false;
+            }
+
+            if (fatal)
+            {
+               dir->draining = true;
+               dir->exit_code = WORKER_SERVER_FATAL;
+            }
+         }
+      }
+
+      index = (dir->head + dir->length) % URING_BUFFERS;
+      dir->bids[index] = bid;
+      dir->lengths[index] = cqe->res;
+      dir->length++;
+
+      direction_dirty(uring, dir);
+   }
+   else if (cqe->res == 0)
+   {
+      pgprtdbg_log_lock();
+      if (dir->client)
+      {
+         pgprtdbg_log_line("[C] client_done: client_fd %d", dir->from);
+      }
+      else
+      {
+         pgprtdbg_log_line("[C] server_done: server_fd %d", dir->from);
+      }
+      pgprtdbg_log_unlock();
+
+      pgprtdbg_worker_session_finish(uring->loop, session, dir->client ? WORKER_CLIENT_FAILURE : WORKER_FAILURE);
+   }
+   else if (cqe->res == -ENOBUFS)
+   {
+      /* All buffers wait to be sent; receive again once they are */
+      direction_dirty(uring, dir);
+   }
+   else
+   {
+      direction_failed(uring, dir, true, -cqe->res);
+   }
+}
+
+static void
+direction_sent(struct uring* uring, struct uring_direction* dir, struct io_uring_cqe* cqe)
+{
+   int length;
+
+   length = dir->lengths[dir->head];
+
+   direction_buffer(dir, dir->bids[dir->head]);
+
+   dir->head = (dir->head + 1) % URING_BUFFERS;
+   dir->length--;
+   dir->sending--;
+
+   if (dir->owner->closing)
+   {
+      return;
+   }
+
+   if (unlikely(cqe->res != length))
+   {
+      direction_failed(uring, dir, false, cqe->res < 0 ? -cqe->res : EIO);
+      return;
+   }
+
+   direction_dirty(uring, dir);
+}
+
+static void
+direction_failed(struct uring* uring, struct uring_direction* dir, bool source, int error)
+{
+   bool client_failed;
+
+   client_failed = dir->client == source;
+
+   pgprtdbg_log_lock();
+   pgprtdbg_log_line("[%s] %s_error: %s_fd %d - %s", dir->client ? "C" : "S",
+                     client_failed ? "client" : "server", client_failed ? "client" : "server",
+                     source ? dir->from : dir->to, error != 0 ? strerror(error) : "decode");
+   pgprtdbg_log_unlock();
+
+   pgprtdbg_worker_session_finish(uring->loop, dir->owner->session, client_failed ? WORKER_CLIENT_FAILURE : WORKER_SERVER_FAILURE);
+}
+
+static void
+session_destroy(struct uring* uring, struct uring_session* us, bool registered)
+{
+   direction_destroy(uring, &us->directions[0], registered);
+   direction_destroy(uring, &us->directions[1], registered);
+
+   free(us->session);
+   free(us);
+}
+
+#else
+
+int
+pgprtdbg_uring_init(struct ev_loop* loop, struct uring** uring)
+{
+   *uring = NULL;
+
+   return 1;
+}
+
+void
+pgprtdbg_uring_destroy(struct ev_loop* loop, struct uring* uring)
+{
+}
+
+int
+pgprtdbg_uring_session_start(struct uring* uring, struct worker_session* session)
+{
+   return 1;
+}
+
+bool
+pgprtdbg_uring_session_finish(struct uring* uring, struct worker_session* session)
+{
+   return false;
+}
+
+#endif
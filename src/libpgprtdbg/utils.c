@@ -29,6 +29,7 @@
 /* pgprtdbg */
 #include <pgprtdbg.h>
 #include <logging.h>
+#include <trace.h>
 #include <utils.h>
 
 /* system */
@@ -53,7 +54,20 @@
 
 #define LINE_LENGTH 32
 
+/* The protocol is big endian; swap with a single instruction where needed */
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define NETWORK_16(v) __builtin_bswap16(v)
+#define NETWORK_32(v) __builtin_bswap32(v)
+#define NETWORK_64(v) __builtin_bswap64(v)
+#else
+#define NETWORK_16(v) (v)
+#define NETWORK_32(v) (v)
+#define NETWORK_64(v) (v)
+#endif
+
 static int write_traffic(char* filename, long identifier, struct message* msg);
+static int append_traffic(char* filename, char* data, size_t length);
+static void end_traffic(int session);
 
 signed char
 pgprtdbg_read_byte(void* data)
@@ -64,53 +78,31 @@ pgprtdbg_read_byte(void* data)
 int16_t
 pgprtdbg_read_int16(void* data)
 {
-   unsigned char bytes[] = {*((unsigned char*)data),
-                            *((unsigned char*)(data + 1))};
+   uint16_t value;
 
-   int16_t res = (int16_t)((bytes[0] << 8)) |
-                 ((bytes[1]));
+   memcpy(&value, data, sizeof(value));
 
-   return res;
+   return (int16_t)NETWORK_16(value);
 }
 
 int32_t
 pgprtdbg_read_int32(void* data)
 {
-   unsigned char bytes[] = {*((unsigned char*)data),
-                            *((unsigned char*)(data + 1)),
-                            *((unsigned char*)(data + 2)),
-                            *((unsigned char*)(data + 3))};
+   uint32_t value;
 
-   int32_t res = (int32_t)((bytes[0] << 24)) |
-                 ((bytes[1] << 16)) |
-                 ((bytes[2] << 8)) |
-                 ((bytes[3]));
+   memcpy(&value, data, sizeof(value));
 
-   return res;
+   return (int32_t)NETWORK_32(value);
 }
 
 long
 pgprtdbg_read_long(void* data)
 {
-   unsigned char bytes[] = {*((unsigned char*)data),
-                            *((unsigned char*)(data + 1)),
-                            *((unsigned char*)(data + 2)),
-                            *((unsigned char*)(data + 3)),
-                            *((unsigned char*)(data + 4)),
-                            *((unsigned char*)(data + 5)),
-                            *((unsigned char*)(data + 6)),
-                            *((unsigned char*)(data + 7))};
-
-   long res = (long)(((long)bytes[0]) << 56) |
-              (((long)bytes[1]) << 48) |
-              (((long)bytes[2]) << 40) |
-              (((long)bytes[3]) << 32) |
-              (((long)bytes[4]) << 24) |
-              (((long)bytes[5]) << 16) |
-              (((long)bytes[6]) << 8) |
-              (((long)bytes[7]));
-
-   return res;
+   uint64_t value;
+
+   memcpy(&value, data, sizeof(value));
+
+   return (long)NETWORK_64(value);
 }
 
 char*
@@ -128,37 +120,17 @@ pgprtdbg_write_byte(void* data, signed char b)
 void
 pgprtdbg_write_int32(void* data, int32_t i)
 {
-   char* ptr = (char*)&i;
-
-   *((char*)(data + 3)) = *ptr;
-   ptr++;
-   *((char*)(data + 2)) = *ptr;
-   ptr++;
-   *((char*)(data + 1)) = *ptr;
-   ptr++;
-   *((char*)(data)) = *ptr;
+   uint32_t value = NETWORK_32((uint32_t)i);
+
+   memcpy(data, &value, sizeof(value));
 }
 
 void
 pgprtdbg_write_long(void* data, long l)
 {
-   char* ptr = (char*)&l;
-
-   *((char*)(data + 7)) = *ptr;
-   ptr++;
-   *((char*)(data + 6)) = *ptr;
-   ptr++;
-   *((char*)(data + 5)) = *ptr;
-   ptr++;
-   *((char*)(data + 4)) = *ptr;
-   ptr++;
-   *((char*)(data + 3)) = *ptr;
-   ptr++;
-   *((char*)(data + 2)) = *ptr;
-   ptr++;
-   *((char*)(data + 1)) = *ptr;
-   ptr++;
-   *((char*)(data)) = *ptr;
+   uint64_t value = NETWORK_64((uint64_t)l);
+
+   memcpy(data, &value, sizeof(value));
 }
 
 void
@@ -337,23 +309,23 @@ pgprtdbg_libev_engine(unsigned int val)
 }
 
 int
-pgprtdbg_save_client_traffic(pid_t pid, long identifier, struct message* msg)
+pgprtdbg_save_client_traffic(int session, long identifier, struct message* msg)
 {
    char filename[MISC_LENGTH];
 
    memset(&filename, 0, sizeof(filename));
-   snprintf(&filename[0], sizeof(filename), "%d-client.bin", pid);
+   snprintf(&filename[0], sizeof(filename), "%d-client.bin", session);
 
    return write_traffic(&filename[0], identifier, msg);
 }
 
 int
-pgprtdbg_save_server_traffic(pid_t pid, long identifier, struct message* msg)
+pgprtdbg_save_server_traffic(int session, long identifier, struct message* msg)
 {
    char filename[MISC_LENGTH];
 
    memset(&filename, 0, sizeof(filename));
-   snprintf(&filename[0], sizeof(filename), "%d-server.bin", pid);
+   snprintf(&filename[0], sizeof(filename), "%d-server.bin", session);
 
    return write_traffic(&filename[0], identifier, msg);
 }
@@ -362,6 +334,9 @@ static int
 write_traffic(char* filename, long identifier, struct message* msg)
 {
    FILE* file;
+   char* data = NULL;
+   size_t size = 0;
+   int status;
    char header[MISC_LENGTH];
    char buf[256 * 1024];
    int j = 0;
@@ -372,7 +347,11 @@ write_traffic(char* filename, long identifier, struct message* msg)
    struct tm gmtval;
    struct timespec curtime;
 
-   file = fopen(filename, "a");
+   file = open_memstream(&data, &size);
+   if (file == NULL)
+   {
+      return 1;
+   }
 
    memset(&header, 0, sizeof(header));
    memset(&buf, 0, sizeof(buf));
@@ -441,17 +420,22 @@ write_traffic(char* filename, long identifier, struct message* msg)
 
    fprintf(file, "%s", buf);
    fprintf(file, "\n");
-   fflush(file);
    fclose(file);
 
-   return 0;
+   status = append_traffic(filename, data, size);
+   free(data);
+
+   return status;
 }
 
 int
-pgprtdbg_save_begin_marker(pid_t pid)
+pgprtdbg_save_begin_marker(int session)
 {
    char filename[MISC_LENGTH];
    FILE* file;
+   char* data = NULL;
+   size_t size = 0;
+   int status;
    char line[MISC_LENGTH];
    char ymds[256];
    char tbuf[256];
@@ -460,9 +444,13 @@ pgprtdbg_save_begin_marker(pid_t pid)
    struct timespec curtime;
 
    memset(&filename, 0, sizeof(filename));
-   snprintf(&filename[0], sizeof(filename), "%d-client.bin", pid);
+   snprintf(&filename[0], sizeof(filename), "%d-client.bin", session);
 
-   file = fopen(filename, "a");
+   file = open_memstream(&data, &size);
+   if (file == NULL)
+   {
+      return 1;
+   }
 
    memset(&line, 0, sizeof(line));
    memset(&ymds, 0, sizeof(ymds));
@@ -479,17 +467,22 @@ pgprtdbg_save_begin_marker(pid_t pid)
    fprintf(file, "%s", line);
    fprintf(file, "\n");
 
-   fflush(file);
    fclose(file);
 
-   return 0;
+   status = append_traffic(filename, data, size);
+   free(data);
+
+   return status;
 }
 
 int
-pgprtdbg_save_end_marker(pid_t pid)
+pgprtdbg_save_end_marker(int session)
 {
    char filename[MISC_LENGTH];
    FILE* file;
+   char* data = NULL;
+   size_t size = 0;
+   int status;
    char line[MISC_LENGTH];
    char ymds[256];
    char tbuf[256];
@@ -498,9 +491,13 @@ pgprtdbg_save_end_marker(pid_t pid)
    struct timespec curtime;
 
    memset(&filename, 0, sizeof(filename));
-   snprintf(&filename[0], sizeof(filename), "%d-client.bin", pid);
+   snprintf(&filename[0], sizeof(filename), "%d-client.bin", session);
 
-   file = fopen(filename, "a");
+   file = open_memstream(&data, &size);
+   if (file == NULL)
+   {
+      return 1;
+   }
 
    memset(&line, 0, sizeof(line));
    memset(&ymds, 0, sizeof(ymds));
@@ -517,60 +514,61 @@ pgprtdbg_save_end_marker(pid_t pid)
    fprintf(file, "%s", line);
    fprintf(file, "\n");
 
-   fflush(file);
    fclose(file);
 
-   return 0;
+   status = append_traffic(filename, data, size);
+   free(data);
+
+   end_traffic(session);
+
+   return status;
 }
 
-void*
-pgprtdbg_data_append(void* data, size_t data_size, void* new_data, size_t new_data_size, size_t* new_size)
+static int
+append_traffic(char* filename, char* data, size_t length)
 {
-   if (data != NULL)
-   {
-      data = realloc(data, data_size + new_data_size);
-      memcpy(data + data_size, new_data, new_data_size);
+   char path[MISC_LENGTH];
+   FILE* file;
+   struct configuration* config;
 
-      *new_size = data_size + new_data_size;
+   config = (struct configuration*)shmem;
 
-      return data;
-   }
-   else
+   if (config->compression != COMPRESSION_NONE)
    {
-      void* result = NULL;
-
-      result = malloc(new_data_size);
-      memcpy(result, new_data, new_data_size);
-
-      *new_size = new_data_size;
+      snprintf(&path[0], sizeof(path), "%s.gz", filename);
 
-      return result;
+      /* Compressed by the trace writer, off the forwarding path */
+      return pgprtdbg_trace_capture(&path[0], data, length, false);
    }
-}
 
-void*
-pgprtdbg_data_remove(void* data, size_t data_size, size_t remove_size, size_t* new_size)
-{
-   if (data_size - remove_size == 0)
+   file = fopen(filename, "a");
+   if (file == NULL)
    {
-      free(data);
+      return 1;
+   }
 
-      *new_size = 0;
+   fwrite(data, 1, length, file);
+   fflush(file);
+   fclose(file);
 
-      return NULL;
-   }
-   else
-   {
-      void* result = NULL;
+   return 0;
+}
 
-      *new_size = data_size - remove_size;
+static void
+end_traffic(int session)
+{
+   char path[MISC_LENGTH];
+   struct configuration* config;
 
-      result = malloc(*new_size);
-      memset(result, 0, *new_size);
-      memcpy(result, data + remove_size, *new_size);
+   config = (struct configuration*)shmem;
 
-      free(data);
+   /* The trace writer ends the compression streams of the session */
+   if (config->compression != COMPRESSION_NONE)
+   {
+      snprintf(&path[0], sizeof(path), "%d-client.bin.gz", session);
+      pgprtdbg_trace_capture(&path[0], NULL, 0, true);
 
-      return result;
+      snprintf(&path[0], sizeof(path), "%d-server.bin.gz", session);
+      pgprtdbg_trace_capture(&path[0], NULL, 0, true);
    }
 }
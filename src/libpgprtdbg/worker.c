@@ -28,38 +28,139 @@
 
 /* pgprtdbg */
 #include <pgprtdbg.h>
+#include <admission.h>
 #include <logging.h>
 #include <memory.h>
 #include <message.h>
 #include <network.h>
+#include <output.h>
 #include <pipeline.h>
+#include <pool.h>
+#include <protocol.h>
+#include <server.h>
+#include <slot.h>
+#include <trace.h>
+#include <uring.h>
 #include <worker.h>
 #include <utils.h>
 #include <counter.h>
+#include <decoder.h>
 
 /* system */
+#include <errno.h>
 #include <ev.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
 #include <sys/types.h>
 
-volatile int running = 1;
-volatile int exit_code = WORKER_FAILURE;
+/* The wait in seconds before peeking again at a partial startup packet */
+#define STARTUP_RETRY 0.01
 
+struct accept_io
+{
+   struct ev_io io;
+   int socket;
+   struct worker_loop* owner;
+};
+
+/** @struct
+ * An event loop serving sessions
+ */
+struct worker_loop
+{
+   struct ev_loop* loop;            /**< The libev loop */
+   struct ev_async stop;            /**< Stop request from another thread */
+   struct ev_timer flush;           /**< Flushes the output buffer */
+   pthread_t thread;                /**< The thread, if threaded */
+   bool keep_running;               /**< Keep running */
+   int* fds;                        /**< The descriptors bound by this loop */
+   int fds_length;                  /**< The number of bound descriptors */
+   struct accept_io* accept_ios;    /**< The accept watchers */
+   int accept_ios_length;           /**< The number of accept watchers */
+   bool accepting;                  /**< Are the accept watchers started */
+   int max_sessions;                /**< The maximum number of sessions, 0 for no limit */
+   int sessions;                    /**< The number of sessions */
+   int exit_code;                   /**< The exit code of the last session */
+   struct worker_session* head;     /**< The sessions */
+   struct uring* uring;             /**< The io_uring data path, if any */
+   struct decoder_stage* stage;     /**< The asynchronous decoder, if any */
+   struct pool* pool;               /**< The established server connections, if any */
+   struct admission* admission;     /**< The clients waiting for a connection slot */
+   bool paused;                     /**< Are the accept watchers stopped by the admission queue */
+};
+
+static struct worker_loop* loops = NULL;
+static int loops_length = 0;
+
+static int loop_init(struct worker_loop* wl, bool bind, int unix_fd, int max_sessions);
+static void loop_run(struct worker_loop* wl);
+static void loop_destroy(struct worker_loop* wl);
+static void* loop_thread(void* arg);
+static int session_start(struct worker_loop* wl, int client_fd, int slot, int server, int server_fd, struct sockaddr_storage* peer);
+static int session_route(struct worker_loop* wl, struct worker_session* session);
+static int session_connect(struct worker_loop* wl, struct worker_session* session);
+static int session_connected(struct worker_loop* wl, struct worker_session* session);
+static void connect_cb(struct ev_loop* loop, struct ev_io* watcher, int revents);
+static void connect_timeout_cb(struct ev_loop* loop, struct ev_timer* watcher, int revents);
+static void connect_retry(struct ev_loop* loop, struct worker_session* session);
+static void startup_cb(struct ev_loop* loop, struct ev_io* watcher, int revents);
+static void startup_retry(struct ev_loop* loop, struct worker_session* session, int bytes);
+static void startup_retry_cb(struct ev_loop* loop, struct ev_timer* watcher, int revents);
+static void startup_timeout_cb(struct ev_loop* loop, struct ev_timer* watcher, int revents);
+static void start_accept(struct worker_loop* wl);
+static void stop_accept(struct worker_loop* wl);
+static void accept_cb(struct ev_loop* loop, struct ev_io* watcher, int revents);
+static void loop_accept(void* data, bool start);
+static void loop_admit(void* data, int client_fd, int slot, struct sockaddr_storage* peer);
+static void stop_cb(struct ev_loop* loop, struct ev_async* w, int revents);
+static void flush_cb(struct ev_loop* loop, struct ev_timer* watcher, int revents);
 static void sigquit_cb(struct ev_loop* loop, ev_signal* w, int revents);
 
 void
-pgprtdbg_worker(int client_fd, int client_number)
+pgprtdbg_worker(int client_fd, int slot, int server, int server_fd, struct sockaddr_storage* peer)
 {
-   struct ev_loop* loop = NULL;
+   struct worker_loop wl;
+   struct ev_signal signal_watcher;
+
+   pgprtdbg_start_logging();
+   pgprtdbg_memory_init();
+
+   /* The slot is given back by this process, so only it sets the pid */
+   pgprtdbg_slot_set_pid(slot, getpid());
+
+   loop_init(&wl, false, -1, 1);
+
+   ev_signal_init(&signal_watcher, sigquit_cb, SIGQUIT);
+   signal_watcher.data = &wl;
+   ev_signal_start(wl.loop, &signal_watcher);
+
+   session_start(&wl, client_fd, slot, server, server_fd, peer);
+
+   loop_run(&wl);
+
+   ev_signal_stop(wl.loop, &signal_watcher);
+   loop_destroy(&wl);
+
+   pgprtdbg_output_release();
+   pgprtdbg_trace_release();
+   pgprtdbg_memory_destroy();
+   pgprtdbg_stop_logging();
+
+   exit(wl.exit_code);
+}
+
+void
+pgprtdbg_worker_pool(int unix_fd)
+{
+   struct worker_loop wl;
    struct ev_signal signal_watcher;
-   struct event_counter* counter;
-   struct worker_io client_io;
-   struct worker_io server_io;
    struct configuration* config;
    pid_t pid;
-   int server_fd = -1;
-   bool connected = false;
 
    pgprtdbg_start_logging();
    pgprtdbg_memory_init();
@@ -67,107 +168,828 @@ pgprtdbg_worker(int client_fd, int client_number)
    config = (struct configuration*)shmem;
    pid = getpid();
 
-   memset(&client_io, 0, sizeof(struct worker_io));
-   memset(&server_io, 0, sizeof(struct worker_io));
+   if (loop_init(&wl, true, unix_fd, 1))
+   {
+      pgprtdbg_log_lock();
+      pgprtdbg_log_line("pgprtdbg: Worker %d could not bind to %s:%d", pid, config->host, config->port);
+      pgprtdbg_log_unlock();
+
+      pgprtdbg_memory_destroy();
+      pgprtdbg_stop_logging();
+
+      exit(WORKER_BIND_FAILURE);
+   }
+
+   ev_signal_init(&signal_watcher, sigquit_cb, SIGQUIT);
+   signal_watcher.data = &wl;
+   ev_signal_start(wl.loop, &signal_watcher);
+
+   pgprtdbg_log_lock();
+   pgprtdbg_log_line("Worker %d: started", pid);
+   pgprtdbg_log_unlock();
+
+   loop_run(&wl);
+
+   ev_signal_stop(wl.loop, &signal_watcher);
+   loop_destroy(&wl);
 
-   counter = pgprtdbg_counter_get(client_number);
-   client_io.counter = counter;
-   server_io.counter = counter;
+   pgprtdbg_log_lock();
+   pgprtdbg_log_line("Worker %d: stopped", pid);
+   pgprtdbg_log_unlock();
+
+   pgprtdbg_output_release();
+   pgprtdbg_trace_release();
+   pgprtdbg_memory_destroy();
+   pgprtdbg_stop_logging();
+
+   exit(WORKER_SUCCESS);
+}
+
+int
+pgprtdbg_worker_threads_start(int unix_fd)
+{
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
 
-   for (int i = 0; i < MAX_NUMBER_OF_CONNECTIONS; i++)
+   loops = (struct worker_loop*)malloc(config->threads * sizeof(struct worker_loop));
+   memset(loops, 0, config->threads * sizeof(struct worker_loop));
+
+   for (int i = 0; i < config->threads; i++)
    {
-      if (config->pids[i] == 0)
+      if (loop_init(&loops[i], true, unix_fd, 0))
       {
-         config->pids[i] = pid;
-         break;
+         pgprtdbg_log_lock();
+         pgprtdbg_log_line("pgprtdbg: Thread %d could not bind to %s:%d", i, config->host, config->port);
+         pgprtdbg_log_unlock();
+         goto error;
+      }
+
+      loops_length++;
+
+      if (pthread_create(&loops[i].thread, NULL, loop_thread, &loops[i]))
+      {
+         pgprtdbg_log_lock();
+         pgprtdbg_log_line("pgprtdbg: Could not create thread %d", i);
+         pgprtdbg_log_unlock();
+         loop_destroy(&loops[i]);
+         loops_length--;
+         goto error;
       }
    }
 
+   return 0;
+
+error:
+
+   pgprtdbg_worker_threads_stop();
+
+   return 1;
+}
+
+void
+pgprtdbg_worker_threads_stop(void)
+{
+   for (int i = 0; i < loops_length; i++)
+   {
+      ev_async_send(loops[i].loop, &loops[i].stop);
+   }
+
+   for (int i = 0; i < loops_length; i++)
+   {
+      pthread_join(loops[i].thread, NULL);
+   }
+
+   free(loops);
+   loops = NULL;
+   loops_length = 0;
+}
+
+void
+pgprtdbg_worker_session_finish(struct ev_loop* loop, struct worker_session* session, int exit_code)
+{
+   bool keep = false;
+   struct worker_loop* wl;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+   wl = session->owner;
+
    pgprtdbg_log_lock();
    pgprtdbg_log_line("--------");
-   pgprtdbg_log_line("Start client: %d", client_fd);
+   pgprtdbg_log_line("Stop client: %d", session->client_io.client_fd);
    pgprtdbg_log_unlock();
 
    if (config->save_traffic)
    {
-      pgprtdbg_save_begin_marker(getpid());
+      pgprtdbg_save_end_marker(session->traffic_id);
    }
 
-   /* Connect */
-   if (!pgprtdbg_connect(config->server[0].host, config->server[0].port, &server_fd))
+   ev_io_stop(loop, (struct ev_io*)&session->client_io);
+   ev_io_stop(loop, (struct ev_io*)&session->server_io);
+   ev_io_stop(loop, &session->client_io.write_io);
+   ev_io_stop(loop, &session->server_io.write_io);
+   ev_io_stop(loop, &session->connect_io);
+   ev_timer_stop(loop, &session->connect_timer);
+   ev_timer_stop(loop, &session->retry_timer);
+
+   if (wl->uring != NULL)
    {
-      atomic_fetch_add(&config->active_connections, 1);
-      connected = true;
+      keep = pgprtdbg_uring_session_finish(wl->uring, session);
+   }
 
-      ev_io_init((struct ev_io*)&client_io, pipeline_client, client_fd, EV_READ);
-      client_io.client_fd = client_fd;
-      client_io.server_fd = server_fd;
+   pgprtdbg_disconnect(session->client_io.client_fd);
+   pgprtdbg_disconnect(session->client_io.server_fd);
 
-      ev_io_init((struct ev_io*)&server_io, pipeline_server, server_fd, EV_READ);
-      server_io.client_fd = client_fd;
-      server_io.server_fd = server_fd;
+   if (session->connected)
+   {
+      atomic_fetch_sub(&config->server[session->server].connections, 1);
+   }
 
-      loop = ev_loop_new(pgprtdbg_libev(config->libev));
+   pgprtdbg_admission_release(session->slot);
 
-      ev_signal_init(&signal_watcher, sigquit_cb, SIGQUIT);
-      ev_signal_start(loop, &signal_watcher);
+   if (session->stage != NULL)
+   {
+      pgprtdbg_decoder_stage_close(session->stage, session->decoder);
+   }
+   else if (session->decoder != NULL)
+   {
+      pgprtdbg_decoder_reset(session->decoder);
+      free(session->decoder);
+   }
+   session->decoder = NULL;
+   pipeline_splice_destroy(&session->client_io);
+   pipeline_splice_destroy(&session->server_io);
+   free(session->client_io.queue);
+   free(session->server_io.queue);
 
-      ev_io_start(loop, (struct ev_io*)&client_io);
-      ev_io_start(loop, (struct ev_io*)&server_io);
+   if (session->prev != NULL)
+   {
+      session->prev->next = session->next;
+   }
+   else
+   {
+      wl->head = session->next;
+   }
+
+   if (session->next != NULL)
+   {
+      session->next->prev = session->prev;
+   }
 
-      while (running)
+   wl->sessions--;
+   wl->exit_code = exit_code;
+
+   if (!keep)
+   {
+      free(session);
+   }
+
+   if (wl->keep_running)
+   {
+      pgprtdbg_admission_wakeup(wl->admission);
+   }
+
+   if (wl->keep_running && !wl->accepting && !wl->paused && (wl->max_sessions == 0 || wl->sessions < wl->max_sessions))
+   {
+      start_accept(wl);
+   }
+
+   ev_break(loop, EVBREAK_ONE);
+}
+
+static int
+loop_init(struct worker_loop* wl, bool bind, int unix_fd, int max_sessions)
+{
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   memset(wl, 0, sizeof(struct worker_loop));
+
+   wl->keep_running = true;
+   wl->max_sessions = max_sessions;
+   wl->exit_code = WORKER_FAILURE;
+
+   if (bind)
+   {
+      if (pgprtdbg_bind(config->host, config->port, &wl->fds, &wl->fds_length))
+      {
+         return 1;
+      }
+
+      wl->accept_ios_length = wl->fds_length + (unix_fd != -1 ? 1 : 0);
+      wl->accept_ios = (struct accept_io*)malloc(wl->accept_ios_length * sizeof(struct accept_io));
+      memset(wl->accept_ios, 0, wl->accept_ios_length * sizeof(struct accept_io));
+
+      for (int i = 0; i < wl->fds_length; i++)
+      {
+         wl->accept_ios[i].socket = *(wl->fds + i);
+      }
+
+      if (unix_fd != -1)
       {
-         ev_loop(loop, 0);
+         wl->accept_ios[wl->fds_length].socket = unix_fd;
       }
+
+      for (int i = 0; i < wl->accept_ios_length; i++)
+      {
+         /* The Unix Domain Socket is shared, so another worker may win the accept() */
+         pgprtdbg_socket_nonblocking(wl->accept_ios[i].socket, true);
+         ev_io_init((struct ev_io*)&wl->accept_ios[i], accept_cb, wl->accept_ios[i].socket, EV_READ);
+         wl->accept_ios[i].owner = wl;
+      }
+   }
+
+   wl->loop = ev_loop_new(pgprtdbg_libev(config->libev));
+
+   ev_async_init(&wl->stop, stop_cb);
+   wl->stop.data = wl;
+   ev_async_start(wl->loop, &wl->stop);
+
+   if (config->output_flush_interval > 0)
+   {
+      ev_timer_init(&wl->flush, flush_cb, config->output_flush_interval / 1000.0, config->output_flush_interval / 1000.0);
+      ev_timer_start(wl->loop, &wl->flush);
+   }
+
+   if (config->async_decode && pgprtdbg_decoder_stage_start(&wl->stage))
+   {
+      pgprtdbg_log_lock();
+      pgprtdbg_log_line("The decoder thread couldn't be started; decoding on the forwarding path");
+      pgprtdbg_log_unlock();
+   }
+
+   if (config->io_uring && pgprtdbg_uring_init(wl->loop, &wl->uring))
+   {
+      pgprtdbg_log_lock();
+      pgprtdbg_log_line("io_uring isn't available; using the event loop pipeline");
+      pgprtdbg_log_unlock();
+   }
+
+   /* A process serving a single session gets its connection from the main process */
+   if (bind && config->pool_size > 0)
+   {
+      pgprtdbg_pool_init(wl->loop, config->pool_size, &wl->pool);
+   }
+
+   if (bind && pgprtdbg_admission_init(wl->loop, loop_accept, loop_admit, wl, &wl->admission))
+   {
+      return 1;
+   }
+
+   return 0;
+}
+
+static void
+loop_run(struct worker_loop* wl)
+{
+   if (wl->accept_ios_length > 0)
+   {
+      start_accept(wl);
+   }
+
+   while (wl->keep_running && (wl->accept_ios_length > 0 || wl->sessions > 0))
+   {
+      ev_loop(wl->loop, 0);
+   }
+}
+
+static void
+loop_destroy(struct worker_loop* wl)
+{
+   pgprtdbg_admission_destroy(wl->admission);
+   wl->admission = NULL;
+
+   while (wl->head != NULL)
+   {
+      pgprtdbg_worker_session_finish(wl->loop, wl->head, WORKER_FAILURE);
+   }
+
+   stop_accept(wl);
+
+   for (int i = 0; i < wl->fds_length; i++)
+   {
+      pgprtdbg_disconnect(*(wl->fds + i));
+   }
+
+   pgprtdbg_uring_destroy(wl->loop, wl->uring);
+   wl->uring = NULL;
+
+   pgprtdbg_decoder_stage_stop(wl->stage);
+   wl->stage = NULL;
+
+   pgprtdbg_pool_destroy(wl->pool);
+   wl->pool = NULL;
+
+   ev_timer_stop(wl->loop, &wl->flush);
+   ev_async_stop(wl->loop, &wl->stop);
+   ev_loop_destroy(wl->loop);
+
+   free(wl->accept_ios);
+   free(wl->fds);
+
+   wl->loop = NULL;
+   wl->accept_ios = NULL;
+   wl->fds = NULL;
+}
+
+static void*
+loop_thread(void* arg)
+{
+   struct worker_loop* wl = (struct worker_loop*)arg;
+
+   pgprtdbg_memory_init();
+
+   loop_run(wl);
+   loop_destroy(wl);
+
+   pgprtdbg_output_release();
+   pgprtdbg_trace_release();
+   pgprtdbg_memory_destroy();
+
+   return NULL;
+}
+
+static int
+session_start(struct worker_loop* wl, int client_fd, int slot, int server, int server_fd, struct sockaddr_storage* peer)
+{
+   struct worker_session* session;
+   struct event_counter* counter;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   session = (struct worker_session*)malloc(sizeof(struct worker_session));
+   memset(session, 0, sizeof(struct worker_session));
+
+   counter = pgprtdbg_counter_get(slot);
+
+   session->slot = slot;
+   session->client_io.client_fd = client_fd;
+   session->client_io.server_fd = -1;
+   session->client_io.counter = counter;
+   session->client_io.session = session;
+   session->server_io.client_fd = client_fd;
+   session->server_io.server_fd = -1;
+   session->server_io.counter = counter;
+   session->server_io.session = session;
+   for (int i = 0; i < 2; i++)
+   {
+      session->client_io.pipe_fds[i] = -1;
+      session->client_io.capture_fds[i] = -1;
+      session->server_io.pipe_fds[i] = -1;
+      session->server_io.capture_fds[i] = -1;
+   }
+   session->client_io.capture_fd = -1;
+   session->server_io.capture_fd = -1;
+   session->exit_code = WORKER_FAILURE;
+   memcpy(&session->peer, peer, sizeof(struct sockaddr_storage));
+   session->owner = wl;
+   session->stage = wl->stage;
+   session->decoder = (struct decoder*)malloc(sizeof(struct decoder));
+   memset(session->decoder, 0, sizeof(struct decoder));
+   session->decoder->offline = wl->stage != NULL;
+   session->decoder->key = -1;
+
+   /* Neither the process nor the slot is unique, as workers serve several sessions and slots are reused */
+   session->traffic_id = atomic_fetch_add(&config->sessions, 1) + 1;
+   session->decoder->session = session->traffic_id;
+
+   session->next = wl->head;
+   if (wl->head != NULL)
+   {
+      wl->head->prev = session;
+   }
+   wl->head = session;
+   wl->sessions++;
+
+   if (wl->max_sessions > 0 && wl->sessions >= wl->max_sessions)
+   {
+      stop_accept(wl);
    }
 
    pgprtdbg_log_lock();
    pgprtdbg_log_line("--------");
-   pgprtdbg_log_line("Stop client: %d", client_fd);
+   pgprtdbg_log_line("Start client: %d (%s)", client_fd, counter->address);
    pgprtdbg_log_unlock();
 
    if (config->save_traffic)
    {
-      pgprtdbg_save_end_marker(getpid());
+      pgprtdbg_save_begin_marker(session->traffic_id);
+   }
+
+   session->server = server;
+   session->client_io.server_fd = server_fd;
+   session->server_io.server_fd = server_fd;
+
+   /* A CancelRequest has to reach the server of the session it cancels */
+   if (config->number_of_servers > 1)
+   {
+      /* The watcher is level-triggered, so it only fires once the header is there */
+      pgprtdbg_socket_rcvlowat(client_fd, 8);
+
+      ev_io_init(&session->connect_io, startup_cb, client_fd, EV_READ);
+      session->connect_io.data = session;
+      ev_io_start(wl->loop, &session->connect_io);
+
+      ev_timer_init(&session->connect_timer, startup_timeout_cb, config->connect_timeout, 0.);
+      session->connect_timer.data = session;
+      ev_timer_start(wl->loop, &session->connect_timer);
+
+      return 0;
+   }
+
+   return session_route(wl, session);
+}
+
+static int
+session_route(struct worker_loop* wl, struct worker_session* session)
+{
+   int server_fd = -1;
+
+   if (session->server_io.server_fd != -1)
+   {
+      return session_connected(wl, session);
+   }
+
+   if (session->server == -1 && pgprtdbg_server_select(session->tried, &session->server))
+   {
+      pgprtdbg_worker_session_finish(wl->loop, session, WORKER_FAILURE);
+      return 1;
+   }
+
+   if (!pgprtdbg_pool_get(wl->pool, session->server, &server_fd))
+   {
+      session->client_io.server_fd = server_fd;
+      session->server_io.server_fd = server_fd;
+
+      return session_connected(wl, session);
+   }
+
+   if (session_connect(wl, session))
+   {
+      pgprtdbg_worker_session_finish(wl->loop, session, WORKER_FAILURE);
+      return 1;
+   }
+
+   return 0;
+}
+
+static int
+session_connect(struct worker_loop* wl, struct worker_session* session)
+{
+   int server_fd = -1;
+   socklen_t length;
+   struct sockaddr_storage address;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   while (true)
+   {
+      while (!pgprtdbg_server_address(session->server, session->address, &address, &length))
+      {
+         if (pgprtdbg_connect((struct sockaddr*)&address, length, &server_fd))
+         {
+            session->address++;
+            continue;
+         }
+
+         session->client_io.server_fd = server_fd;
+         session->server_io.server_fd = server_fd;
+
+         ev_io_init(&session->connect_io, connect_cb, server_fd, EV_WRITE);
+         session->connect_io.data = session;
+         ev_io_start(wl->loop, &session->connect_io);
+
+         ev_timer_init(&session->connect_timer, connect_timeout_cb, config->connect_timeout, 0.);
+         session->connect_timer.data = session;
+         ev_timer_start(wl->loop, &session->connect_timer);
+
+         return 0;
+      }
+
+      pgprtdbg_log_lock();
+      pgprtdbg_log_line("pgprtdbg: Could not connect to %s:%d", config->server[session->server].host, config->server[session->server].port);
+      pgprtdbg_log_unlock();
+
+      /* Fail over to the next server */
+      pgprtdbg_server_failure(session->server);
+      session->tried |= 1U << session->server;
+      session->address = 0;
+
+      if (pgprtdbg_server_select(session->tried, &session->server))
+      {
+         return 1;
+      }
+   }
+}
+
+static int
+session_connected(struct worker_loop* wl, struct worker_session* session)
+{
+   int client_fd = session->client_io.client_fd;
+   int server_fd = session->server_io.server_fd;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   atomic_fetch_add(&config->server[session->server].connections, 1);
+   session->connected = true;
+   session->decoder->server = session->server;
+
+   pgprtdbg_server_success(session->server);
+
+   if (wl->uring != NULL)
+   {
+      /* io_uring sessions use blocking sockets */
+      pgprtdbg_socket_nonblocking(client_fd, false);
+      pgprtdbg_socket_nonblocking(server_fd, false);
+
+      if (pgprtdbg_uring_session_start(wl->uring, session))
+      {
+         pgprtdbg_worker_session_finish(wl->loop, session, WORKER_FAILURE);
+         return 1;
+      }
+
+      return 0;
+   }
+
+   /* Writes never block; pending output is queued instead */
+   pgprtdbg_socket_nonblocking(client_fd, true);
+
+   if (config->passthrough && pipeline_splice_available())
+   {
+      if (pipeline_splice_init(&session->client_io, true) || pipeline_splice_init(&session->server_io, false))
+      {
+         pgprtdbg_worker_session_finish(wl->loop, session, WORKER_FAILURE);
+         return 1;
+      }
+
+      ev_io_init((struct ev_io*)&session->client_io, pipeline_splice_client, client_fd, EV_READ);
+      ev_io_init((struct ev_io*)&session->server_io, pipeline_splice_server, server_fd, EV_READ);
+   }
+   else
+   {
+      ev_io_init((struct ev_io*)&session->client_io, pipeline_client, client_fd, EV_READ);
+      ev_io_init((struct ev_io*)&session->server_io, pipeline_server, server_fd, EV_READ);
+   }
+
+   ev_io_start(wl->loop, (struct ev_io*)&session->client_io);
+   ev_io_start(wl->loop, (struct ev_io*)&session->server_io);
+
+   return 0;
+}
+
+static void
+connect_cb(struct ev_loop* loop, struct ev_io* watcher, int revents)
+{
+   struct worker_session* session = (struct worker_session*)watcher->data;
+
+   ev_io_stop(loop, &session->connect_io);
+   ev_timer_stop(loop, &session->connect_timer);
+
+   if (pgprtdbg_connect_result(session->server_io.server_fd))
+   {
+      connect_retry(loop, session);
+      return;
+   }
+
+   session_connected(session->owner, session);
+}
+
+static void
+connect_timeout_cb(struct ev_loop* loop, struct ev_timer* watcher, int revents)
+{
+   struct worker_session* session = (struct worker_session*)watcher->data;
+
+   ev_io_stop(loop, &session->connect_io);
+
+   pgprtdbg_log_lock();
+   pgprtdbg_log_line("pgprtdbg: Connect timeout");
+   pgprtdbg_log_unlock();
+
+   connect_retry(loop, session);
+}
+
+static void
+connect_retry(struct ev_loop* loop, struct worker_session* session)
+{
+   pgprtdbg_disconnect(session->server_io.server_fd);
+   session->client_io.server_fd = -1;
+   session->server_io.server_fd = -1;
+   session->address++;
+
+   if (session_connect(session->owner, session))
+   {
+      pgprtdbg_worker_session_finish(loop, session, WORKER_FAILURE);
+   }
+}
+
+static void
+startup_cb(struct ev_loop* loop, struct ev_io* watcher, int revents)
+{
+   char packet[CANCEL_REQUEST_LENGTH];
+   ssize_t r;
+   int server;
+   struct worker_session* session = (struct worker_session*)watcher->data;
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   /* Only peek, so the pipeline forwards the message as usual */
+   r = recv(session->client_io.client_fd, &packet[0], sizeof(packet), MSG_PEEK | MSG_DONTWAIT);
+
+   if (r == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+   {
+      errno = 0;
+      return;
+   }
+
+   if (r <= 0)
+   {
+      errno = 0;
+      pgprtdbg_worker_session_finish(loop, session, r == 0 ? WORKER_SUCCESS : WORKER_FAILURE);
+      return;
+   }
+
+   if (r < 8)
+   {
+      startup_retry(loop, session, 8);
+      return;
+   }
+
+   if (pgprtdbg_read_int32(&packet[0]) == CANCEL_REQUEST_LENGTH &&
+       pgprtdbg_read_int32(&packet[4]) == CANCEL_REQUEST_CODE)
+   {
+      if (r < CANCEL_REQUEST_LENGTH)
+      {
+         startup_retry(loop, session, CANCEL_REQUEST_LENGTH);
+         return;
+      }
+
+      if (!pgprtdbg_server_key_find(pgprtdbg_read_int32(&packet[8]), pgprtdbg_read_int32(&packet[12]), &server))
+      {
+         if (server != session->server)
+         {
+            pgprtdbg_disconnect(session->server_io.server_fd);
+            session->client_io.server_fd = -1;
+            session->server_io.server_fd = -1;
+            session->server = server;
+         }
+      }
+      else
+      {
+         /* The session wasn't decoded, so every server gets it */
+         if (session->server == -1)
+         {
+            pgprtdbg_server_select(session->tried, &session->server);
+         }
+
+         for (int i = 0; i < config->number_of_servers; i++)
+         {
+            if (i != session->server)
+            {
+               pgprtdbg_server_cancel(loop, i, &packet[0]);
+            }
+         }
+      }
+   }
+
+   ev_io_stop(loop, &session->connect_io);
+   ev_timer_stop(loop, &session->connect_timer);
+   ev_timer_stop(loop, &session->retry_timer);
+   pgprtdbg_socket_rcvlowat(watcher->fd, 1);
+
+   session_route(session->owner, session);
+}
+
+static void
+startup_retry(struct ev_loop* loop, struct worker_session* session, int bytes)
+{
+   /* The watcher is level-triggered and a Unix socket ignores the low-water mark,
+    * so the watcher rests until the retry timer instead of firing again at once */
+   ev_io_stop(loop, &session->connect_io);
+   pgprtdbg_socket_rcvlowat(session->client_io.client_fd, bytes);
+
+   ev_timer_init(&session->retry_timer, startup_retry_cb, STARTUP_RETRY, 0.);
+   session->retry_timer.data = session;
+   ev_timer_start(loop, &session->retry_timer);
+}
+
+static void
+startup_retry_cb(struct ev_loop* loop, struct ev_timer* watcher, int revents)
+{
+   struct worker_session* session = (struct worker_session*)watcher->data;
+
+   ev_io_start(loop, &session->connect_io);
+}
+
+static void
+startup_timeout_cb(struct ev_loop* loop, struct ev_timer* watcher, int revents)
+{
+   struct worker_session* session = (struct worker_session*)watcher->data;
+
+   pgprtdbg_log_lock();
+   pgprtdbg_log_line("pgprtdbg: Startup timeout");
+   pgprtdbg_log_unlock();
+
+   pgprtdbg_worker_session_finish(loop, session, WORKER_FAILURE);
+}
+
+static void
+start_accept(struct worker_loop* wl)
+{
+   for (int i = 0; i < wl->accept_ios_length; i++)
+   {
+      ev_io_start(wl->loop, (struct ev_io*)&wl->accept_ios[i]);
    }
 
-   pgprtdbg_disconnect(client_fd);
-   pgprtdbg_disconnect(server_fd);
+   wl->accepting = wl->accept_ios_length > 0;
+}
 
-   if (loop)
+static void
+stop_accept(struct worker_loop* wl)
+{
+   for (int i = 0; i < wl->accept_ios_length; i++)
    {
-      ev_io_stop(loop, (struct ev_io*)&client_io);
-      ev_io_stop(loop, (struct ev_io*)&server_io);
+      ev_io_stop(wl->loop, (struct ev_io*)&wl->accept_ios[i]);
+   }
 
-      ev_signal_stop(loop, &signal_watcher);
+   wl->accepting = false;
+}
+
+static void
+accept_cb(struct ev_loop* loop, struct ev_io* watcher, int revents)
+{
+   struct sockaddr_storage peer;
+   int client_fd;
+   struct accept_io* ai;
+
+   ai = (struct accept_io*)watcher;
 
-      ev_loop_destroy(loop);
+   if (EV_ERROR & revents)
+   {
+      return;
    }
 
-   for (int i = 0; i < MAX_NUMBER_OF_CONNECTIONS; i++)
+   /* Take the whole burst, as long as the loop accepts sessions */
+   while (ai->owner->accepting && pgprtdbg_admission_open(ai->owner->admission))
    {
-      if (config->pids[i] == pid)
+      if (pgprtdbg_accept(watcher->fd, &peer, &client_fd))
       {
-         config->pids[i] = 0;
          break;
       }
+
+      pgprtdbg_admission_offer(ai->owner->admission, client_fd, &peer);
    }
+}
+
+static void
+loop_accept(void* data, bool start)
+{
+   struct worker_loop* wl = (struct worker_loop*)data;
+
+   wl->paused = !start;
 
-   if (connected)
+   if (!start)
    {
-      atomic_fetch_sub(&config->active_connections, 1);
+      stop_accept(wl);
    }
+   else if (wl->keep_running && !wl->accepting && (wl->max_sessions == 0 || wl->sessions < wl->max_sessions))
+   {
+      start_accept(wl);
+   }
+}
 
-   pgprtdbg_memory_destroy();
-   pgprtdbg_stop_logging();
+static void
+loop_admit(void* data, int client_fd, int slot, struct sockaddr_storage* peer)
+{
+   session_start((struct worker_loop*)data, client_fd, slot, -1, -1, peer);
+}
+
+static void
+stop_cb(struct ev_loop* loop, struct ev_async* w, int revents)
+{
+   struct worker_loop* wl = (struct worker_loop*)w->data;
 
-   exit(exit_code);
+   wl->keep_running = false;
+   ev_break(loop, EVBREAK_ALL);
+}
+
+static void
+flush_cb(struct ev_loop* loop, struct ev_timer* watcher, int revents)
+{
+   pgprtdbg_output_flush();
 }
 
 static void
 sigquit_cb(struct ev_loop* loop, ev_signal* w, int revents)
 {
-   exit_code = WORKER_FAILURE;
-   running = 0;
+   struct worker_loop* wl = (struct worker_loop*)w->data;
+
+   wl->keep_running = false;
+   wl->exit_code = WORKER_FAILURE;
    ev_break(loop, EVBREAK_ALL);
 }
@@ -28,10 +28,16 @@
 
 /* pgprtdbg */
 #include <pgprtdbg.h>
+#include <admission.h>
 #include <configuration.h>
 #include <logging.h>
 #include <network.h>
+#include <output.h>
+#include <pool.h>
+#include <server.h>
 #include <shmem.h>
+#include <slot.h>
+#include <trace.h>
 #include <utils.h>
 #include <worker.h>
 #include <counter.h>
@@ -50,12 +56,20 @@
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
 
 #define MAX_FDS 64
 
+#define SHMEM_ALIGNMENT 64
+
 static void accept_cb(struct ev_loop* loop, struct ev_io* watcher, int revents);
+static void accept_pause(void* data, bool start);
+static void admit(void* data, int client_fd, int slot, struct sockaddr_storage* peer);
 static void shutdown_cb(struct ev_loop* loop, ev_signal* w, int revents);
 static void coredump_cb(struct ev_loop* loop, ev_signal* w, int revents);
+static void worker_cb(struct ev_loop* loop, ev_child* w, int revents);
+static void writer_cb(struct ev_loop* loop, ev_child* w, int revents);
+static size_t shmem_region(size_t* size, size_t region_size);
 
 struct accept_io
 {
@@ -75,7 +89,10 @@ static struct accept_io io_uds;
 static int unix_pgsql_socket = -1;
 static int* main_fds = NULL;
 static int main_fds_length;
-static int client_number = 0;
+static struct ev_child* workers = NULL;
+static struct ev_child writer;
+static struct pool* pool = NULL;
+static struct admission* admission = NULL;
 
 static void
 start_io(void)
@@ -85,6 +102,7 @@ start_io(void)
       int sockfd = *(main_fds + i);
 
       memset(&io_main[i], 0, sizeof(struct accept_io));
+      pgprtdbg_socket_nonblocking(sockfd, true);
       ev_io_init((struct ev_io*)&io_main[i], accept_cb, sockfd, EV_READ);
       io_main[i].socket = sockfd;
       ev_io_start(main_loop, (struct ev_io*)&io_main[i]);
@@ -105,6 +123,7 @@ static void
 start_uds(void)
 {
    memset(&io_uds, 0, sizeof(struct accept_io));
+   pgprtdbg_socket_nonblocking(unix_pgsql_socket, true);
    ev_io_init((struct ev_io*)&io_uds, accept_cb, unix_pgsql_socket, EV_READ);
    io_uds.socket = unix_pgsql_socket;
    ev_io_start(main_loop, (struct ev_io*)&io_uds);
@@ -128,6 +147,67 @@ shutdown_uds(void)
    errno = 0;
 }
 
+static void
+start_worker(int index)
+{
+   pid_t pid;
+
+   pid = fork();
+
+   if (pid == -1)
+   {
+      pgprtdbg_log_lock();
+      pgprtdbg_log_line("pgprtdbg: Could not fork worker %d", index);
+      pgprtdbg_log_unlock();
+      return;
+   }
+
+   if (pid == 0)
+   {
+      ev_loop_fork(main_loop);
+      pgprtdbg_worker_pool(unix_pgsql_socket);
+   }
+
+   ev_child_init(&workers[index], worker_cb, pid, 0);
+   ev_child_start(main_loop, &workers[index]);
+}
+
+static void
+start_workers(void)
+{
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   workers = (struct ev_child*)malloc(config->workers * sizeof(struct ev_child));
+   memset(workers, 0, config->workers * sizeof(struct ev_child));
+
+   for (int i = 0; i < config->workers; i++)
+   {
+      start_worker(i);
+   }
+}
+
+static void
+shutdown_workers(void)
+{
+   struct configuration* config;
+
+   config = (struct configuration*)shmem;
+
+   for (int i = 0; i < config->workers; i++)
+   {
+      if (ev_is_active(&workers[i]))
+      {
+         kill(workers[i].pid, SIGQUIT);
+      }
+      ev_child_stop(main_loop, &workers[i]);
+   }
+
+   free(workers);
+   workers = NULL;
+}
+
 static void
 version()
 {
@@ -163,7 +243,7 @@ main(int argc, char** argv)
    pid_t pid, sid;
    struct ev_signal signal_watcher[6];
    size_t configuration_size;
-   size_t event_counters_size;
+   size_t shmem_size;
    char pgsql[MISC_LENGTH];
    struct configuration* config = NULL;
    int c;
@@ -175,7 +255,8 @@ main(int argc, char** argv)
          {"config", required_argument, 0, 'c'},
          {"daemon", no_argument, 0, 'd'},
          {"version", no_argument, 0, 'V'},
-         {"help", no_argument, 0, '?'}
+         {"help", no_argument, 0, '?'},
+         {0, 0, 0, 0}
       };
       int option_index = 0;
 
@@ -213,8 +294,7 @@ main(int argc, char** argv)
    }
 
    configuration_size = sizeof(struct configuration);
-   event_counters_size = sizeof(struct event_counter) * (MAX_NUMBER_OF_COUNTERS + 1); /* +1 to prevent overflow */
-   if (pgprtdbg_create_shared_memory(configuration_size + event_counters_size))
+   if (pgprtdbg_create_shared_memory(configuration_size))
    {
       printf("pgagroal: Error in creating shared memory\n");
       exit(1);
@@ -243,8 +323,22 @@ main(int argc, char** argv)
       exit(1);
    }
 
+   /* The rest of the segment is sized by the configuration */
+   shmem_size = configuration_size;
+   event_counters_offset = shmem_region(&shmem_size, pgprtdbg_counter_size());
+   slots_offset = shmem_region(&shmem_size, pgprtdbg_slot_size());
+   keys_offset = shmem_region(&shmem_size, pgprtdbg_server_key_size());
+   trace_offset = shmem_region(&shmem_size, pgprtdbg_trace_size());
+   if (pgprtdbg_resize_shared_memory(configuration_size, shmem_size))
+   {
+      printf("pgprtdbg: Error in creating shared memory\n");
+      exit(1);
+   }
+
    config = (struct configuration*)shmem;
 
+   pgprtdbg_slot_init();
+
    if (daemon)
    {
       if (config->log_type == PGPRTDBG_LOGGING_TYPE_CONSOLE)
@@ -279,7 +373,32 @@ main(int argc, char** argv)
    pgprtdbg_start_logging();
 
    /* Open file */
-   config->file = fopen(config->output, "a+");
+   if (pgprtdbg_output_open())
+   {
+      printf("pgprtdbg: Could not open the output %s\n", config->output);
+      exit(1);
+   }
+
+   if (config->trace_writer)
+   {
+      pgprtdbg_trace_init();
+
+      pid = pgprtdbg_trace_writer_start();
+      if (pid < 0)
+      {
+         printf("pgprtdbg: Could not start the trace writer\n");
+         exit(1);
+      }
+
+      ev_child_init(&writer, writer_cb, pid, 0);
+   }
+
+   /* Resolve the server once, instead of for each connection */
+   if (pgprtdbg_resolver_start())
+   {
+      printf("pgprtdbg: Could not start the resolver\n");
+      exit(1);
+   }
 
    memset(&pgsql, 0, sizeof(pgsql));
    snprintf(&pgsql[0], sizeof(pgsql), ".s.PGSQL.%d", config->port);
@@ -294,11 +413,14 @@ main(int argc, char** argv)
       }
    }
 
-   /* Bind main socket */
-   if (pgprtdbg_bind(config->host, config->port, &main_fds, &main_fds_length))
+   /* Bind main socket; pre-forked workers and threads bind their own */
+   if (config->workers == 0 && config->threads == 0)
    {
-      printf("pgprtdbg: Could not bind to %s:%d\n", config->host, config->port);
-      exit(1);
+      if (pgprtdbg_bind(config->host, config->port, &main_fds, &main_fds_length))
+      {
+         printf("pgprtdbg: Could not bind to %s:%d\n", config->host, config->port);
+         exit(1);
+      }
    }
 
    if (main_fds_length > MAX_FDS)
@@ -328,11 +450,42 @@ main(int argc, char** argv)
       ev_signal_start(main_loop, &signal_watcher[i]);
    }
 
-   if (strlen(config->unix_socket_dir) > 0)
+   if (config->trace_writer)
+   {
+      ev_child_start(main_loop, &writer);
+   }
+
+   if (config->workers > 0)
+   {
+      start_workers();
+   }
+   else if (config->threads > 0)
    {
-      start_uds();
+      if (pgprtdbg_worker_threads_start(unix_pgsql_socket))
+      {
+         printf("pgprtdbg: Could not start %d threads\n", config->threads);
+         exit(1);
+      }
+   }
+   else
+   {
+      if (strlen(config->unix_socket_dir) > 0)
+      {
+         start_uds();
+      }
+      start_io();
+
+      if (pgprtdbg_admission_init(main_loop, accept_pause, admit, NULL, &admission))
+      {
+         printf("pgprtdbg: Could not create the admission queue\n");
+         exit(1);
+      }
+
+      if (config->pool_size > 0)
+      {
+         pgprtdbg_pool_init(main_loop, config->pool_size, &pool);
+      }
    }
-   start_io();
 
    pgprtdbg_log_lock();
    pgprtdbg_log_line("--------");
@@ -342,10 +495,19 @@ main(int argc, char** argv)
    {
       pgprtdbg_log_line("Socket %d", *(main_fds + i));
    }
+   if (config->workers > 0)
+   {
+      pgprtdbg_log_line("Workers: %d", config->workers);
+   }
+   if (config->threads > 0)
+   {
+      pgprtdbg_log_line("Threads: %d", config->threads);
+   }
    pgprtdbg_libev_engines();
    pgprtdbg_log_line("libev engine: %s", pgprtdbg_libev_engine(ev_backend(main_loop)));
+   pgprtdbg_log_line("Max connections: %d", config->max_connections);
    pgprtdbg_log_line("Configuration size: %lu", configuration_size);
-   pgprtdbg_log_line("Event counters size: %lu", event_counters_size);
+   pgprtdbg_log_line("Shared memory size: %lu", shmem_size);
    pgprtdbg_log_unlock();
 
    while (keep_running)
@@ -357,22 +519,45 @@ main(int argc, char** argv)
    pgprtdbg_log_line("pgprtdbg: shutdown");
    pgprtdbg_log_unlock();
 
+   if (config->workers > 0)
+   {
+      shutdown_workers();
+   }
+
+   if (config->threads > 0)
+   {
+      pgprtdbg_worker_threads_stop();
+   }
+
    shutdown_io();
    if (strlen(config->unix_socket_dir) > 0)
    {
       shutdown_uds();
    }
 
+   pgprtdbg_admission_destroy(admission);
+   admission = NULL;
+
+   pgprtdbg_pool_destroy(pool);
+   pool = NULL;
+
    for (int i = 0; i < 6; i++)
    {
       ev_signal_stop(main_loop, &signal_watcher[i]);
    }
 
-   for (int i = 0; i < MAX_NUMBER_OF_CONNECTIONS; i++)
+   if (ev_is_active(&writer))
+   {
+      ev_child_stop(main_loop, &writer);
+   }
+
+   for (int i = 0; i < atomic_load(&config->clients); i++)
    {
-      if (config->pids[i] != 0)
+      pid_t pid = pgprtdbg_slot_pid(i);
+
+      if (pid != 0)
       {
-         kill(config->pids[i], SIGQUIT);
+         kill(pid, SIGQUIT);
       }
    }
 
@@ -380,14 +565,16 @@ main(int argc, char** argv)
 
    free(main_fds);
 
-   pgprtdbg_counter_output_statistics(client_number);
+   pgprtdbg_resolver_stop();
+   pgprtdbg_trace_writer_stop(writer.pid);
+
+   pgprtdbg_counter_output_statistics(atomic_load(&config->clients));
 
    /* Close file */
-   fflush(config->file);
-   fclose(config->file);
+   pgprtdbg_output_close();
 
    pgprtdbg_stop_logging();
-   pgprtdbg_destroy_shared_memory(configuration_size + event_counters_size);
+   pgprtdbg_destroy_shared_memory(shmem_size);
 
    return 0;
 }
@@ -395,54 +582,88 @@ main(int argc, char** argv)
 static void
 accept_cb(struct ev_loop* loop, struct ev_io* watcher, int revents)
 {
-   struct sockaddr_in client_addr;
-   socklen_t client_addr_length;
+   struct sockaddr_storage peer;
    int client_fd;
-   struct accept_io* ai;
-   struct configuration* config;
-
-   ai = (struct accept_io*)watcher;
-   config = (struct configuration*)shmem;
 
    if (EV_ERROR & revents)
    {
       return;
    }
 
-   if (atomic_load(&config->active_connections) > MAX_NUMBER_OF_CONNECTIONS)
+   /* Take the whole burst */
+   while (pgprtdbg_admission_open(admission))
    {
-      return;
+      if (pgprtdbg_accept(watcher->fd, &peer, &client_fd))
+      {
+         return;
+      }
+
+      pgprtdbg_admission_offer(admission, client_fd, &peer);
    }
+}
 
-   client_addr_length = sizeof(client_addr);
-   client_fd = accept(watcher->fd, (struct sockaddr*)&client_addr, &client_addr_length);
-   if (client_fd == -1)
+static void
+accept_pause(void* data, bool start)
+{
+   for (int i = 0; i < main_fds_length; i++)
    {
-      return;
+      if (start)
+      {
+         ev_io_start(main_loop, (struct ev_io*)&io_main[i]);
+      }
+      else
+      {
+         ev_io_stop(main_loop, (struct ev_io*)&io_main[i]);
+      }
    }
 
-   if (!fork())
+   if (unix_pgsql_socket != -1)
    {
-      ev_loop_fork(loop);
-      shutdown_io();
-      pgprtdbg_disconnect(ai->socket);
-      pgprtdbg_worker(client_fd, client_number);
+      if (start)
+      {
+         ev_io_start(main_loop, (struct ev_io*)&io_uds);
+      }
+      else
+      {
+         ev_io_stop(main_loop, (struct ev_io*)&io_uds);
+      }
    }
+}
+
+static void
+admit(void* data, int client_fd, int slot, struct sockaddr_storage* peer)
+{
+   pid_t pid;
+   int server;
+   int server_fd = -1;
 
-   /* event_counters array is initialized with size MAX_NUMBER_OF_COUNTERS + 1 and client_number will be
-    * mostly at the last element, which is ignored in output statistics */
-   if (client_number < MAX_NUMBER_OF_COUNTERS)
+   if (pgprtdbg_server_select(0, &server) || pgprtdbg_pool_get(pool, server, &server_fd))
    {
-      client_number++;
+      server = -1;
    }
-   else  /* past this, everything will be dumped in the trash counter */
+
+   pid = fork();
+
+   if (pid == 0)
+   {
+      ev_loop_fork(main_loop);
+      shutdown_io();
+      pgprtdbg_disconnect(unix_pgsql_socket);
+      pgprtdbg_pool_forget(pool);
+      pgprtdbg_admission_forget(admission);
+      pgprtdbg_worker(client_fd, slot, server, server_fd, peer);
+   }
+   else if (pid == -1)
    {
       pgprtdbg_log_lock();
-      pgprtdbg_log_line("pgprtdbg: maximum number of counters reached.\n");
+      pgprtdbg_log_line("pgprtdbg: Could not fork for client: %d", client_fd);
       pgprtdbg_log_unlock();
+
+      pgprtdbg_admission_release(slot);
    }
 
    pgprtdbg_disconnect(client_fd);
+   pgprtdbg_disconnect(server_fd);
 }
 
 static void
@@ -457,3 +678,76 @@ coredump_cb(struct ev_loop* loop, ev_signal* w, int revents)
 {
    abort();
 }
+
+static void
+worker_cb(struct ev_loop* loop, ev_child* w, int revents)
+{
+   int index;
+   int status;
+
+   index = (int)(w - workers);
+   status = WIFEXITED(w->rstatus) ? WEXITSTATUS(w->rstatus) : WORKER_FAILURE;
+
+   ev_child_stop(loop, w);
+
+   if (!keep_running)
+   {
+      return;
+   }
+
+   if (status == WORKER_BIND_FAILURE)
+   {
+      pgprtdbg_log_lock();
+      pgprtdbg_log_line("pgprtdbg: Worker %d could not bind, not restarting", w->rpid);
+      pgprtdbg_log_unlock();
+      return;
+   }
+
+   pgprtdbg_log_lock();
+   pgprtdbg_log_line("pgprtdbg: Worker %d exited (%d), restarting", w->rpid, status);
+   pgprtdbg_log_unlock();
+
+   start_worker(index);
+}
+
+static void
+writer_cb(struct ev_loop* loop, ev_child* w, int revents)
+{
+   pid_t pid;
+
+   ev_child_stop(loop, w);
+
+   if (!keep_running)
+   {
+      return;
+   }
+
+   pgprtdbg_log_lock();
+   pgprtdbg_log_line("pgprtdbg: Trace writer %d exited (%d), restarting", w->rpid, w->rstatus);
+   pgprtdbg_log_unlock();
+
+   /* The rings are kept in shared memory, so the new writer continues where the old one stopped */
+   pid = pgprtdbg_trace_writer_start();
+   if (pid < 0)
+   {
+      pgprtdbg_log_lock();
+      pgprtdbg_log_line("pgprtdbg: Could not restart the trace writer");
+      pgprtdbg_log_unlock();
+      ev_child_set(w, 0, 0);
+      return;
+   }
+
+   ev_child_set(w, pid, 0);
+   ev_child_start(loop, w);
+}
+
+static size_t
+shmem_region(size_t* size, size_t region_size)
+{
+   size_t offset;
+
+   offset = (*size + SHMEM_ALIGNMENT - 1) & ~((size_t)SHMEM_ALIGNMENT - 1);
+   *size = offset + region_size;
+
+   return offset;
+}